@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+#if defined(__linux__)
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+#endif
+
+#define COPY_NO_REFLINK (0x1 << 0)
+#define COPY_NO_KERNEL_COPY (0x1 << 1)
+
+
+struct assembly_thread_arg {
+    fz_ctx_t *ctx;
+    fz_file_manifest_t *mnfst;
+    fz_chunk_loc_t *chunk_locs;
+    int dest_fd;
+    int *failed;
+    size_t block_size;
+    size_t *next_chunk;
+    pthread_mutex_t *mtx;
+};
+
+
+/* Keyed by the address of the path, every location of the same file shares one string */
+struct src_fd_map_s {const char *key; int fd; size_t size;};
+
+
+static void* assemble_chunks(void *arg);
+static inline void close_src_fds(struct src_fd_map_s *src_fds);
+static inline int verify_blob(fz_blob_handle_t *blob, fz_hex_digest_t chunk_checksum, size_t chunk_size, char **buffer, size_t *max_alloc);
+static inline int copy_range(int src_fd, off_t src_off, int dest_fd, off_t dest_off, size_t len, size_t block_size, int *copy_flags, char **buffer, size_t *max_alloc);
+static inline int read_full(int fd, char *buffer, size_t size, off_t offset);
+static inline int write_full(int fd, const char *buffer, size_t size, off_t offset);
+
+
+/* Writes every chunk of the manifest into `dest_fd` at its cutpoint, the destination is preallocated to `file_size` so workers can pwrite concurrently.
+`chunk_locs` is either NULL or has one entry per chunk of the manifest, entries with a `file_path` are copied from that file instead of the blob store */
+extern int fz_assemble_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_loc_t *chunk_locs, int dest_fd){
+    int result = 1;
+    int failed = 0;
+    size_t next_chunk = 0;
+    size_t nthreads = 0;
+    pthread_t *threads = NULL;
+    pthread_mutex_t mtx;
+
+    pthread_mutex_init(&mtx, NULL);
+    if (0 != ftruncate(dest_fd, (off_t)mnfst->file_size)) {
+        fz_log(FZ_ERROR, "Failed to resize destination file to %lu byte(s)", mnfst->file_size);
+        RETURN_DEFER(0);
+    }
+#if defined(__linux__)
+    /* Preallocation is only a hint, filesystems without fallocate support still work with the sparse file */
+    if (0 != fallocate(dest_fd, 0, 0, (off_t)mnfst->file_size)) {
+        fz_log(FZ_INFO, "Preallocation not supported for destination file, continuing without it");
+    }
+#endif
+
+    struct stat dest_meta = {0};
+    size_t block_size = 0;
+    if (0 == fstat(dest_fd, &dest_meta) && 0 < dest_meta.st_blksize) block_size = (size_t)dest_meta.st_blksize;
+
+    nthreads = ctx->max_threads;
+    if (0 == nthreads) nthreads = 1;
+    if (nthreads > mnfst->chunk_seq.chunk_seq_len) nthreads = mnfst->chunk_seq.chunk_seq_len;
+
+    threads = calloc(nthreads, sizeof(pthread_t));
+    if (NULL == threads) {
+        fz_log(FZ_ERROR, "Out of memory error in %s", __func__);
+        RETURN_DEFER(0);
+    }
+
+    struct assembly_thread_arg arg = {
+        .ctx = ctx,
+        .mnfst = mnfst,
+        .chunk_locs = chunk_locs,
+        .dest_fd = dest_fd,
+        .failed = &failed,
+        .block_size = block_size,
+        .next_chunk = &next_chunk,
+        .mtx = &mtx,
+    };
+    size_t spawned = 0;
+    for (; spawned < nthreads; spawned++){
+        if (0 != pthread_create(&threads[spawned], NULL, assemble_chunks, &arg)) {
+            pthread_mutex_lock(&mtx);
+            failed = 1;
+            pthread_mutex_unlock(&mtx);
+            break;
+        }
+    }
+    for (size_t i = 0; i < spawned; i++) pthread_join(threads[i], NULL);
+    if (failed) {
+        fz_log(FZ_ERROR, "Failed to assemble file from chunks");
+        RETURN_DEFER(0);
+    }
+    defer:
+        if (NULL != threads) free(threads);
+        pthread_mutex_destroy(&mtx);
+        return result;
+}
+
+
+static void* assemble_chunks(void *arg){
+    struct assembly_thread_arg *t_arg = (struct assembly_thread_arg *)arg;
+    fz_file_manifest_t *mnfst = t_arg->mnfst;
+    char *buffer = NULL;
+    size_t max_alloc = 0;
+    int copy_flags = 0;
+    struct src_fd_map_s *src_fds = NULL;
+
+    while (1){
+        size_t i = 0;
+        pthread_mutex_lock(t_arg->mtx);
+        if (*t_arg->failed || *t_arg->next_chunk >= mnfst->chunk_seq.chunk_seq_len) {
+            pthread_mutex_unlock(t_arg->mtx);
+            break;
+        }
+        i = (*t_arg->next_chunk)++;
+        pthread_mutex_unlock(t_arg->mtx);
+
+        size_t cutpoint = mnfst->chunk_seq.cutpoint[i];
+        if (cutpoint >= mnfst->file_size) continue;
+
+        /* The trailing chunk is zero padded to the full chunk size, only the bytes within the file are written */
+        size_t len = mnfst->file_size - cutpoint;
+        if (len > mnfst->chunk_seq.chunk_size[i]) len = mnfst->chunk_seq.chunk_size[i];
+
+        fz_chunk_loc_t *loc = (NULL != t_arg->chunk_locs)? &t_arg->chunk_locs[i] : NULL;
+        if (NULL != loc && NULL != loc->file_path){
+            /* Source files are shared by many chunks, keep them open for the lifetime of the worker */
+            struct src_fd_map_s *src = hmgetp_null(src_fds, loc->file_path);
+            if (NULL == src){
+                struct src_fd_map_s entry = {.key = loc->file_path, .fd = open(loc->file_path, O_RDONLY), .size = 0};
+                struct stat src_meta = {0};
+                if (-1 == entry.fd || 0 != fstat(entry.fd, &src_meta)) {
+                    fz_log(FZ_ERROR, "Scavenged source file `%s` is no longer readable", loc->file_path);
+                    if (-1 != entry.fd) close(entry.fd);
+                    goto failed;
+                }
+                int64_t mtime_ns = (int64_t)src_meta.st_mtim.tv_sec * 1000000000LL + src_meta.st_mtim.tv_nsec;
+                if ((size_t)src_meta.st_size != loc->file_size || mtime_ns != loc->mtime_ns) {
+                    fz_log(FZ_ERROR, "Scavenged source file `%s` changed after its chunks were verified", loc->file_path);
+                    close(entry.fd);
+                    goto failed;
+                }
+                entry.size = (size_t)src_meta.st_size;
+                hmputs(src_fds, entry);
+                src = hmgetp_null(src_fds, loc->file_path);
+            }
+            /* A chunk that was the short tail of its source file is zero padded, the destination is already zero filled past the copied bytes */
+            if (loc->offset >= src->size) continue;
+            if (len > src->size - loc->offset) len = src->size - loc->offset;
+            if (!copy_range(src->fd, (off_t)loc->offset, t_arg->dest_fd, (off_t)cutpoint, len, t_arg->block_size, &copy_flags, &buffer, &max_alloc)) goto failed;
+            continue;
+        }
+
+        /* Once the filesystem refused a reflink every path writes the bytes, a cached chunk saves reading them back */
+        size_t cached_size = 0;
+        if ((copy_flags & COPY_NO_REFLINK)
+            && fz_chunk_cache_get(&t_arg->ctx->chunk_cache, mnfst->chunk_seq.chunk_checksum[i], &buffer, &max_alloc, &cached_size)
+            && cached_size >= len){
+            if (!write_full(t_arg->dest_fd, buffer, len, (off_t)cutpoint)) goto failed;
+            continue;
+        }
+
+        fz_blob_handle_t blob = {0};
+        if (!fz_blob_store_open(t_arg->ctx, mnfst->chunk_seq.chunk_checksum[i], &blob)) {
+            /* The next transfer of this chunk downloads it instead of trusting the index again */
+            fz_blob_state_forget(t_arg->ctx, mnfst->chunk_seq.chunk_checksum[i]);
+            fz_log(FZ_ERROR, "Missing chunk `%016llx` during assembly", mnfst->chunk_seq.chunk_checksum[i]);
+            goto failed;
+        }
+        int ok = 1;
+        if (blob.changed){
+            /* The blob was touched after it was verified, it is only used if its content still hashes to the checksum */
+            ok = verify_blob(&blob, mnfst->chunk_seq.chunk_checksum[i], mnfst->chunk_seq.chunk_size[i], &buffer, &max_alloc);
+            if (ok) fz_chunk_cache_put(&t_arg->ctx->chunk_cache, mnfst->chunk_seq.chunk_checksum[i], buffer, mnfst->chunk_seq.chunk_size[i]);
+            if (ok) ok = write_full(t_arg->dest_fd, buffer, len, (off_t)cutpoint);
+            else fz_log(FZ_ERROR, "Blob `%016llx` no longer matches its checksum", mnfst->chunk_seq.chunk_checksum[i]);
+        } else if (0 != blob.raw_size){
+            /* Compressed records can be neither cloned nor copied in the kernel, they are decoded unless the cache holds the chunk.
+            Without reflinks the cache was already asked above */
+            size_t size = 0;
+            int cached = !(copy_flags & COPY_NO_REFLINK)
+                && fz_chunk_cache_get(&t_arg->ctx->chunk_cache, mnfst->chunk_seq.chunk_checksum[i], &buffer, &max_alloc, &size)
+                && size >= len;
+            if (!cached){
+                ok = fz_blob_store_read(&blob, &buffer, &max_alloc, &size) && size >= len;
+                if (ok) fz_chunk_cache_put(&t_arg->ctx->chunk_cache, mnfst->chunk_seq.chunk_checksum[i], buffer, size);
+                else fz_log(FZ_ERROR, "Failed to decode compressed chunk `%016llx`", mnfst->chunk_seq.chunk_checksum[i]);
+            }
+            if (ok) ok = write_full(t_arg->dest_fd, buffer, len, (off_t)cutpoint);
+        } else {
+            ok = copy_range(blob.fd, (off_t)blob.offset, t_arg->dest_fd, (off_t)cutpoint, len, t_arg->block_size, &copy_flags, &buffer, &max_alloc);
+        }
+        fz_blob_store_release(&blob);
+        if (!ok) goto failed;
+    }
+    close_src_fds(src_fds);
+    if (NULL != buffer) free(buffer);
+    return NULL;
+
+    failed:
+        close_src_fds(src_fds);
+        pthread_mutex_lock(t_arg->mtx);
+        *t_arg->failed = 1;
+        pthread_mutex_unlock(t_arg->mtx);
+        if (NULL != buffer) free(buffer);
+        return NULL;
+}
+
+
+/* Copies `len` bytes between two files, cheapest first: a reflink shares the extents on XFS/btrfs, copy_file_range keeps the data in the kernel
+and pread/pwrite through `buffer` is the fallback. `copy_flags` remembers per worker which methods the filesystem refused */
+static inline int copy_range(int src_fd, off_t src_off, int dest_fd, off_t dest_off, size_t len, size_t block_size, int *copy_flags, char **buffer, size_t *max_alloc){
+#if defined(__linux__) && defined(FICLONERANGE)
+    if (!(*copy_flags & COPY_NO_REFLINK) && 0 < block_size
+        && 0 == (src_off % block_size) && 0 == (dest_off % block_size) && 0 == (len % block_size)){
+        struct file_clone_range range = {
+            .src_fd = src_fd,
+            .src_offset = (uint64_t)src_off,
+            .src_length = (uint64_t)len,
+            .dest_offset = (uint64_t)dest_off,
+        };
+        if (0 == ioctl(dest_fd, FICLONERANGE, &range)) return 1;
+        if (EOPNOTSUPP == errno || ENOTTY == errno || EXDEV == errno || EINVAL == errno) *copy_flags |= COPY_NO_REFLINK;
+    }
+#else
+    (void)block_size;
+#endif
+#if defined(__linux__)
+    if (!(*copy_flags & COPY_NO_KERNEL_COPY)){
+        loff_t in_off = src_off, out_off = dest_off;
+        size_t done = 0;
+        while (done < len){
+            ssize_t n = copy_file_range(src_fd, &in_off, dest_fd, &out_off, len - done, 0);
+            if (-1 == n && EINTR == errno) continue;
+            if (0 >= n) break;
+            done += (size_t)n;
+        }
+        if (done == len) return 1;
+        if (0 == done && (ENOSYS == errno || EXDEV == errno || EOPNOTSUPP == errno || EINVAL == errno)) *copy_flags |= COPY_NO_KERNEL_COPY;
+        src_off += (off_t)done; dest_off += (off_t)done; len -= done;
+    }
+#endif
+    if (*max_alloc < len){
+        char *temp = realloc(*buffer, len);
+        if (NULL == temp) return 0;
+        *buffer = temp;
+        *max_alloc = len;
+    }
+    return read_full(src_fd, *buffer, len, src_off) && write_full(dest_fd, *buffer, len, dest_off);
+}
+
+
+static inline void close_src_fds(struct src_fd_map_s *src_fds){
+    if (NULL == src_fds) return;
+    for (size_t i = 0; i < hmlenu(src_fds); i++) close(src_fds[i].fd);
+    hmfree(src_fds);
+}
+
+
+static inline int verify_blob(fz_blob_handle_t *blob, fz_hex_digest_t chunk_checksum, size_t chunk_size, char **buffer, size_t *max_alloc){
+    if (blob->size != chunk_size) return 0;
+    if (*max_alloc < chunk_size){
+        char *temp = realloc(*buffer, chunk_size);
+        if (NULL == temp) return 0;
+        *buffer = temp;
+        *max_alloc = chunk_size;
+    }
+    if (!read_full(blob->fd, *buffer, chunk_size, (off_t)blob->offset)) return 0;
+    fz_hex_digest_t digest = 0;
+    xxhash_hexdigest(*buffer, chunk_size, &digest);
+    return digest == chunk_checksum;
+}
+
+
+static inline int read_full(int fd, char *buffer, size_t size, off_t offset){
+    size_t done = 0;
+    while (done < size){
+        ssize_t n = pread(fd, buffer + done, size - done, offset + (off_t)done);
+        if (-1 == n && EINTR == errno) continue;
+        if (0 >= n) return 0;
+        done += (size_t)n;
+    }
+    return 1;
+}
+
+
+static inline int write_full(int fd, const char *buffer, size_t size, off_t offset){
+    size_t done = 0;
+    while (done < size){
+        ssize_t n = pwrite(fd, buffer + done, size - done, offset + (off_t)done);
+        if (-1 == n && EINTR == errno) continue;
+        if (0 >= n) return 0;
+        done += (size_t)n;
+    }
+    return 1;
+}
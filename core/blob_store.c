@@ -0,0 +1,753 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ctype.h>
+#include <dirent.h>
+#include "core.h"
+
+#define BLOB_SCRUB_INTERVAL_DEFAULT (7 * 24 * 60 * 60)
+#define PACK_SIZE_DEFAULT MB(1024)
+#define CHUNK_INDEX_SNAPSHOT "chunk_index"
+
+/* Records start on filesystem block boundaries so assembly can reflink straight out of a pack */
+#define PACK_ALIGNMENT KB(4)
+#define PACK_ALIGN(size_) (((size_) + PACK_ALIGNMENT - 1) & ~(PACK_ALIGNMENT - 1))
+
+/* Repack a sealed pack once less than this fraction (in percent) of it is still referenced */
+#define PACK_REPACK_LIVE_PERCENT 50
+
+/* Bytes per pack id, live bytes while repacking and file sizes while reconciling */
+struct pack_size_map_s {uint32_t key; size_t value;};
+
+
+static inline int64_t stat_mtime_ns(struct stat *meta);
+static inline void mark_dirty(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum);
+static inline int pack_path(fz_ctx_t *ctx, uint32_t pack_id, char *buffer, size_t buffer_size);
+static inline int snapshot_path(fz_ctx_t *ctx, char *buffer, size_t buffer_size);
+static inline int flat_blob_path(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size);
+static inline int parse_blob_name(const char *name, fz_hex_digest_t *chunk_checksum);
+static int make_shard_dirs(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum);
+static int pack_fd(fz_ctx_t *ctx, uint32_t pack_id);
+static void pack_unref(fz_pack_store_t *store, uint32_t pack_id);
+static int ensure_active_pack(fz_ctx_t *ctx);
+static int seal_active_pack(fz_ctx_t *ctx);
+static int put_packed(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size, uint32_t raw_size);
+static int put_loose(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size);
+
+
+/* Loose blobs live under two levels of shard directories named after the leading checksum bytes, `ab/cd/abcd...` */
+extern int fz_blob_path(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size){
+    int len = snprintf(buffer, buffer_size, "%s%02x/%02x/%016llx",
+        ctx->metadata_loc, (unsigned)(chunk_checksum >> 56), (unsigned)((chunk_checksum >> 48) & 0xff), chunk_checksum);
+    return (0 < len && (size_t)len < buffer_size);
+}
+
+
+/* Finds an existing loose blob, stores that predate sharding keep theirs directly under `metadata_loc` until migrated */
+extern int fz_blob_locate(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size){
+    if (fz_blob_path(ctx, chunk_checksum, buffer, buffer_size) && 0 == access(buffer, F_OK)) return 1;
+    return flat_blob_path(ctx, chunk_checksum, buffer, buffer_size) && 0 == access(buffer, F_OK);
+}
+
+
+/* Moves loose blobs of the flat layout into their shard directories. Renames keep inode and mtime so recorded blob state stays valid */
+extern int fz_blob_store_migrate(fz_ctx_t *ctx){
+    int result = 1;
+    DIR *dir = NULL;
+    char from[RESERVED];
+    char to[RESERVED];
+    size_t moved = 0;
+
+    dir = opendir(ctx->metadata_loc);
+    if (NULL == dir) RETURN_DEFER(0);
+    struct dirent *entry = NULL;
+    while (NULL != (entry = readdir(dir))){
+        fz_hex_digest_t chunk_checksum = 0;
+        if (!parse_blob_name(entry->d_name, &chunk_checksum)) continue;
+        if (!flat_blob_path(ctx, chunk_checksum, from, sizeof(from))) continue;
+        if (!make_shard_dirs(ctx, chunk_checksum) || !fz_blob_path(ctx, chunk_checksum, to, sizeof(to))) RETURN_DEFER(0);
+        if (0 != rename(from, to)) {
+            fz_log(FZ_ERROR, "Failed to move `%s` to `%s`", from, to);
+            RETURN_DEFER(0);
+        }
+        moved++;
+    }
+    defer:
+        fz_log(FZ_INFO, "Moved %lu loose blob(s) into shard directories", moved);
+        if (NULL != dir) closedir(dir);
+        return result;
+}
+
+
+/* Appends the checksum of every loose blob on disk, in either layout */
+extern int fz_blob_store_list_loose(fz_ctx_t *ctx, fz_hex_digest_t **checksums){
+    char path[RESERVED];
+    DIR *dir = opendir(ctx->metadata_loc);
+    if (NULL == dir) return 0;
+    struct dirent *entry = NULL;
+    while (NULL != (entry = readdir(dir))){
+        fz_hex_digest_t chunk_checksum = 0;
+        if (parse_blob_name(entry->d_name, &chunk_checksum)) {arrput(*checksums, chunk_checksum); continue;}
+        if (2 != strlen(entry->d_name) || !isxdigit((unsigned char)entry->d_name[0]) || !isxdigit((unsigned char)entry->d_name[1])) continue;
+        for (int i = 0; i < 256; i++){
+            int len = snprintf(path, sizeof(path), "%s%s/%02x", ctx->metadata_loc, entry->d_name, i);
+            if (0 >= len || (size_t)len >= sizeof(path)) continue;
+            DIR *shard = opendir(path);
+            if (NULL == shard) continue;
+            struct dirent *blob = NULL;
+            while (NULL != (blob = readdir(shard))){
+                if (parse_blob_name(blob->d_name, &chunk_checksum)) arrput(*checksums, chunk_checksum);
+            }
+            closedir(shard);
+        }
+    }
+    closedir(dir);
+    return 1;
+}
+
+
+/* Loads the blob state index, presence checks against the blob store are answered from it.
+The snapshot under `metadata_loc` is mapped when it matches the table epoch, otherwise the index is rebuilt from `filezap_blob_state`.
+The pack store is set up lazily on the first write so contexts that never store chunks leave `metadata_loc` untouched */
+extern int fz_blob_state_init(fz_ctx_t *ctx){
+    int result = 1;
+    char path[RESERVED];
+    pthread_mutex_init(&ctx->blob_state_mtx, NULL);
+    pthread_mutex_init(&ctx->packs.mtx, NULL);
+    ctx->blob_state_dirty = NULL;
+    ctx->blob_state_epoch = 0;
+    ctx->blob_state_unsaved = 0;
+    ctx->packs.fds = NULL;
+    ctx->packs.refs = NULL;
+    ctx->packs.retired = NULL;
+    ctx->packs.active_id = 0;
+    ctx->packs.active_fd = -1;
+    ctx->packs.active_len = 0;
+    if (0 == ctx->blob_layout) ctx->blob_layout = FZ_BLOB_PACKED;
+    if (0 == ctx->ctx_attrs.scrub_interval) ctx->ctx_attrs.scrub_interval = BLOB_SCRUB_INTERVAL_DEFAULT;
+    if (0 == ctx->ctx_attrs.pack_size) ctx->ctx_attrs.pack_size = PACK_SIZE_DEFAULT;
+    if (!fz_chunk_index_init(&ctx->blob_state, 0)) RETURN_DEFER(0);
+    if (!fz_query_meta_value(ctx, FZ_META_BLOB_STATE_EPOCH, &ctx->blob_state_epoch)) {
+        fz_log(FZ_ERROR, "Failed to read the blob state epoch");
+        RETURN_DEFER(0);
+    }
+    if (0 != ctx->blob_state_epoch && snapshot_path(ctx, path, sizeof(path))
+        && fz_chunk_index_load(&ctx->blob_state, path, ctx->blob_state_epoch)){
+        fz_log(FZ_INFO, "Mapped %lu blob state entries from `%s`", fz_chunk_index_len(&ctx->blob_state), path);
+        RETURN_DEFER(1);
+    }
+    if (!fz_query_blob_state(ctx, &ctx->blob_state)) {
+        fz_log(FZ_ERROR, "Failed to load the blob state index");
+        RETURN_DEFER(0);
+    }
+    ctx->blob_state_unsaved = 1;
+    defer:
+        return result;
+}
+
+
+extern void fz_blob_state_destroy(fz_ctx_t *ctx){
+    char path[RESERVED];
+    if (NULL != ctx->blob_state_dirty) fz_blob_state_flush(ctx);
+    /* The snapshot is only written if every change made through this context reached the table */
+    if (ctx->blob_state_unsaved && NULL == ctx->blob_state_dirty && 0 != ctx->blob_state_epoch && snapshot_path(ctx, path, sizeof(path))){
+        if (!fz_chunk_index_save(&ctx->blob_state, path, ctx->blob_state_epoch)) fz_log(FZ_WARNING, "Could not write blob state snapshot `%s`", path);
+    }
+    fz_chunk_index_destroy(&ctx->blob_state);
+    if (NULL != ctx->blob_state_dirty) arrfree(ctx->blob_state_dirty);
+    for (size_t i = 0; i < arrlenu(ctx->packs.fds); i++){
+        if (-1 != ctx->packs.fds[i]) close(ctx->packs.fds[i]);
+    }
+    if (NULL != ctx->packs.fds) arrfree(ctx->packs.fds);
+    if (NULL != ctx->packs.refs) arrfree(ctx->packs.refs);
+    if (NULL != ctx->packs.retired) arrfree(ctx->packs.retired);
+    ctx->packs.active_fd = -1;
+    pthread_mutex_destroy(&ctx->packs.mtx);
+    pthread_mutex_destroy(&ctx->blob_state_mtx);
+}
+
+
+/* Returns 1 and fills `state` if the blob is known to hold verified data for `chunk_checksum`, no file is touched */
+extern int fz_blob_state_get(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, fz_blob_state_t *state){
+    int result = 0;
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    fz_blob_state_t *entry = fz_chunk_index_get(&ctx->blob_state, chunk_checksum);
+    if (NULL != entry) {
+        if (NULL != state) *state = *entry;
+        result = 1;
+    }
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+    return result;
+}
+
+
+/* Call after the loose blob of `chunk_checksum` was written or verified, the file must hold data matching the checksum */
+extern int fz_blob_state_record(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum){
+    char blob_path[RESERVED];
+    struct stat meta = {0};
+    if (!fz_blob_locate(ctx, chunk_checksum, blob_path, sizeof(blob_path))) return 0;
+    if (0 != stat(blob_path, &meta)) return 0;
+
+    fz_blob_state_t state = {
+        .blob_size = (size_t)meta.st_size,
+        .mtime_ns = stat_mtime_ns(&meta),
+        .inode = (uint64_t)meta.st_ino,
+        .verified_at = (int64_t)time(NULL),
+    };
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    int ok = fz_chunk_index_put(&ctx->blob_state, chunk_checksum, &state);
+    if (ok) mark_dirty(ctx, chunk_checksum);
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+    return ok;
+}
+
+
+extern void fz_blob_state_forget(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum){
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    if (fz_chunk_index_del(&ctx->blob_state, chunk_checksum)) mark_dirty(ctx, chunk_checksum);
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+}
+
+
+/* Writes every recorded or forgotten blob state since the last flush in a single transaction.
+The active pack is synced and its length committed first, so persisted entries never point past the durable end of a pack */
+extern int fz_blob_state_flush(fz_ctx_t *ctx){
+    int result = 1;
+    fz_blob_state_t *states = NULL;
+    uint8_t *present = NULL;
+    fz_hex_digest_t *dirty = NULL;
+
+    pthread_mutex_lock(&ctx->packs.mtx);
+    if (-1 != ctx->packs.active_fd){
+        if (0 != fdatasync(ctx->packs.active_fd) || !fz_commit_pack(ctx, ctx->packs.active_id, ctx->packs.active_len, 0)) {
+            pthread_mutex_unlock(&ctx->packs.mtx);
+            fz_log(FZ_ERROR, "Failed to checkpoint pack %u", ctx->packs.active_id);
+            RETURN_DEFER(0);
+        }
+    }
+    pthread_mutex_unlock(&ctx->packs.mtx);
+
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    dirty = ctx->blob_state_dirty;
+    ctx->blob_state_dirty = NULL;
+    size_t ndirty = arrlenu(dirty);
+    if (0 < ndirty) {
+        states = calloc(ndirty, sizeof(fz_blob_state_t));
+        present = calloc(ndirty, sizeof(uint8_t));
+    }
+    if (0 < ndirty && (NULL == states || NULL == present)) {
+        ctx->blob_state_dirty = dirty; dirty = NULL;
+        pthread_mutex_unlock(&ctx->blob_state_mtx);
+        RETURN_DEFER(0);
+    }
+    for (size_t i = 0; i < ndirty; i++){
+        fz_blob_state_t *entry = fz_chunk_index_get(&ctx->blob_state, dirty[i]);
+        if (NULL != entry) {states[i] = *entry; present[i] = 1;}
+    }
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+
+    if (0 < ndirty && !fz_commit_blob_state(ctx, dirty, states, present, ndirty, &ctx->blob_state_epoch)) {
+        /* The entries stay dirty, the next flush writes them with whatever they hold by then */
+        pthread_mutex_lock(&ctx->blob_state_mtx);
+        for (size_t i = 0; i < ndirty; i++) arrput(ctx->blob_state_dirty, dirty[i]);
+        pthread_mutex_unlock(&ctx->blob_state_mtx);
+        fz_log(FZ_ERROR, "Failed to persist the blob state index");
+        RETURN_DEFER(0);
+    }
+    if (0 < ndirty) {
+        ctx->blob_state_unsaved = 1;
+        fz_chunk_filter_commit(ctx, FZ_FILTER_BLOB_STATE, ctx->blob_state_epoch, dirty, ndirty);
+    }
+    defer:
+        if (NULL != dirty) arrfree(dirty);
+        if (NULL != states) free(states);
+        if (NULL != present) free(present);
+        return result;
+}
+
+
+/* Stores a verified chunk, `buffer` must hash to `chunk_checksum`. Packed chunks that pass the entropy probe are stored compressed */
+extern int fz_blob_store_put(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size){
+    int result = 1;
+    char *compressed = NULL;
+    size_t max_alloc = 0;
+    size_t compressed_size = 0;
+    if (fz_blob_state_get(ctx, chunk_checksum, NULL)) return 1;
+    if (!(FZ_BLOB_PACKED & ctx->blob_layout)) return put_loose(ctx, chunk_checksum, buffer, size);
+    if ((FZ_CODEC_LZ & ctx->compression) && fz_chunk_compress(buffer, size, &compressed, &max_alloc, &compressed_size)){
+        result = fz_blob_store_put_compressed(ctx, chunk_checksum, buffer, size, compressed, compressed_size);
+    } else result = put_packed(ctx, chunk_checksum, buffer, size, 0);
+    if (NULL != compressed) free(compressed);
+    return result;
+}
+
+
+/* Stores a verified chunk whose compressed form is already at hand, e.g. straight off the wire. Loose blobs stay raw so they can be
+hashed and scavenged as plain files, packed records are only compressed if that frees at least one pack block */
+extern int fz_blob_store_put_compressed(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size, const char *compressed, size_t compressed_size){
+    if (fz_blob_state_get(ctx, chunk_checksum, NULL)) return 1;
+    if (!(FZ_BLOB_PACKED & ctx->blob_layout)) return put_loose(ctx, chunk_checksum, buffer, size);
+    if (!(FZ_CODEC_LZ & ctx->compression) || UINT32_MAX < size || PACK_ALIGN(compressed_size) >= PACK_ALIGN(size)){
+        return put_packed(ctx, chunk_checksum, buffer, size, 0);
+    }
+    return put_packed(ctx, chunk_checksum, compressed, compressed_size, (uint32_t)size);
+}
+
+
+/* Reads the chunk behind `handle` into `*buffer`, growing it as needed, compressed records are decoded. `*size` is the chunk size */
+extern int fz_blob_store_read(fz_blob_handle_t *handle, char **buffer, size_t *max_alloc, size_t *size){
+    int result = 1;
+    char *compressed = NULL;
+    size_t chunk_size = (0 != handle->raw_size)? handle->raw_size : handle->size;
+    if (*max_alloc < chunk_size){
+        char *temp = realloc(*buffer, chunk_size);
+        if (NULL == temp) RETURN_DEFER(0);
+        *buffer = temp;
+        *max_alloc = chunk_size;
+    }
+    if (0 == handle->raw_size){
+        if ((ssize_t)handle->size != pread(handle->fd, *buffer, handle->size, (off_t)handle->offset)) RETURN_DEFER(0);
+        RETURN_DEFER(1);
+    }
+    compressed = malloc(handle->size);
+    if (NULL == compressed) RETURN_DEFER(0);
+    if ((ssize_t)handle->size != pread(handle->fd, compressed, handle->size, (off_t)handle->offset)) RETURN_DEFER(0);
+    if (!fz_chunk_decompress(compressed, handle->size, *buffer, handle->raw_size)) RETURN_DEFER(0);
+    defer:
+        if (result) *size = chunk_size;
+        if (NULL != compressed) free(compressed);
+        return result;
+}
+
+
+/* Resolves a stored chunk to a readable range, release the handle with `fz_blob_store_release` */
+extern int fz_blob_store_open(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, fz_blob_handle_t *handle){
+    char blob_path[RESERVED];
+    fz_blob_state_t state = {0};
+    *handle = (fz_blob_handle_t){.fd = -1};
+    int known = fz_blob_state_get(ctx, chunk_checksum, &state);
+    if (known && 0 != state.pack_id){
+        int fd = pack_fd(ctx, state.pack_id);
+        /* The entry may have moved to another pack while the old one was repacked and removed */
+        if (-1 == fd && fz_blob_state_get(ctx, chunk_checksum, &state) && 0 != state.pack_id) fd = pack_fd(ctx, state.pack_id);
+        if (-1 == fd) return 0;
+        *handle = (fz_blob_handle_t){.fd = fd, .offset = state.pack_offset, .size = state.blob_size, .owned = 0, .raw_size = state.raw_size, .state = state, .store = &ctx->packs};
+        return 1;
+    }
+    if (!fz_blob_locate(ctx, chunk_checksum, blob_path, sizeof(blob_path))) return 0;
+    int fd = open(blob_path, O_RDONLY);
+    if (-1 == fd) return 0;
+    struct stat meta = {0};
+    if (0 != fstat(fd, &meta)) {close(fd); return 0;}
+    *handle = (fz_blob_handle_t){.fd = fd, .offset = 0, .size = (size_t)meta.st_size, .owned = 1, .state = state};
+    /* A loose blob is trusted only while it is exactly the file that was verified */
+    handle->changed = !known
+        || state.blob_size != (size_t)meta.st_size
+        || state.mtime_ns != stat_mtime_ns(&meta)
+        || state.inode != (uint64_t)meta.st_ino;
+    return 1;
+}
+
+
+extern void fz_blob_store_release(fz_blob_handle_t *handle){
+    if (handle->owned && -1 != handle->fd) close(handle->fd);
+    if (NULL != handle->store && -1 != handle->fd) pack_unref(handle->store, handle->state.pack_id);
+    handle->fd = -1;
+    handle->store = NULL;
+}
+
+
+/* Drops a chunk from the store, packed chunks leave dead space that `fz_blob_store_repack` reclaims */
+extern int fz_blob_store_remove(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum){
+    char blob_path[RESERVED];
+    fz_blob_state_t state = {0};
+    int known = fz_blob_state_get(ctx, chunk_checksum, &state);
+    fz_blob_state_forget(ctx, chunk_checksum);
+    if (known && 0 != state.pack_id) return 1;
+    if (!fz_blob_locate(ctx, chunk_checksum, blob_path, sizeof(blob_path))) return 0;
+    return 0 == remove(blob_path);
+}
+
+
+/* Moves the live chunks of mostly dead sealed packs into the active pack and deletes the old segments. At most `max_bytes` (0 for
+no limit) of live chunks are moved per call, a pack that does not fit is left whole and `*more` tells whether any was left */
+extern int fz_blob_store_repack(fz_ctx_t *ctx, size_t max_bytes, int *more){
+    int result = 1;
+    fz_pack_info_t *packs = NULL;
+    struct pack_size_map_s *live_bytes = NULL;
+    fz_hex_digest_t *moving = NULL;
+    char *buffer = NULL;
+    size_t max_alloc = 0;
+    char path[RESERVED];
+    size_t moved_bytes = 0;
+
+    if (NULL != more) *more = 0;
+    if (!fz_query_packs(ctx, &packs)) RETURN_DEFER(0);
+    if (0 == arrlenu(packs)) RETURN_DEFER(1);
+
+    size_t cursor = 0;
+    fz_hex_digest_t key = 0;
+    fz_blob_state_t *state = NULL;
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    while (fz_chunk_index_next(&ctx->blob_state, &cursor, &key, &state)){
+        if (0 == state->pack_id) continue;
+        size_t live = hmget(live_bytes, state->pack_id) + PACK_ALIGN(state->blob_size);
+        hmput(live_bytes, state->pack_id, live);
+    }
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+
+    for (size_t i = 0; i < arrlenu(packs); i++){
+        if (!packs[i].sealed || packs[i].pack_id == ctx->packs.active_id) continue;
+        size_t live = hmget(live_bytes, packs[i].pack_id);
+        if (live * 100 >= packs[i].length * PACK_REPACK_LIVE_PERCENT) continue;
+        if (0 != max_bytes && live > max_bytes - moved_bytes) {
+            if (NULL != more) *more = 1;
+            continue;
+        }
+        moved_bytes += live;
+
+        pthread_mutex_lock(&ctx->blob_state_mtx);
+        cursor = 0;
+        while (fz_chunk_index_next(&ctx->blob_state, &cursor, &key, &state)){
+            if (state->pack_id == packs[i].pack_id) arrput(moving, key);
+        }
+        pthread_mutex_unlock(&ctx->blob_state_mtx);
+
+        for (size_t j = 0; j < arrlenu(moving); j++){
+            fz_blob_handle_t handle = {0};
+            if (!fz_blob_store_open(ctx, moving[j], &handle)) RETURN_DEFER(0);
+            if (max_alloc < handle.size){
+                char *temp = realloc(buffer, handle.size);
+                if (NULL == temp) {fz_blob_store_release(&handle); RETURN_DEFER(0);}
+                buffer = temp;
+                max_alloc = handle.size;
+            }
+            /* Records move as stored, compressed ones are not decoded on the way */
+            ssize_t n = pread(handle.fd, buffer, handle.size, (off_t)handle.offset);
+            size_t size = handle.size;
+            uint32_t raw_size = (uint32_t)handle.raw_size;
+            fz_blob_store_release(&handle);
+            if (n != (ssize_t)size) RETURN_DEFER(0);
+            /* The entry keeps pointing at the old pack until the record is written to the new one */
+            if (!put_packed(ctx, moving[j], buffer, size, raw_size)) RETURN_DEFER(0);
+        }
+        /* Entries must point at the new pack durably before the old segment disappears */
+        if (!fz_blob_state_flush(ctx)) RETURN_DEFER(0);
+        if (!fz_commit_pack_removal(ctx, packs[i].pack_id)) RETURN_DEFER(0);
+        /* Readers still holding a handle on the old pack keep its descriptor, the last release closes it */
+        pthread_mutex_lock(&ctx->packs.mtx);
+        if (packs[i].pack_id < arrlenu(ctx->packs.fds) && -1 != ctx->packs.fds[packs[i].pack_id]) {
+            ctx->packs.retired[packs[i].pack_id] = 1;
+            if (0 == ctx->packs.refs[packs[i].pack_id]) {
+                close(ctx->packs.fds[packs[i].pack_id]);
+                ctx->packs.fds[packs[i].pack_id] = -1;
+            }
+        }
+        pthread_mutex_unlock(&ctx->packs.mtx);
+        if (pack_path(ctx, packs[i].pack_id, path, sizeof(path))) remove(path);
+        fz_log(FZ_INFO, "Repacked %lu chunk(s) out of pack %u", arrlenu(moving), packs[i].pack_id);
+        arrfree(moving);
+    }
+    defer:
+        if (NULL != packs) arrfree(packs);
+        if (NULL != live_bytes) hmfree(live_bytes);
+        if (NULL != moving) arrfree(moving);
+        if (NULL != buffer) free(buffer);
+        return result;
+}
+
+
+/* Rehashes up to `limit` blobs (0 for all) whose last verification is older than the scrub interval, corrupted or vanished blobs
+are dropped from the store. `*more` tells whether due blobs were left for the next call */
+extern int fz_blob_store_scrub(fz_ctx_t *ctx, size_t limit, int *more){
+    int result = 1;
+    fz_hex_digest_t *due = NULL;
+    int64_t now = (int64_t)time(NULL);
+    char *buffer = NULL;
+    size_t max_alloc = 0;
+
+    size_t cursor = 0;
+    fz_hex_digest_t key = 0;
+    fz_blob_state_t *state = NULL;
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    int left = 0;
+    while (fz_chunk_index_next(&ctx->blob_state, &cursor, &key, &state)){
+        if (now - state->verified_at < (int64_t)ctx->ctx_attrs.scrub_interval) continue;
+        if (0 != limit && arrlenu(due) == limit) {
+            left = 1;
+            break;
+        }
+        arrput(due, key);
+    }
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+    if (NULL != more) *more = left;
+
+    size_t corrupted = 0;
+    for (size_t i = 0; i < arrlenu(due); i++){
+        fz_hex_digest_t digest = 0;
+        fz_blob_handle_t handle = {0};
+        if (fz_blob_store_open(ctx, due[i], &handle)) {
+            size_t size = 0;
+            if (fz_blob_store_read(&handle, &buffer, &max_alloc, &size)) xxhash_hexdigest(buffer, size, &digest);
+            fz_blob_store_release(&handle);
+        }
+        if (due[i] == digest) {
+            pthread_mutex_lock(&ctx->blob_state_mtx);
+            fz_blob_state_t *entry = fz_chunk_index_get(&ctx->blob_state, due[i]);
+            if (NULL != entry) {
+                entry->verified_at = now;
+                mark_dirty(ctx, due[i]);
+            }
+            pthread_mutex_unlock(&ctx->blob_state_mtx);
+        } else {
+            fz_log(FZ_WARNING, "Scrub found corrupted or missing blob %016llx", due[i]);
+            fz_blob_store_remove(ctx, due[i]);
+            corrupted++;
+        }
+    }
+    fz_log(FZ_INFO, "Scrubbed %lu blob(s), dropped %lu", arrlenu(due), corrupted);
+    if (!fz_blob_state_flush(ctx)) RETURN_DEFER(0);
+    defer:
+        if (NULL != due) arrfree(due);
+        if (NULL != buffer) free(buffer);
+        return result;
+}
+
+
+/* Forgets entries pointing into a pack file that vanished or was cut short, so presence checks report those chunks as missing.
+Costs one stat per pack, run it before answering presence checks for a transfer */
+extern int fz_blob_store_reconcile(fz_ctx_t *ctx){
+    int result = 1;
+    fz_pack_info_t *packs = NULL;
+    struct pack_size_map_s *usable = NULL;
+    fz_hex_digest_t *gone = NULL;
+    char path[RESERVED];
+    struct stat meta = {0};
+
+    if (!fz_query_packs(ctx, &packs)) RETURN_DEFER(0);
+    for (size_t i = 0; i < arrlenu(packs); i++){
+        if (pack_path(ctx, packs[i].pack_id, path, sizeof(path)) && 0 == stat(path, &meta)){
+            hmput(usable, packs[i].pack_id, (size_t)meta.st_size);
+            continue;
+        }
+        fz_log(FZ_WARNING, "Pack `%s` is missing", path);
+        if (!fz_commit_pack_removal(ctx, packs[i].pack_id)) RETURN_DEFER(0);
+    }
+
+    size_t dropped = 0;
+    size_t cursor = 0;
+    fz_hex_digest_t key = 0;
+    fz_blob_state_t *state = NULL;
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    while (fz_chunk_index_next(&ctx->blob_state, &cursor, &key, &state)){
+        struct pack_size_map_s *pack = hmgetp_null(usable, state->pack_id);
+        if (0 == state->pack_id || (NULL != pack && state->pack_offset + state->blob_size <= pack->value)) continue;
+        arrput(gone, key);
+    }
+    for (size_t i = 0; i < arrlenu(gone); i++){
+        fz_chunk_index_del(&ctx->blob_state, gone[i]);
+        mark_dirty(ctx, gone[i]);
+        dropped++;
+    }
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+    if (0 < dropped) {
+        fz_log(FZ_WARNING, "Dropped %lu blob state entries whose pack data is gone", dropped);
+        if (!fz_blob_state_flush(ctx)) RETURN_DEFER(0);
+    }
+    defer:
+        if (NULL != packs) arrfree(packs);
+        if (NULL != usable) hmfree(usable);
+        if (NULL != gone) arrfree(gone);
+        return result;
+}
+
+
+static int put_loose(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size){
+    char blob_path[RESERVED];
+    if (!make_shard_dirs(ctx, chunk_checksum) || !fz_blob_path(ctx, chunk_checksum, blob_path, sizeof(blob_path))) return 0;
+    FILE *fh = fopen(blob_path, "wb");
+    if (NULL == fh) return 0;
+    size_t written = fwrite(buffer, 1, size, fh);
+    fclose(fh);
+    if (written != size) return 0;
+    return fz_blob_state_record(ctx, chunk_checksum);
+}
+
+
+/* Appends the chunk to the active pack, the entry becomes durable with the next `fz_blob_state_flush`.
+A non-zero `raw_size` marks `buffer` as the compressed form of the chunk */
+static int put_packed(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size, uint32_t raw_size){
+    int result = 1;
+    pthread_mutex_lock(&ctx->packs.mtx);
+    if (!ensure_active_pack(ctx)) RETURN_DEFER(0);
+
+    size_t offset = ctx->packs.active_len;
+    size_t done = 0;
+    while (done < size){
+        ssize_t n = pwrite(ctx->packs.active_fd, buffer + done, size - done, (off_t)(offset + done));
+        if (-1 == n && EINTR == errno) continue;
+        if (0 >= n) {
+            fz_log(FZ_ERROR, "Failed to append chunk to pack %u", ctx->packs.active_id);
+            RETURN_DEFER(0);
+        }
+        done += (size_t)n;
+    }
+    ctx->packs.active_len = PACK_ALIGN(offset + size);
+
+    fz_blob_state_t state = {
+        .blob_size = size,
+        .verified_at = (int64_t)time(NULL),
+        .pack_id = ctx->packs.active_id,
+        .raw_size = raw_size,
+        .pack_offset = offset,
+    };
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    int ok = fz_chunk_index_put(&ctx->blob_state, chunk_checksum, &state);
+    if (ok) mark_dirty(ctx, chunk_checksum);
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+    if (!ok) RETURN_DEFER(0);
+
+    if (ctx->packs.active_len >= ctx->ctx_attrs.pack_size && !seal_active_pack(ctx)) RETURN_DEFER(0);
+    defer:
+        pthread_mutex_unlock(&ctx->packs.mtx);
+        return result;
+}
+
+
+/* Caller holds `packs.mtx`. Reopens the unsealed pack left by a previous run, dropping any tail that was never committed, or starts a new one */
+static int ensure_active_pack(fz_ctx_t *ctx){
+    int result = 1;
+    fz_pack_info_t *packs = NULL;
+    char path[RESERVED];
+    if (-1 != ctx->packs.active_fd) return 1;
+
+    if (!fz_query_packs(ctx, &packs)) RETURN_DEFER(0);
+    uint32_t next_id = 1;
+    int found = 0;
+    for (size_t i = 0; i < arrlenu(packs); i++){
+        if (packs[i].pack_id >= next_id) next_id = packs[i].pack_id + 1;
+        if (!packs[i].sealed && !found){
+            ctx->packs.active_id = packs[i].pack_id;
+            ctx->packs.active_len = packs[i].length;
+            found = 1;
+        }
+    }
+    if (!found){
+        ctx->packs.active_id = next_id;
+        ctx->packs.active_len = 0;
+    }
+    if (!pack_path(ctx, ctx->packs.active_id, path, sizeof(path))) RETURN_DEFER(0);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (-1 == fd) {
+        fz_log(FZ_ERROR, "Failed to open pack `%s`", path);
+        RETURN_DEFER(0);
+    }
+    if (0 != ftruncate(fd, (off_t)ctx->packs.active_len) || !fz_commit_pack(ctx, ctx->packs.active_id, ctx->packs.active_len, 0)) {
+        close(fd);
+        RETURN_DEFER(0);
+    }
+    while (arrlenu(ctx->packs.fds) <= ctx->packs.active_id) {
+        arrput(ctx->packs.fds, -1);
+        arrput(ctx->packs.refs, 0);
+        arrput(ctx->packs.retired, 0);
+    }
+    if (-1 != ctx->packs.fds[ctx->packs.active_id]) close(ctx->packs.fds[ctx->packs.active_id]);
+    ctx->packs.fds[ctx->packs.active_id] = fd;
+    ctx->packs.active_fd = fd;
+    defer:
+        if (NULL != packs) arrfree(packs);
+        return result;
+}
+
+
+/* Caller holds `packs.mtx`. A sealed pack is immutable, its final length is committed only after its data is durable */
+static int seal_active_pack(fz_ctx_t *ctx){
+    if (0 != fdatasync(ctx->packs.active_fd)) return 0;
+    if (!fz_commit_pack(ctx, ctx->packs.active_id, ctx->packs.active_len, 1)) return 0;
+    fz_log(FZ_INFO, "Sealed pack %u at %lu byte(s)", ctx->packs.active_id, ctx->packs.active_len);
+    ctx->packs.active_fd = -1;
+    ctx->packs.active_len = 0;
+    return 1;
+}
+
+
+/* Takes a reference on the cached descriptor of a pack, drop it with `pack_unref` */
+static int pack_fd(fz_ctx_t *ctx, uint32_t pack_id){
+    char path[RESERVED];
+    int fd = -1;
+    pthread_mutex_lock(&ctx->packs.mtx);
+    while (arrlenu(ctx->packs.fds) <= pack_id) {
+        arrput(ctx->packs.fds, -1);
+        arrput(ctx->packs.refs, 0);
+        arrput(ctx->packs.retired, 0);
+    }
+    fd = ctx->packs.fds[pack_id];
+    if (-1 == fd && !ctx->packs.retired[pack_id] && pack_path(ctx, pack_id, path, sizeof(path))){
+        fd = open(path, O_RDONLY);
+        ctx->packs.fds[pack_id] = fd;
+    }
+    if (-1 != fd) ctx->packs.refs[pack_id]++;
+    pthread_mutex_unlock(&ctx->packs.mtx);
+    return fd;
+}
+
+
+static void pack_unref(fz_pack_store_t *store, uint32_t pack_id){
+    pthread_mutex_lock(&store->mtx);
+    if (0 < store->refs[pack_id]) store->refs[pack_id]--;
+    if (0 == store->refs[pack_id] && store->retired[pack_id] && -1 != store->fds[pack_id]) {
+        close(store->fds[pack_id]);
+        store->fds[pack_id] = -1;
+    }
+    pthread_mutex_unlock(&store->mtx);
+}
+
+
+static inline int pack_path(fz_ctx_t *ctx, uint32_t pack_id, char *buffer, size_t buffer_size){
+    int len = snprintf(buffer, buffer_size, "%spack-%08x.pack", ctx->metadata_loc, pack_id);
+    return (0 < len && (size_t)len < buffer_size);
+}
+
+
+static inline int flat_blob_path(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size){
+    int len = snprintf(buffer, buffer_size, "%s%016llx", ctx->metadata_loc, chunk_checksum);
+    return (0 < len && (size_t)len < buffer_size);
+}
+
+
+static inline int parse_blob_name(const char *name, fz_hex_digest_t *chunk_checksum){
+    char *end = NULL;
+    if (HEX_DIGIT_SIZE - 1 != strlen(name)) return 0;
+    *chunk_checksum = (fz_hex_digest_t)strtoull(name, &end, 16);
+    return '\0' == *end;
+}
+
+
+static int make_shard_dirs(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum){
+    char path[RESERVED];
+    int len = snprintf(path, sizeof(path), "%s%02x", ctx->metadata_loc, (unsigned)(chunk_checksum >> 56));
+    if (0 >= len || (size_t)len >= sizeof(path)) return 0;
+    if (0 != mkdir(path, 0755) && EEXIST != errno) return 0;
+    len = snprintf(path, sizeof(path), "%s%02x/%02x", ctx->metadata_loc, (unsigned)(chunk_checksum >> 56), (unsigned)((chunk_checksum >> 48) & 0xff));
+    if (0 >= len || (size_t)len >= sizeof(path)) return 0;
+    if (0 != mkdir(path, 0755) && EEXIST != errno) return 0;
+    return 1;
+}
+
+
+static inline int snapshot_path(fz_ctx_t *ctx, char *buffer, size_t buffer_size){
+    int len = snprintf(buffer, buffer_size, "%s%s", ctx->metadata_loc, CHUNK_INDEX_SNAPSHOT);
+    return (0 < len && (size_t)len < buffer_size);
+}
+
+
+static inline int64_t stat_mtime_ns(struct stat *meta){
+    return (int64_t)meta->st_mtim.tv_sec * 1000000000LL + meta->st_mtim.tv_nsec;
+}
+
+
+/* Caller holds `blob_state_mtx` */
+static inline void mark_dirty(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum){
+    arrput(ctx->blob_state_dirty, chunk_checksum);
+}
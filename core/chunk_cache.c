@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+
+#define CHUNK_CACHE_SIZE_DEFAULT MB(64)
+
+
+static inline fz_cache_shard_t *shard_of(fz_chunk_cache_t *cache, fz_hex_digest_t chunk_checksum);
+static void evict_until(fz_cache_shard_t *shard, size_t budget, size_t needed);
+
+
+extern void fz_chunk_cache_init(fz_chunk_cache_t *cache, size_t budget){
+    memset(cache, 0, sizeof(*cache));
+    if (0 == budget) budget = CHUNK_CACHE_SIZE_DEFAULT;
+    cache->shard_budget = budget / FZ_CACHE_SHARDS;
+    for (size_t i = 0; i < FZ_CACHE_SHARDS; i++){
+        pthread_mutex_init(&cache->shards[i].mtx, NULL);
+    }
+}
+
+
+extern void fz_chunk_cache_destroy(fz_chunk_cache_t *cache){
+    for (size_t i = 0; i < FZ_CACHE_SHARDS; i++){
+        fz_cache_shard_t *shard = &cache->shards[i];
+        for (size_t j = 0; j < arrlenu(shard->entries); j++) free(shard->entries[j].data);
+        if (NULL != shard->entries) arrfree(shard->entries);
+        if (NULL != shard->slots) hmfree(shard->slots);
+        pthread_mutex_destroy(&shard->mtx);
+    }
+    memset(cache, 0, sizeof(*cache));
+}
+
+
+/* Caches a copy of a verified chunk, chunks larger than a shard's budget are not cached */
+extern void fz_chunk_cache_put(fz_chunk_cache_t *cache, fz_hex_digest_t chunk_checksum, const char *data, size_t size){
+    fz_cache_shard_t *shard = shard_of(cache, chunk_checksum);
+    if (0 == size || size > cache->shard_budget) return;
+
+    pthread_mutex_lock(&shard->mtx);
+    if (NULL != hmgetp_null(shard->slots, chunk_checksum)) goto done;
+    evict_until(shard, cache->shard_budget, size);
+    fz_cache_entry_t entry = {.chunk_checksum = chunk_checksum, .data = malloc(size), .size = size, .referenced = 0};
+    if (NULL == entry.data) goto done;
+    memcpy(entry.data, data, size);
+    arrput(shard->entries, entry);
+    hmput(shard->slots, chunk_checksum, arrlenu(shard->entries) - 1);
+    shard->used += size;
+    done:
+        pthread_mutex_unlock(&shard->mtx);
+}
+
+
+/* Copies a cached chunk into `*buffer`, growing it as needed. Returns 0 on a miss */
+extern int fz_chunk_cache_get(fz_chunk_cache_t *cache, fz_hex_digest_t chunk_checksum, char **buffer, size_t *max_alloc, size_t *size){
+    int result = 0;
+    fz_cache_shard_t *shard = shard_of(cache, chunk_checksum);
+
+    pthread_mutex_lock(&shard->mtx);
+    struct cache_slot_map_s *slot = hmgetp_null(shard->slots, chunk_checksum);
+    if (NULL == slot) goto done;
+    fz_cache_entry_t *entry = &shard->entries[slot->value];
+    if (*max_alloc < entry->size){
+        char *temp = realloc(*buffer, entry->size);
+        if (NULL == temp) goto done;
+        *buffer = temp;
+        *max_alloc = entry->size;
+    }
+    memcpy(*buffer, entry->data, entry->size);
+    *size = entry->size;
+    entry->referenced = 1;
+    result = 1;
+    done:
+        pthread_mutex_unlock(&shard->mtx);
+        return result;
+}
+
+
+/* Checksums are uniformly distributed, the top bits pick the shard */
+static inline fz_cache_shard_t *shard_of(fz_chunk_cache_t *cache, fz_hex_digest_t chunk_checksum){
+    return &cache->shards[(size_t)(chunk_checksum >> 60) % FZ_CACHE_SHARDS];
+}
+
+
+/* CLOCK: the hand clears reference bits until it finds an entry nobody read since the last sweep.
+Evicted entries are replaced by the last entry so the array stays dense. Caller holds the shard lock */
+static void evict_until(fz_cache_shard_t *shard, size_t budget, size_t needed){
+    while (shard->used + needed > budget && 0 < arrlenu(shard->entries)){
+        if (shard->hand >= arrlenu(shard->entries)) shard->hand = 0;
+        fz_cache_entry_t *entry = &shard->entries[shard->hand];
+        if (entry->referenced){
+            entry->referenced = 0;
+            shard->hand++;
+            continue;
+        }
+        shard->used -= entry->size;
+        free(entry->data);
+        (void)hmdel(shard->slots, entry->chunk_checksum);
+        fz_cache_entry_t last = arrpop(shard->entries);
+        if (shard->hand < arrlenu(shard->entries)){
+            shard->entries[shard->hand] = last;
+            hmput(shard->slots, last.chunk_checksum, shard->hand);
+        }
+    }
+}
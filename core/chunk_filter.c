@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+
+#define CHUNK_FILTER_FILE "chunk_filter"
+#define CHUNK_FILTER_MAGIC 0x52544c464b4e4843ULL /* "CHNKFLTR" */
+#define CHUNK_FILTER_VERSION 1
+
+/* Split block Bloom filter: a key sets one bit in each of the 8 words of a 256-bit block */
+#define CHUNK_FILTER_BLOCK_WORDS 8
+#define CHUNK_FILTER_MIN_BLOCKS 64
+
+/* 16 bits per key keeps false positives well under 0.1%, filters are sized for twice their keys and rebuilt once they outgrow that */
+#define CHUNK_FILTER_BITS_PER_KEY 16
+
+
+typedef struct chunk_filter_header_s{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t nblocks;
+    uint64_t nkeys;
+    uint64_t blob_state_epoch;
+    uint64_t chunks_epoch;
+    uint64_t checksum;
+} chunk_filter_header_t;
+
+
+static const uint32_t salt[CHUNK_FILTER_BLOCK_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+
+static int ensure_ready(fz_ctx_t *ctx);
+static int rebuild(fz_ctx_t *ctx);
+static int load(fz_ctx_t *ctx, uint64_t blob_state_epoch, uint64_t chunks_epoch);
+static int save(fz_ctx_t *ctx);
+static int alloc_blocks(fz_chunk_filter_t *filter, size_t nkeys);
+static inline void set_key(fz_chunk_filter_t *filter, fz_hex_digest_t key);
+static inline int test_key(fz_chunk_filter_t *filter, fz_hex_digest_t key);
+static inline int filter_path(fz_ctx_t *ctx, char *buffer, size_t buffer_size);
+
+
+extern void fz_chunk_filter_init(fz_ctx_t *ctx){
+    memset(&ctx->chunk_filter, 0, sizeof(ctx->chunk_filter));
+    pthread_mutex_init(&ctx->chunk_filter.mtx, NULL);
+}
+
+
+extern void fz_chunk_filter_destroy(fz_ctx_t *ctx){
+    fz_chunk_filter_t *filter = &ctx->chunk_filter;
+    if (filter->ready && filter->unsaved && !filter->stale && !save(ctx)) {
+        fz_log(FZ_WARNING, "Could not write the chunk presence filter");
+    }
+    if (NULL != filter->blocks) free(filter->blocks);
+    filter->blocks = NULL;
+    pthread_mutex_destroy(&filter->mtx);
+}
+
+
+/* Returns 0 only if `chunk_checksum` is in neither the blob store nor `filezap_chunk_locs`, 1 means it may be in either.
+The filter is loaded or rebuilt on first use, without one every chunk may be present */
+extern int fz_chunk_filter_may_contain(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum){
+    int result = 1;
+    pthread_mutex_lock(&ctx->chunk_filter.mtx);
+    if (ensure_ready(ctx)) result = test_key(&ctx->chunk_filter, chunk_checksum);
+    pthread_mutex_unlock(&ctx->chunk_filter.mtx);
+    return result;
+}
+
+
+/* Call after committing `nkeys` checksums to the table behind `source`, `epoch` is the epoch the commit moved that table to.
+If another connection committed in between the filter no longer covers the table and is not persisted */
+extern void fz_chunk_filter_commit(fz_ctx_t *ctx, int source, uint64_t epoch, fz_hex_digest_t *keys, size_t nkeys){
+    fz_chunk_filter_t *filter = &ctx->chunk_filter;
+    pthread_mutex_lock(&filter->mtx);
+    if (filter->ready){
+        uint64_t *covered = (FZ_FILTER_BLOB_STATE & source)? &filter->blob_state_epoch : &filter->chunks_epoch;
+        if (0 != *covered && *covered + 1 != epoch) filter->stale = 1;
+        *covered = epoch;
+        for (size_t i = 0; i < nkeys; i++) set_key(filter, keys[i]);
+        filter->nkeys += nkeys;
+        filter->unsaved = 1;
+    }
+    pthread_mutex_unlock(&filter->mtx);
+}
+
+
+/* Caller holds the filter lock */
+static int ensure_ready(fz_ctx_t *ctx){
+    fz_chunk_filter_t *filter = &ctx->chunk_filter;
+    uint64_t blob_state_epoch = 0;
+    uint64_t chunks_epoch = 0;
+    if (filter->ready) return 1;
+    if (filter->failed) return 0;
+
+    if (fz_query_meta_value(ctx, FZ_META_BLOB_STATE_EPOCH, &blob_state_epoch)
+        && fz_query_chunks_epoch(ctx, &chunks_epoch)
+        && load(ctx, blob_state_epoch, chunks_epoch)){
+        fz_log(FZ_INFO, "Loaded chunk presence filter with %lu key(s)", filter->nkeys);
+        filter->ready = 1;
+        return 1;
+    }
+    if (!rebuild(ctx)) {
+        fz_log(FZ_WARNING, "Could not build the chunk presence filter, every chunk is looked up");
+        filter->failed = 1;
+        return 0;
+    }
+    fz_log(FZ_INFO, "Built chunk presence filter with %lu key(s)", filter->nkeys);
+    filter->ready = 1;
+    filter->unsaved = 1;
+    return 1;
+}
+
+
+/* Covers the blob state index, `filezap_chunk_locs` and loose blobs the index does not know about.
+The epochs are read first, a commit racing the scan only adds keys so the filter still covers the tables at those epochs */
+static int rebuild(fz_ctx_t *ctx){
+    int result = 1;
+    fz_chunk_filter_t *filter = &ctx->chunk_filter;
+    fz_hex_digest_t *keys = NULL;
+
+    if (!fz_query_meta_value(ctx, FZ_META_BLOB_STATE_EPOCH, &filter->blob_state_epoch)) RETURN_DEFER(0);
+    if (!fz_query_chunks_epoch(ctx, &filter->chunks_epoch)) RETURN_DEFER(0);
+    if (!fz_query_chunk_checksums(ctx, &keys)) RETURN_DEFER(0);
+
+    size_t cursor = 0;
+    fz_hex_digest_t key = 0;
+    fz_blob_state_t *state = NULL;
+    pthread_mutex_lock(&ctx->blob_state_mtx);
+    while (fz_chunk_index_next(&ctx->blob_state, &cursor, &key, &state)) arrput(keys, key);
+    pthread_mutex_unlock(&ctx->blob_state_mtx);
+
+    /* A missing `metadata_loc` just means there are no loose blobs yet */
+    fz_blob_store_list_loose(ctx, &keys);
+
+    if (!alloc_blocks(filter, arrlenu(keys))) RETURN_DEFER(0);
+    for (size_t i = 0; i < arrlenu(keys); i++) set_key(filter, keys[i]);
+    filter->nkeys = arrlenu(keys);
+    defer:
+        if (NULL != keys) arrfree(keys);
+        return result;
+}
+
+
+static int load(fz_ctx_t *ctx, uint64_t blob_state_epoch, uint64_t chunks_epoch){
+    int result = 1;
+    fz_chunk_filter_t *filter = &ctx->chunk_filter;
+    FILE *fh = NULL;
+    chunk_filter_header_t header = {0};
+    char path[RESERVED];
+
+    if (!filter_path(ctx, path, sizeof(path))) RETURN_DEFER(0);
+    fh = fopen(path, "rb");
+    if (NULL == fh) RETURN_DEFER(0);
+    if (1 != fread(&header, sizeof(header), 1, fh)) RETURN_DEFER(0);
+    /* A filter that outgrew its size is rebuilt rather than loaded */
+    if (CHUNK_FILTER_MAGIC != header.magic
+        || CHUNK_FILTER_VERSION != header.version
+        || blob_state_epoch != header.blob_state_epoch
+        || chunks_epoch != header.chunks_epoch
+        || CHUNK_FILTER_MIN_BLOCKS > header.nblocks
+        || header.nkeys * CHUNK_FILTER_BITS_PER_KEY > header.nblocks * CHUNK_FILTER_BLOCK_WORDS * 32) RETURN_DEFER(0);
+
+    size_t size = (size_t)header.nblocks * CHUNK_FILTER_BLOCK_WORDS * sizeof(uint32_t);
+    uint32_t *blocks = malloc(size);
+    if (NULL == blocks) RETURN_DEFER(0);
+    fz_hex_digest_t checksum = 0;
+    if (size != fread(blocks, 1, size, fh)) {free(blocks); RETURN_DEFER(0);}
+    xxhash_hexdigest((char *)blocks, size, &checksum);
+    if (checksum != header.checksum) {free(blocks); RETURN_DEFER(0);}
+
+    if (NULL != filter->blocks) free(filter->blocks);
+    filter->blocks = blocks;
+    filter->nblocks = (size_t)header.nblocks;
+    filter->nkeys = (size_t)header.nkeys;
+    filter->blob_state_epoch = blob_state_epoch;
+    filter->chunks_epoch = chunks_epoch;
+    defer:
+        if (NULL != fh) fclose(fh);
+        return result;
+}
+
+
+static int save(fz_ctx_t *ctx){
+    int result = 1;
+    fz_chunk_filter_t *filter = &ctx->chunk_filter;
+    FILE *fh = NULL;
+    char path[RESERVED];
+    char temp_path[RESERVED];
+    size_t size = filter->nblocks * CHUNK_FILTER_BLOCK_WORDS * sizeof(uint32_t);
+
+    if (!filter_path(ctx, path, sizeof(path))) RETURN_DEFER(0);
+    int len = snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    if (0 >= len || (size_t)len >= sizeof(temp_path)) RETURN_DEFER(0);
+
+    chunk_filter_header_t header = {
+        .magic = CHUNK_FILTER_MAGIC,
+        .version = CHUNK_FILTER_VERSION,
+        .nblocks = filter->nblocks,
+        .nkeys = filter->nkeys,
+        .blob_state_epoch = filter->blob_state_epoch,
+        .chunks_epoch = filter->chunks_epoch,
+    };
+    xxhash_hexdigest((char *)filter->blocks, size, &header.checksum);
+
+    fh = fopen(temp_path, "wb");
+    if (NULL == fh) RETURN_DEFER(0);
+    if (1 != fwrite(&header, sizeof(header), 1, fh) || size != fwrite(filter->blocks, 1, size, fh)) RETURN_DEFER(0);
+    if (0 != fclose(fh)) {fh = NULL; RETURN_DEFER(0);}
+    fh = NULL;
+    if (0 != rename(temp_path, path)) RETURN_DEFER(0);
+    defer:
+        if (NULL != fh) fclose(fh);
+        if (!result) remove(temp_path);
+        return result;
+}
+
+
+static int alloc_blocks(fz_chunk_filter_t *filter, size_t nkeys){
+    size_t nblocks = CHUNK_FILTER_MIN_BLOCKS;
+    /* Room for twice the current keys before the filter is rebuilt */
+    while (nblocks * CHUNK_FILTER_BLOCK_WORDS * 32 < 2 * nkeys * CHUNK_FILTER_BITS_PER_KEY) nblocks <<= 1;
+    uint32_t *blocks = calloc(nblocks * CHUNK_FILTER_BLOCK_WORDS, sizeof(uint32_t));
+    if (NULL == blocks) return 0;
+    if (NULL != filter->blocks) free(filter->blocks);
+    filter->blocks = blocks;
+    filter->nblocks = nblocks;
+    filter->nkeys = 0;
+    return 1;
+}
+
+
+/* Checksums are already well mixed, the high half picks the block and the low half the bit in each word */
+static inline void set_key(fz_chunk_filter_t *filter, fz_hex_digest_t key){
+    uint32_t *block = &filter->blocks[(size_t)(key >> 32) % filter->nblocks * CHUNK_FILTER_BLOCK_WORDS];
+    for (int i = 0; i < CHUNK_FILTER_BLOCK_WORDS; i++){
+        block[i] |= 1U << (((uint32_t)key * salt[i]) >> 27);
+    }
+}
+
+
+static inline int test_key(fz_chunk_filter_t *filter, fz_hex_digest_t key){
+    uint32_t *block = &filter->blocks[(size_t)(key >> 32) % filter->nblocks * CHUNK_FILTER_BLOCK_WORDS];
+    for (int i = 0; i < CHUNK_FILTER_BLOCK_WORDS; i++){
+        if (0 == (block[i] & (1U << (((uint32_t)key * salt[i]) >> 27)))) return 0;
+    }
+    return 1;
+}
+
+
+static inline int filter_path(fz_ctx_t *ctx, char *buffer, size_t buffer_size){
+    int len = snprintf(buffer, buffer_size, "%s%s", ctx->metadata_loc, CHUNK_FILTER_FILE);
+    return (0 < len && (size_t)len < buffer_size);
+}
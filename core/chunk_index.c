@@ -0,0 +1,310 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "core.h"
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#define CHUNK_INDEX_MIN_CAPACITY 64
+#define CHUNK_INDEX_SNAPSHOT_MAGIC 0x58444e494b4e4843ULL /* "CHNKINDX" */
+#define CHUNK_INDEX_SNAPSHOT_VERSION 2
+
+/* Grow once the table is more than 3/4 full, linear probe runs stay short below that */
+#define CHUNK_INDEX_FULL(count_, capacity_) ((count_) * 4 >= (capacity_) * 3)
+
+
+/* Snapshot layout: this header, `capacity` keys, then `capacity` values, all in host byte order */
+typedef struct chunk_index_header_s{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t value_size;
+    uint64_t capacity;
+    uint64_t count;
+    uint64_t epoch;
+    uint64_t checksum;
+    uint64_t has_zero;
+    fz_blob_state_t zero_value;
+    uint8_t reserved[128 - 7 * sizeof(uint64_t) - sizeof(fz_blob_state_t)];
+} chunk_index_header_t;
+
+/* Keys follow the header and must stay 16-byte aligned for the SSE2 probe */
+_Static_assert(128 == sizeof(chunk_index_header_t), "chunk index snapshot header must be 128 bytes");
+
+
+static inline size_t home_slot(fz_chunk_index_t *index, fz_hex_digest_t key);
+static inline size_t probe(fz_chunk_index_t *index, fz_hex_digest_t key, int *found);
+static int rehash(fz_chunk_index_t *index, size_t capacity);
+static void release_storage(fz_chunk_index_t *index);
+
+
+extern int fz_chunk_index_init(fz_chunk_index_t *index, size_t capacity){
+    memset(index, 0, sizeof(*index));
+    size_t size = CHUNK_INDEX_MIN_CAPACITY;
+    while (CHUNK_INDEX_FULL(capacity, size)) size <<= 1;
+    return rehash(index, size);
+}
+
+
+extern void fz_chunk_index_destroy(fz_chunk_index_t *index){
+    release_storage(index);
+    memset(index, 0, sizeof(*index));
+}
+
+
+/* Returned pointers stay valid until the next put or delete */
+extern fz_blob_state_t *fz_chunk_index_get(fz_chunk_index_t *index, fz_hex_digest_t key){
+    int found = 0;
+    if (0 == key) return index->has_zero? &index->zero_value : NULL;
+    size_t slot = probe(index, key, &found);
+    return found? &index->values[slot] : NULL;
+}
+
+
+extern int fz_chunk_index_put(fz_chunk_index_t *index, fz_hex_digest_t key, fz_blob_state_t *value){
+    int found = 0;
+    if (0 == key) {
+        index->zero_value = *value;
+        index->has_zero = 1;
+        return 1;
+    }
+    if (CHUNK_INDEX_FULL(index->count + 1, index->capacity) && !rehash(index, index->capacity << 1)) return 0;
+    size_t slot = probe(index, key, &found);
+    if (!found) {
+        index->keys[slot] = key;
+        index->count++;
+    }
+    index->values[slot] = *value;
+    return 1;
+}
+
+
+/* Backward shift deletion, later members of the probe run move into the hole so no tombstones are needed */
+extern int fz_chunk_index_del(fz_chunk_index_t *index, fz_hex_digest_t key){
+    int found = 0;
+    if (0 == key) {
+        int had = index->has_zero;
+        index->has_zero = 0;
+        return had;
+    }
+    size_t hole = probe(index, key, &found);
+    if (!found) return 0;
+    size_t mask = index->capacity - 1;
+    size_t next = (hole + 1) & mask;
+    while (0 != index->keys[next]){
+        size_t home = home_slot(index, index->keys[next]);
+        /* Move the entry unless its home lies cyclically in (hole, next] */
+        if (((next - home) & mask) >= ((next - hole) & mask)){
+            index->keys[hole] = index->keys[next];
+            index->values[hole] = index->values[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    index->keys[hole] = 0;
+    index->count--;
+    return 1;
+}
+
+
+/* Iterates all entries, start with `*cursor` at 0. Entries must not be added or removed while iterating */
+extern int fz_chunk_index_next(fz_chunk_index_t *index, size_t *cursor, fz_hex_digest_t *key, fz_blob_state_t **value){
+    while (*cursor < index->capacity){
+        size_t slot = (*cursor)++;
+        if (0 == index->keys[slot]) continue;
+        *key = index->keys[slot];
+        *value = &index->values[slot];
+        return 1;
+    }
+    if (*cursor == index->capacity && index->has_zero){
+        (*cursor)++;
+        *key = 0;
+        *value = &index->zero_value;
+        return 1;
+    }
+    return 0;
+}
+
+
+extern size_t fz_chunk_index_len(fz_chunk_index_t *index){
+    return index->count + (index->has_zero? 1 : 0);
+}
+
+
+/* Maps a snapshot written by `fz_chunk_index_save` copy-on-write and uses it as the table storage.
+Returns 0 without touching `index` if the file is missing, damaged or was written at a different `epoch` */
+extern int fz_chunk_index_load(fz_chunk_index_t *index, const char *path, uint64_t epoch){
+    int result = 1;
+    int fd = -1;
+    void *map = MAP_FAILED;
+    struct stat meta = {0};
+
+    fd = open(path, O_RDONLY);
+    if (-1 == fd || 0 != fstat(fd, &meta) || (size_t)meta.st_size < sizeof(chunk_index_header_t)) RETURN_DEFER(0);
+    map = mmap(NULL, (size_t)meta.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (MAP_FAILED == map) RETURN_DEFER(0);
+
+    chunk_index_header_t *header = (chunk_index_header_t *)map;
+    size_t payload_size = (size_t)header->capacity * (sizeof(fz_hex_digest_t) + sizeof(fz_blob_state_t));
+    if (CHUNK_INDEX_SNAPSHOT_MAGIC != header->magic
+        || CHUNK_INDEX_SNAPSHOT_VERSION != header->version
+        || sizeof(fz_blob_state_t) != header->value_size
+        || epoch != header->epoch
+        || header->capacity < CHUNK_INDEX_MIN_CAPACITY
+        || 0 != (header->capacity & (header->capacity - 1))
+        || CHUNK_INDEX_FULL(header->count, header->capacity)
+        || sizeof(chunk_index_header_t) + payload_size != (size_t)meta.st_size) RETURN_DEFER(0);
+
+    char *payload = (char *)map + sizeof(chunk_index_header_t);
+    fz_hex_digest_t checksum = 0;
+    xxhash_hexdigest(payload, payload_size, &checksum);
+    if (checksum != header->checksum) RETURN_DEFER(0);
+
+    release_storage(index);
+    index->keys = (fz_hex_digest_t *)payload;
+    index->values = (fz_blob_state_t *)(payload + header->capacity * sizeof(fz_hex_digest_t));
+    index->capacity = (size_t)header->capacity;
+    index->count = (size_t)header->count;
+    index->has_zero = (int)header->has_zero;
+    index->zero_value = header->zero_value;
+    index->map = map;
+    index->map_size = (size_t)meta.st_size;
+    map = MAP_FAILED;
+    defer:
+        if (MAP_FAILED != map) munmap(map, (size_t)meta.st_size);
+        if (-1 != fd) close(fd);
+        return result;
+}
+
+
+/* Writes the table next to `path` and renames it into place, readers never see a partial snapshot */
+extern int fz_chunk_index_save(fz_chunk_index_t *index, const char *path, uint64_t epoch){
+    int result = 1;
+    FILE *fh = NULL;
+    char temp_path[RESERVED];
+    chunk_index_header_t header = {0};
+
+    int len = snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    if (0 >= len || (size_t)len >= sizeof(temp_path)) RETURN_DEFER(0);
+
+    size_t keys_size = index->capacity * sizeof(fz_hex_digest_t);
+    size_t values_size = index->capacity * sizeof(fz_blob_state_t);
+    XXH3_state_t *state = XXH3_createState();
+    if (NULL == state) RETURN_DEFER(0);
+    XXH3_64bits_reset(state);
+    XXH3_64bits_update(state, index->keys, keys_size);
+    XXH3_64bits_update(state, index->values, values_size);
+    header.checksum = XXH3_64bits_digest(state);
+    XXH3_freeState(state);
+
+    header.magic = CHUNK_INDEX_SNAPSHOT_MAGIC;
+    header.version = CHUNK_INDEX_SNAPSHOT_VERSION;
+    header.value_size = sizeof(fz_blob_state_t);
+    header.capacity = index->capacity;
+    header.count = index->count;
+    header.epoch = epoch;
+    header.has_zero = (uint64_t)index->has_zero;
+    header.zero_value = index->zero_value;
+
+    fh = fopen(temp_path, "wb");
+    if (NULL == fh) RETURN_DEFER(0);
+    if (1 != fwrite(&header, sizeof(header), 1, fh)
+        || keys_size != fwrite(index->keys, 1, keys_size, fh)
+        || values_size != fwrite(index->values, 1, values_size, fh)) RETURN_DEFER(0);
+    if (0 != fclose(fh)) {fh = NULL; RETURN_DEFER(0);}
+    fh = NULL;
+    if (0 != rename(temp_path, path)) RETURN_DEFER(0);
+    defer:
+        if (NULL != fh) fclose(fh);
+        if (!result) remove(temp_path);
+        return result;
+}
+
+
+/* Checksums are already uniformly distributed, their low bits pick the slot */
+static inline size_t home_slot(fz_chunk_index_t *index, fz_hex_digest_t key){
+    return (size_t)key & (index->capacity - 1);
+}
+
+
+/* Returns the slot holding `key`, or the empty slot where it would be inserted.
+The SSE2 path compares an aligned pair of slots per step, the table always has an empty slot so the loop terminates */
+static inline size_t probe(fz_chunk_index_t *index, fz_hex_digest_t key, int *found){
+    size_t mask = index->capacity - 1;
+    size_t slot = home_slot(index, key);
+#if defined(__SSE2__)
+    const __m128i needle = _mm_set1_epi64x((long long)key);
+    const __m128i empty = _mm_setzero_si128();
+    size_t pair = slot & ~(size_t)1;
+    /* The slot before the home slot is not part of the probe run, an empty slot there must not end the search */
+    int skip = (int)(slot & 1);
+    while (1){
+        __m128i keys = _mm_load_si128((const __m128i *)&index->keys[pair]);
+        __m128i eq = _mm_cmpeq_epi32(keys, needle);
+        __m128i ez = _mm_cmpeq_epi32(keys, empty);
+        /* A 64-bit lane matches when both of its 32-bit halves do */
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        ez = _mm_and_si128(ez, _mm_shuffle_epi32(ez, _MM_SHUFFLE(2, 3, 0, 1)));
+        int eq_mask = _mm_movemask_pd(_mm_castsi128_pd(eq));
+        int ez_mask = _mm_movemask_pd(_mm_castsi128_pd(ez)) & ~skip;
+        if (eq_mask) {
+            *found = 1;
+            return pair + (eq_mask & 1? 0 : 1);
+        }
+        if (ez_mask) {
+            *found = 0;
+            return pair + (ez_mask & 1? 0 : 1);
+        }
+        skip = 0;
+        pair = (pair + 2) & mask;
+    }
+#else
+    while (1){
+        if (key == index->keys[slot]) {*found = 1; return slot;}
+        if (0 == index->keys[slot]) {*found = 0; return slot;}
+        slot = (slot + 1) & mask;
+    }
+#endif
+}
+
+
+static int rehash(fz_chunk_index_t *index, size_t capacity){
+    fz_chunk_index_t grown = {0};
+    /* 16-byte alignment lets the SSE2 probe load key pairs with aligned loads */
+    if (0 != posix_memalign((void **)&grown.keys, 16, capacity * sizeof(fz_hex_digest_t))) return 0;
+    grown.values = malloc(capacity * sizeof(fz_blob_state_t));
+    if (NULL == grown.values) {free(grown.keys); return 0;}
+    memset(grown.keys, 0, capacity * sizeof(fz_hex_digest_t));
+    grown.capacity = capacity;
+
+    for (size_t i = 0; i < index->capacity; i++){
+        int found = 0;
+        if (0 == index->keys[i]) continue;
+        size_t slot = probe(&grown, index->keys[i], &found);
+        grown.keys[slot] = index->keys[i];
+        grown.values[slot] = index->values[i];
+        grown.count++;
+    }
+    grown.has_zero = index->has_zero;
+    grown.zero_value = index->zero_value;
+    release_storage(index);
+    *index = grown;
+    return 1;
+}
+
+
+static void release_storage(fz_chunk_index_t *index){
+    if (NULL != index->map) munmap(index->map, index->map_size);
+    else {
+        if (NULL != index->keys) free(index->keys);
+        if (NULL != index->values) free(index->values);
+    }
+    index->map = NULL;
+    index->map_size = 0;
+    index->keys = NULL;
+    index->values = NULL;
+    index->capacity = 0;
+    index->count = 0;
+}
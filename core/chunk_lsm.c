@@ -0,0 +1,1113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include "core.h"
+
+/* The manifest digest is taken with a state on the stack, that needs the state's layout */
+#define XXH_STATIC_LINKING_ONLY
+#include "../hash/xxhash.h"
+
+#define CHUNK_LSM_DIR "chunk_lsm/"
+#define CHUNK_LSM_RUN_MAGIC 0x4e55524d534c4b43ULL /* "CKLSMRUN" */
+#define CHUNK_LSM_MANIFEST_MAGIC 0x464e4d4d534c4b43ULL /* "CKLSMMNF" */
+#define CHUNK_LSM_VERSION 1
+
+/* Version 3 manifests carry the chunks epoch, version 2 ones checksum the record without it, version 1 ones only their run numbers */
+#define CHUNK_LSM_MANIFEST_VERSION 3
+
+/* A run is merged into the one before it while that one holds at most this many times its rows, the number of runs stays
+logarithmic in the rows and every row is rewritten about as often */
+#define CHUNK_LSM_MERGE_RATIO 2
+
+/* The logs are rewritten without their dead head once it is this many bytes and outweighs the live part */
+#define CHUNK_LSM_LOG_SLACK KB(64)
+
+#define LSM_FILE_ADD 1
+#define LSM_FILE_DROP 2
+#define LSM_FILE_PURGE 3
+
+
+/* Run layout: this header, `count` sorted keys, their `count` locations, then the run's `nfiles` distinct file ids sorted, host byte order */
+typedef struct lsm_run_header_s{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t value_size;
+    uint64_t count;
+    uint64_t nfiles;
+    uint64_t min_key;
+    uint64_t max_key;
+    uint64_t checksum;
+    uint64_t reserved;
+} lsm_run_header_t;
+
+_Static_assert(64 == sizeof(lsm_run_header_t), "LSM run header must be 64 bytes");
+
+
+/* The manifest is the commit point: only the runs it lists and the log bytes below its lengths exist, followed by `nruns` run numbers */
+typedef struct lsm_manifest_s{
+    uint64_t magic;
+    uint32_t version;
+    uint32_t nruns;
+    uint64_t next_seq;
+    uint64_t next_file_id;
+    uint64_t files_gen;
+    uint64_t files_len;
+    uint64_t zero_gen;
+    uint64_t zero_head;
+    uint64_t zero_len;
+    uint64_t checksum;
+    uint64_t chunks_epoch;
+} lsm_manifest_t;
+
+
+/* File log record, an ADD is followed by `path_len` bytes of path */
+typedef struct lsm_file_record_s{
+    uint32_t type;
+    uint32_t path_len;
+    uint64_t file_id;
+    uint64_t nrows;
+} lsm_file_record_t;
+
+
+/* Rows are read through strided cursors, so runs and the sorted rows of a commit merge the same way */
+typedef struct lsm_cursor_s{
+    const char *keys;
+    size_t key_stride;
+    const char *locs;
+    size_t loc_stride;
+    size_t pos;
+    size_t count;
+} lsm_cursor_t;
+
+
+typedef struct lsm_row_s{
+    uint64_t key;
+    fz_lsm_loc_t loc;
+} lsm_row_t;
+
+
+typedef struct lsm_id_set_s lsm_id_set_t;
+
+
+static int lsm_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_t **chunk_buffer, size_t *nchunk, struct missing_chunks_map_s **missing_chunks);
+static int lsm_commit_group(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs, uint64_t *epoch);
+static int lsm_remove_files(fz_ctx_t *ctx, const char **file_paths, size_t nfiles, size_t *nrows);
+static int lsm_list_files(fz_ctx_t *ctx, const char *after, size_t limit, char ***file_paths);
+static int lsm_unreferenced(fz_ctx_t *ctx, size_t limit, fz_hex_digest_t **checksums);
+static int lsm_collect(fz_ctx_t *ctx, fz_hex_digest_t *checksums, size_t nchunk);
+static int lsm_checksums(fz_ctx_t *ctx, fz_hex_digest_t **checksums);
+static int lsm_chunks_epoch(fz_ctx_t *ctx, uint64_t *epoch);
+static int ensure_open(fz_ctx_t *ctx);
+static int load(fz_ctx_t *ctx);
+static void release(fz_chunk_lsm_t *lsm);
+static int map_run(fz_ctx_t *ctx, uint64_t seq, fz_lsm_run_t *run);
+static int write_run(fz_ctx_t *ctx, lsm_cursor_t *cursors, size_t ncursors, lsm_id_set_t *adding, fz_lsm_run_t *run, fz_lsm_zero_t **dropped);
+static int merge_pass(fz_chunk_lsm_t *lsm, lsm_cursor_t *cursors, size_t ncursors, lsm_id_set_t *adding, FILE *fh, XXH3_state_t *state, int locs, lsm_run_header_t *header, lsm_id_set_t **file_ids, fz_lsm_zero_t **dropped);
+static int compact(fz_ctx_t *ctx, size_t *indices, size_t nruns);
+static int commit(fz_ctx_t *ctx, fz_lsm_run_t *runs, char *file_records, fz_lsm_zero_t *zero_records, uint64_t chunks_epoch);
+static int rewrite_logs(fz_ctx_t *ctx);
+static int save_manifest(fz_ctx_t *ctx, lsm_manifest_t *manifest, fz_lsm_run_t *runs);
+static fz_hex_digest_t manifest_checksum(lsm_manifest_t *manifest, uint64_t *seqs);
+static inline size_t manifest_size(uint32_t version);
+static void apply_file_records(fz_chunk_lsm_t *lsm, const char *records, size_t size);
+static void put_file_record(char **records, uint32_t type, uint64_t file_id, uint64_t nrows, const char *path);
+static int is_live(fz_chunk_lsm_t *lsm, uint64_t key);
+static size_t lower_bound(const fz_lsm_run_t *run, uint64_t key);
+static int write_at(fz_ctx_t *ctx, const char *path, uint64_t offset, const void *data, size_t size);
+static int read_prefix(const char *path, uint64_t size, char **data);
+static int compare_rows(const void *a, const void *b);
+static int compare_ids(const void *a, const void *b);
+static int compare_paths(const void *a, const void *b);
+static inline int lsm_path(fz_ctx_t *ctx, char *buffer, size_t buffer_size, const char *name, uint64_t number);
+
+
+const fz_meta_ops_t fz_meta_lsm_ops = {
+    .required_chunk_list = lsm_required_chunk_list,
+    .commit_group = lsm_commit_group,
+    .remove_files = lsm_remove_files,
+    .list_files = lsm_list_files,
+    .unreferenced = lsm_unreferenced,
+    .collect = lsm_collect,
+    .checksums = lsm_checksums,
+    .chunks_epoch = lsm_chunks_epoch,
+};
+
+
+extern void fz_chunk_lsm_init(fz_ctx_t *ctx){
+    memset(&ctx->chunk_lsm, 0, sizeof(ctx->chunk_lsm));
+    ctx->chunk_lsm.lock_fd = -1;
+    pthread_mutex_init(&ctx->chunk_lsm.mtx, NULL);
+}
+
+
+extern void fz_chunk_lsm_destroy(fz_ctx_t *ctx){
+    release(&ctx->chunk_lsm);
+    pthread_mutex_destroy(&ctx->chunk_lsm.mtx);
+}
+
+
+/* Same contract as the SQLite lookup: locations of every missing chunk the presence filter does not rule out */
+static int lsm_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_t **chunk_buffer, size_t *nchunk, struct missing_chunks_map_s **missing_chunks){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    fz_chunk_t *buffer = NULL;
+    size_t local_nchunk = 0;
+    size_t max_alloc = (0 < mnfst->chunk_seq.chunk_seq_len)? mnfst->chunk_seq.chunk_seq_len : 1;
+    uint64_t *keys = NULL;
+
+    /* The filter is asked before the index lock is taken, a filter rebuild reads the index under the filter lock */
+    for (size_t i = 0; i < hmlenu(*missing_chunks); i++){
+        fz_hex_digest_t key = (*missing_chunks)[i].key;
+        if (1 == (*missing_chunks)[i].value && fz_chunk_filter_may_contain(ctx, key)) arrput(keys, key);
+    }
+    buffer = calloc(max_alloc, sizeof(fz_chunk_t));
+    if (NULL == buffer) return 0;
+
+    pthread_mutex_lock(&lsm->mtx);
+    if (0 < arrlenu(keys) && !ensure_open(ctx)) RETURN_DEFER(0);
+    for (size_t k = 0; k < arrlenu(keys); k++){
+        for (size_t r = 0; r < arrlenu(lsm->runs); r++){
+            fz_lsm_run_t *run = &lsm->runs[r];
+            for (size_t i = lower_bound(run, keys[k]); i < run->count && keys[k] == run->keys[i]; i++){
+                struct lsm_file_map_s *file = hmgetp_null(lsm->files, run->locs[i].file_id);
+                if (NULL == file) continue;
+                if (local_nchunk >= max_alloc) {
+                    fz_chunk_t *grown = realloc(buffer, 2 * max_alloc * sizeof(fz_chunk_t));
+                    if (NULL == grown) RETURN_DEFER(0);
+                    buffer = grown;
+                    max_alloc *= 2;
+                }
+                buffer[local_nchunk].chunk_checksum = keys[k];
+                buffer[local_nchunk].cutpoint = (size_t)run->locs[i].cutpoint;
+                buffer[local_nchunk].chunk_size = (size_t)run->locs[i].chunk_size;
+                buffer[local_nchunk].src_file_path = strdup(file->value.path);
+                if (NULL == buffer[local_nchunk].src_file_path) RETURN_DEFER(0);
+                local_nchunk++;
+            }
+        }
+    }
+    *nchunk = local_nchunk;
+    *chunk_buffer = buffer;
+    fz_log(FZ_INFO, "Found chunk size: %lu", local_nchunk);
+    defer:
+        pthread_mutex_unlock(&lsm->mtx);
+        if (NULL != keys) arrfree(keys);
+        if (!result) {
+            for (size_t i = 0; i < local_nchunk; i++) free((char *)buffer[i].src_file_path);
+            free(buffer);
+        }
+        return result;
+}
+
+
+/* Writes the rows of a group of received files as one run. A path recorded before, or earlier in the group, is replaced:
+its old id is dropped and the rows of an id that never becomes live are left out of the run with their keys offered for collection.
+The chunks epoch moves in the same manifest, `*epoch` receives it */
+static int lsm_commit_group(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs, uint64_t *epoch){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    lsm_row_t *rows = NULL;
+    char *file_records = NULL;
+    fz_lsm_zero_t *dropped = NULL;
+    lsm_id_set_t *adding = NULL;
+    struct {char *key; uint64_t value;} *latest = NULL;
+    fz_lsm_run_t run = {0};
+    fz_lsm_run_t *runs = NULL;
+    int committed = 0;
+
+    fz_log(FZ_INFO, "Committing chunk metadata of %lu file(s)", njobs);
+    pthread_mutex_lock(&lsm->mtx);
+    if (!ensure_open(ctx)) RETURN_DEFER(0);
+    sh_new_strdup(latest);
+    uint64_t first_id = lsm->next_file_id;
+    for (size_t j = 0; j < njobs; j++) shput(latest, jobs[j].dest_file_path, first_id + j);
+
+    for (size_t j = 0; j < njobs; j++){
+        fz_chunk_seq_t *seq = &jobs[j].mnfst.chunk_seq;
+        uint64_t file_id = first_id + j;
+        uint64_t nrows = 0;
+        lsm_id_set_t *seen = NULL;
+        for (size_t i = 0; i < seq->chunk_seq_len; i++){
+            if (0 <= hmgeti(seen, seq->chunk_checksum[i])) continue;
+            hmput(seen, seq->chunk_checksum[i], 1);
+            lsm_row_t row = {.key = seq->chunk_checksum[i], .loc = {.file_id = file_id, .cutpoint = seq->cutpoint[i], .chunk_size = seq->chunk_size[i]}};
+            arrput(rows, row);
+            nrows++;
+        }
+        if (NULL != seen) hmfree(seen);
+        if (file_id != shget(latest, jobs[j].dest_file_path)) continue;
+        ptrdiff_t old = shgeti(lsm->paths, jobs[j].dest_file_path);
+        if (0 <= old) put_file_record(&file_records, LSM_FILE_DROP, lsm->paths[old].value, 0, NULL);
+        put_file_record(&file_records, LSM_FILE_ADD, file_id, nrows, jobs[j].dest_file_path);
+        hmput(adding, file_id, 1);
+    }
+    qsort(rows, arrlenu(rows), sizeof(lsm_row_t), compare_rows);
+
+    lsm_cursor_t cursor = {
+        .keys = (const char *)&rows[0].key, .key_stride = sizeof(lsm_row_t),
+        .locs = (const char *)&rows[0].loc, .loc_stride = sizeof(lsm_row_t),
+        .count = arrlenu(rows),
+    };
+    lsm->next_file_id += njobs;
+    if (!write_run(ctx, &cursor, 1, adding, &run, &dropped)) RETURN_DEFER(0);
+    for (size_t i = 0; i < arrlenu(lsm->runs); i++) arrput(runs, lsm->runs[i]);
+    if (0 < run.count) arrput(runs, run);
+    if (!commit(ctx, runs, file_records, dropped, lsm->chunks_epoch + 1)) RETURN_DEFER(0);
+    committed = 1;
+    *epoch = lsm->chunks_epoch;
+    if (0 == run.count) {
+        char path[RESERVED];
+        munmap(run.map, run.map_size);
+        if (lsm_path(ctx, path, sizeof(path), "run-%08llx.idx", run.seq)) remove(path);
+    }
+
+    /* Size tiered merging, a failed merge leaves the runs as they were and is tried again after the next commit */
+    while (2 <= arrlenu(lsm->runs)){
+        size_t n = arrlenu(lsm->runs);
+        if (lsm->runs[n - 2].count > CHUNK_LSM_MERGE_RATIO * lsm->runs[n - 1].count) break;
+        size_t pair[2] = {n - 2, n - 1};
+        if (!compact(ctx, pair, 2)) {
+            fz_log(FZ_WARNING, "Could not merge chunk index runs");
+            break;
+        }
+    }
+    fz_log(FZ_INFO, "Chunk metadata committed successfully");
+    defer:
+        if (!result && !committed && NULL != run.map) {
+            char path[RESERVED];
+            munmap(run.map, run.map_size);
+            if (lsm_path(ctx, path, sizeof(path), "run-%08llx.idx", run.seq)) remove(path);
+        }
+        pthread_mutex_unlock(&lsm->mtx);
+        if (NULL != rows) arrfree(rows);
+        if (NULL != runs) arrfree(runs);
+        if (NULL != file_records) arrfree(file_records);
+        if (NULL != dropped) arrfree(dropped);
+        if (NULL != adding) hmfree(adding);
+        if (NULL != latest) shfree(latest);
+        return result;
+}
+
+
+/* Drops the files from the log, their rows stay in the runs until a compaction purges them */
+static int lsm_remove_files(fz_ctx_t *ctx, const char **file_paths, size_t nfiles, size_t *nrows){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    char *file_records = NULL;
+    size_t total = 0;
+
+    if (0 == nfiles) return 1;
+    pthread_mutex_lock(&lsm->mtx);
+    if (!ensure_open(ctx)) RETURN_DEFER(0);
+    for (size_t i = 0; i < nfiles; i++){
+        ptrdiff_t at = shgeti(lsm->paths, file_paths[i]);
+        if (0 > at) continue;
+        uint64_t file_id = lsm->paths[at].value;
+        put_file_record(&file_records, LSM_FILE_DROP, file_id, 0, NULL);
+        total += (size_t)hmget(lsm->files, file_id).nrows;
+    }
+    if (NULL != file_records && !commit(ctx, lsm->runs, file_records, NULL, lsm->chunks_epoch)) RETURN_DEFER(0);
+    defer:
+        pthread_mutex_unlock(&lsm->mtx);
+        if (NULL != file_records) arrfree(file_records);
+        if (result && NULL != nrows) *nrows = total;
+        return result;
+}
+
+
+static int lsm_list_files(fz_ctx_t *ctx, const char *after, size_t limit, char ***file_paths){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+
+    pthread_mutex_lock(&lsm->mtx);
+    if (!ensure_open(ctx)) RETURN_DEFER(0);
+    if (lsm->paths_dirty) {
+        arrfree(lsm->sorted_paths);
+        for (size_t i = 0; i < shlenu(lsm->paths); i++) arrput(lsm->sorted_paths, lsm->paths[i].key);
+        qsort(lsm->sorted_paths, arrlenu(lsm->sorted_paths), sizeof(char *), compare_paths);
+        lsm->paths_dirty = 0;
+    }
+    size_t lo = 0, hi = arrlenu(lsm->sorted_paths);
+    while (NULL != after && lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        if (0 >= strcmp(lsm->sorted_paths[mid], after)) lo = mid + 1;
+        else hi = mid;
+    }
+    for (size_t i = lo; i < arrlenu(lsm->sorted_paths) && i - lo < limit; i++){
+        char *copy = strdup(lsm->sorted_paths[i]);
+        if (NULL == copy) RETURN_DEFER(0);
+        arrput(*file_paths, copy);
+    }
+    defer:
+        pthread_mutex_unlock(&lsm->mtx);
+        return result;
+}
+
+
+/* Purges the rows of dropped files first, every key that loses its last row there joins the zero log. Entries are returned oldest first,
+those recorded again since are skipped */
+static int lsm_unreferenced(fz_ctx_t *ctx, size_t limit, fz_hex_digest_t **checksums){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    size_t *indices = NULL;
+    lsm_id_set_t *returned = NULL;
+
+    pthread_mutex_lock(&lsm->mtx);
+    if (!ensure_open(ctx)) RETURN_DEFER(0);
+    if (0 < hmlenu(lsm->pending)) {
+        for (size_t r = 0; r < arrlenu(lsm->runs); r++){
+            fz_lsm_run_t *run = &lsm->runs[r];
+            for (size_t p = 0; p < hmlenu(lsm->pending); p++){
+                if (NULL == bsearch(&lsm->pending[p].key, run->file_ids, run->nfiles, sizeof(uint64_t), compare_ids)) continue;
+                arrput(indices, r);
+                break;
+            }
+        }
+        if (!compact(ctx, indices, arrlenu(indices))) RETURN_DEFER(0);
+        if (!rewrite_logs(ctx)) fz_log(FZ_WARNING, "Could not rewrite the chunk index logs, they are rewritten on a later purge");
+    }
+    for (size_t i = 0; i < arrlenu(lsm->zero) && hmlenu(returned) < limit; i++){
+        uint64_t key = lsm->zero[i].key;
+        if (0 <= hmgeti(lsm->collected, key) || 0 <= hmgeti(returned, key) || is_live(lsm, key)) continue;
+        hmput(returned, key, 1);
+        arrput(*checksums, key);
+    }
+    defer:
+        pthread_mutex_unlock(&lsm->mtx);
+        if (NULL != indices) arrfree(indices);
+        if (NULL != returned) hmfree(returned);
+        return result;
+}
+
+
+/* Moves the head of the zero log past collected entries and entries whose chunk was recorded again */
+static int lsm_collect(fz_ctx_t *ctx, fz_hex_digest_t *checksums, size_t nchunk){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    lsm_id_set_t *passed_keys = NULL;
+
+    if (0 == nchunk) return 1;
+    pthread_mutex_lock(&lsm->mtx);
+    if (!ensure_open(ctx)) RETURN_DEFER(0);
+    for (size_t i = 0; i < nchunk; i++) hmput(lsm->collected, checksums[i], 1);
+    size_t passed = 0;
+    while (passed < arrlenu(lsm->zero)){
+        uint64_t key = lsm->zero[passed].key;
+        /* A key logged twice is passed on both entries, it leaves the set with the head */
+        if (0 > hmgeti(lsm->collected, key) && 0 > hmgeti(passed_keys, key) && !is_live(lsm, key)) break;
+        hmput(passed_keys, key, 1);
+        (void)hmdel(lsm->collected, key);
+        passed++;
+    }
+    if (0 == passed) RETURN_DEFER(1);
+    lsm_manifest_t manifest = {
+        .next_seq = lsm->next_seq, .next_file_id = lsm->next_file_id,
+        .files_gen = lsm->files_gen, .files_len = lsm->files_len,
+        .zero_gen = lsm->zero_gen, .zero_head = lsm->zero_head + passed, .zero_len = lsm->zero_len,
+        .chunks_epoch = lsm->chunks_epoch,
+    };
+    if (!save_manifest(ctx, &manifest, lsm->runs)) RETURN_DEFER(0);
+    arrdeln(lsm->zero, 0, passed);
+    lsm->zero_head += passed;
+    if (!rewrite_logs(ctx)) fz_log(FZ_WARNING, "Could not rewrite the chunk index logs, they are rewritten on a later collection");
+    defer:
+        pthread_mutex_unlock(&lsm->mtx);
+        if (NULL != passed_keys) hmfree(passed_keys);
+        return result;
+}
+
+
+/* Every key with a live row, a key held by several runs is listed once per run */
+static int lsm_checksums(fz_ctx_t *ctx, fz_hex_digest_t **checksums){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+
+    pthread_mutex_lock(&lsm->mtx);
+    if (!ensure_open(ctx)) RETURN_DEFER(0);
+    for (size_t r = 0; r < arrlenu(lsm->runs); r++){
+        fz_lsm_run_t *run = &lsm->runs[r];
+        int listed = 0;
+        for (size_t i = 0; i < run->count; i++){
+            if (0 < i && run->keys[i] != run->keys[i - 1]) listed = 0;
+            if (listed || 0 > hmgeti(lsm->files, run->locs[i].file_id)) continue;
+            arrput(*checksums, run->keys[i]);
+            listed = 1;
+        }
+    }
+    defer:
+        pthread_mutex_unlock(&lsm->mtx);
+        return result;
+}
+
+
+static int lsm_chunks_epoch(fz_ctx_t *ctx, uint64_t *epoch){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+
+    pthread_mutex_lock(&lsm->mtx);
+    if (!ensure_open(ctx)) RETURN_DEFER(0);
+    *epoch = lsm->chunks_epoch;
+    defer:
+        pthread_mutex_unlock(&lsm->mtx);
+        return result;
+}
+
+
+/* Caller holds the index lock. The directory is locked for this process, a second process sharing `metadata_loc` gets an error */
+static int ensure_open(fz_ctx_t *ctx){
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    char path[RESERVED];
+    if (lsm->ready) return 1;
+    if (lsm->failed) return 0;
+
+    int len = snprintf(path, sizeof(path), "%s%s", ctx->metadata_loc, CHUNK_LSM_DIR);
+    if (0 >= len || (size_t)len >= sizeof(path)) return 0;
+    mkdir(ctx->metadata_loc, 0755);
+    if (0 != mkdir(path, 0755) && EEXIST != errno) {
+        fz_log(FZ_ERROR, "Unable to create chunk index directory `%s`: %s", path, strerror(errno));
+        lsm->failed = 1;
+        return 0;
+    }
+    if (!lsm_path(ctx, path, sizeof(path), "LOCK", 0)) return 0;
+    lsm->lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (-1 == lsm->lock_fd || 0 != flock(lsm->lock_fd, LOCK_EX | LOCK_NB)) {
+        fz_log(FZ_ERROR, "Chunk index `%s` is in use by another process", path);
+        if (-1 != lsm->lock_fd) close(lsm->lock_fd);
+        lsm->lock_fd = -1;
+        lsm->failed = 1;
+        return 0;
+    }
+    if (!load(ctx)) {
+        fz_log(FZ_ERROR, "Unable to open the chunk index under `%s`", ctx->metadata_loc);
+        release(lsm);
+        lsm->failed = 1;
+        return 0;
+    }
+    fz_log(FZ_INFO, "Opened chunk index with %lu run(s) and %lu file(s)", arrlenu(lsm->runs), hmlenu(lsm->files));
+    lsm->ready = 1;
+    return 1;
+}
+
+
+/* Reads the manifest and what it names, then removes files it does not name. A damaged run or log loses the locations in it,
+which only costs scavenging: local copies are verified before they are used. A manifest that cannot be read fails the open
+instead, nothing would be left to tell live files from leftovers */
+static int load(fz_ctx_t *ctx){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    char path[RESERVED];
+    char *data = NULL;
+    uint64_t *seqs = NULL;
+    lsm_manifest_t manifest = {.next_seq = 1, .next_file_id = 1, .files_gen = 1, .zero_gen = 1};
+    DIR *dir = NULL;
+
+    sh_new_strdup(lsm->paths);
+    if (!lsm_path(ctx, path, sizeof(path), "MANIFEST", 0)) RETURN_DEFER(0);
+    FILE *fh = fopen(path, "rb");
+    if (NULL == fh && ENOENT != errno) {
+        fz_log(FZ_ERROR, "Unable to open the chunk index manifest `%s`: %s", path, strerror(errno));
+        RETURN_DEFER(0);
+    }
+    if (NULL != fh) {
+        lsm_manifest_t stored = {0};
+        int ok = 1 == fread(&stored, manifest_size(1), 1, fh) && CHUNK_LSM_MANIFEST_MAGIC == stored.magic
+            && 1 <= stored.version && CHUNK_LSM_MANIFEST_VERSION >= stored.version;
+        if (ok && manifest_size(stored.version) > manifest_size(1)) {
+            ok = 1 == fread((char *)&stored + manifest_size(1), manifest_size(stored.version) - manifest_size(1), 1, fh);
+        }
+        if (ok) {
+            arrsetlen(seqs, stored.nruns);
+            ok = stored.nruns == fread(seqs, sizeof(uint64_t), stored.nruns, fh);
+        }
+        if (ok) {
+            fz_hex_digest_t checksum = 0;
+            if (1 == stored.version) xxhash_hexdigest((char *)seqs, stored.nruns * sizeof(uint64_t), &checksum);
+            else checksum = manifest_checksum(&stored, seqs);
+            ok = checksum == stored.checksum;
+        }
+        fclose(fh);
+        if (!ok) {
+            fz_log(FZ_ERROR, "Chunk index manifest `%s` is damaged, the index is not opened", path);
+            RETURN_DEFER(0);
+        }
+        manifest = stored;
+    }
+    /* Older indexes kept the chunks epoch in the database, it carries on from there */
+    if (3 > manifest.version) {
+        if (!fz_query_meta_value(ctx, FZ_META_CHUNKS_EPOCH, &manifest.chunks_epoch)) RETURN_DEFER(0);
+    }
+    lsm->chunks_epoch = manifest.chunks_epoch;
+    lsm->next_seq = manifest.next_seq;
+    lsm->next_file_id = manifest.next_file_id;
+    lsm->files_gen = manifest.files_gen;
+    lsm->zero_gen = manifest.zero_gen;
+    lsm->zero_head = manifest.zero_head;
+
+    for (size_t i = 0; i < arrlenu(seqs); i++){
+        fz_lsm_run_t run = {0};
+        if (map_run(ctx, seqs[i], &run)) arrput(lsm->runs, run);
+        else fz_log(FZ_WARNING, "Chunk index run %lu is damaged, its locations are dropped", seqs[i]);
+    }
+    if (!lsm_path(ctx, path, sizeof(path), "files-%08llx.log", lsm->files_gen)) RETURN_DEFER(0);
+    if (0 < manifest.files_len && !read_prefix(path, manifest.files_len, &data)) {
+        fz_log(FZ_WARNING, "Chunk index file log is short, the files it lost are no longer offered");
+    } else if (NULL != data) apply_file_records(lsm, data, manifest.files_len);
+    lsm->files_len = manifest.files_len;
+    if (NULL != data) {free(data); data = NULL;}
+
+    if (!lsm_path(ctx, path, sizeof(path), "zero-%08llx.log", lsm->zero_gen)) RETURN_DEFER(0);
+    size_t zero_size = (manifest.zero_len - manifest.zero_head) * sizeof(fz_lsm_zero_t);
+    if (manifest.zero_head < manifest.zero_len && read_prefix(path, manifest.zero_len * sizeof(fz_lsm_zero_t), &data)) {
+        arrsetlen(lsm->zero, manifest.zero_len - manifest.zero_head);
+        memcpy(lsm->zero, data + manifest.zero_head * sizeof(fz_lsm_zero_t), zero_size);
+        lsm->zero_len = manifest.zero_len;
+    } else lsm->zero_len = lsm->zero_head;
+    lsm->paths_dirty = 1;
+
+    /* Runs, logs and temporaries of commits that never reached the manifest */
+    if (!lsm_path(ctx, path, sizeof(path), "", 0)) RETURN_DEFER(0);
+    dir = opendir(path);
+    if (NULL == dir) RETURN_DEFER(0);
+    struct dirent *entry = NULL;
+    while (NULL != (entry = readdir(dir))){
+        unsigned long long number = 0;
+        char name[RESERVED];
+        int keep = 1;
+        if (1 == sscanf(entry->d_name, "run-%llx.idx", &number)) {
+            /* A named run that failed to map is kept, only the manifest decides what is garbage */
+            keep = 0;
+            for (size_t i = 0; i < arrlenu(seqs); i++) keep |= seqs[i] == number;
+        }
+        else if (1 == sscanf(entry->d_name, "files-%llx.log", &number)) keep = number == lsm->files_gen;
+        else if (1 == sscanf(entry->d_name, "zero-%llx.log", &number)) keep = number == lsm->zero_gen;
+        if (NULL != strstr(entry->d_name, ".tmp")) keep = 0;
+        if (keep || !lsm_path(ctx, name, sizeof(name), entry->d_name, 0)) continue;
+        remove(name);
+    }
+    defer:
+        if (NULL != dir) closedir(dir);
+        if (NULL != data) free(data);
+        if (NULL != seqs) arrfree(seqs);
+        return result;
+}
+
+
+static void release(fz_chunk_lsm_t *lsm){
+    for (size_t i = 0; i < arrlenu(lsm->runs); i++) munmap(lsm->runs[i].map, lsm->runs[i].map_size);
+    if (NULL != lsm->runs) arrfree(lsm->runs);
+    for (size_t i = 0; i < hmlenu(lsm->files); i++) free(lsm->files[i].value.path);
+    if (NULL != lsm->files) hmfree(lsm->files);
+    if (NULL != lsm->paths) shfree(lsm->paths);
+    if (NULL != lsm->pending) hmfree(lsm->pending);
+    if (NULL != lsm->sorted_paths) arrfree(lsm->sorted_paths);
+    if (NULL != lsm->zero) arrfree(lsm->zero);
+    if (NULL != lsm->collected) hmfree(lsm->collected);
+    if (-1 != lsm->lock_fd) close(lsm->lock_fd);
+    lsm->lock_fd = -1;
+    lsm->ready = 0;
+}
+
+
+static int map_run(fz_ctx_t *ctx, uint64_t seq, fz_lsm_run_t *run){
+    int result = 1;
+    int fd = -1;
+    void *map = MAP_FAILED;
+    struct stat meta = {0};
+    char path[RESERVED];
+
+    if (!lsm_path(ctx, path, sizeof(path), "run-%08llx.idx", seq)) RETURN_DEFER(0);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (-1 == fd || 0 != fstat(fd, &meta) || (size_t)meta.st_size < sizeof(lsm_run_header_t)) RETURN_DEFER(0);
+    map = mmap(NULL, (size_t)meta.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == map) RETURN_DEFER(0);
+
+    const lsm_run_header_t *header = (const lsm_run_header_t *)map;
+    size_t payload_size = (size_t)header->count * (sizeof(uint64_t) + sizeof(fz_lsm_loc_t)) + (size_t)header->nfiles * sizeof(uint64_t);
+    if (CHUNK_LSM_RUN_MAGIC != header->magic
+        || CHUNK_LSM_VERSION != header->version
+        || sizeof(fz_lsm_loc_t) != header->value_size
+        || sizeof(lsm_run_header_t) + payload_size != (size_t)meta.st_size) RETURN_DEFER(0);
+    const char *payload = (const char *)map + sizeof(lsm_run_header_t);
+    fz_hex_digest_t checksum = 0;
+    xxhash_hexdigest((char *)payload, payload_size, &checksum);
+    if (checksum != header->checksum) RETURN_DEFER(0);
+
+    *run = (fz_lsm_run_t){
+        .seq = seq,
+        .keys = (const uint64_t *)payload,
+        .locs = (const fz_lsm_loc_t *)(payload + header->count * sizeof(uint64_t)),
+        .file_ids = (const uint64_t *)(payload + header->count * (sizeof(uint64_t) + sizeof(fz_lsm_loc_t))),
+        .count = (size_t)header->count,
+        .nfiles = (size_t)header->nfiles,
+        .min_key = header->min_key,
+        .max_key = header->max_key,
+        .map = map,
+        .map_size = (size_t)meta.st_size,
+    };
+    map = MAP_FAILED;
+    defer:
+        if (MAP_FAILED != map) munmap(map, (size_t)meta.st_size);
+        if (-1 != fd) close(fd);
+        return result;
+}
+
+
+/* Merges the cursors into a new run, rows of files that are not live and not in `adding` are left out and their keys go to `*dropped`
+unless the merge keeps another row for them. Keys and locations are written in two passes over the same rows */
+static int write_run(fz_ctx_t *ctx, lsm_cursor_t *cursors, size_t ncursors, lsm_id_set_t *adding, fz_lsm_run_t *run, fz_lsm_zero_t **dropped){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    FILE *fh = NULL;
+    XXH3_state_t *state = NULL;
+    lsm_id_set_t *file_ids = NULL;
+    uint64_t *sorted_ids = NULL;
+    lsm_run_header_t header = {.magic = CHUNK_LSM_RUN_MAGIC, .version = CHUNK_LSM_VERSION, .value_size = sizeof(fz_lsm_loc_t)};
+    char path[RESERVED];
+    char temp_path[RESERVED];
+    uint64_t seq = lsm->next_seq;
+
+    if (!lsm_path(ctx, path, sizeof(path), "run-%08llx.idx", seq)) RETURN_DEFER(0);
+    int len = snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    if (0 >= len || (size_t)len >= sizeof(temp_path)) RETURN_DEFER(0);
+    state = XXH3_createState();
+    if (NULL == state) RETURN_DEFER(0);
+    XXH3_64bits_reset(state);
+    fh = fopen(temp_path, "wb");
+    if (NULL == fh) {
+        fz_log(FZ_ERROR, "Unable to create chunk index run `%s`: %s", temp_path, strerror(errno));
+        RETURN_DEFER(0);
+    }
+    if (1 != fwrite(&header, sizeof(header), 1, fh)) RETURN_DEFER(0);
+    for (size_t pass = 0; pass < 2; pass++){
+        for (size_t c = 0; c < ncursors; c++) cursors[c].pos = 0;
+        if (!merge_pass(lsm, cursors, ncursors, adding, fh, state, (int)pass, &header, &file_ids, (0 == pass)? dropped : NULL)) RETURN_DEFER(0);
+    }
+    for (size_t i = 0; i < hmlenu(file_ids); i++) arrput(sorted_ids, file_ids[i].key);
+    if (0 < arrlenu(sorted_ids)) {
+        qsort(sorted_ids, arrlenu(sorted_ids), sizeof(uint64_t), compare_ids);
+        if (arrlenu(sorted_ids) != fwrite(sorted_ids, sizeof(uint64_t), arrlenu(sorted_ids), fh)) RETURN_DEFER(0);
+        XXH3_64bits_update(state, sorted_ids, arrlenu(sorted_ids) * sizeof(uint64_t));
+    }
+    header.nfiles = arrlenu(sorted_ids);
+    header.checksum = XXH3_64bits_digest(state);
+    if (0 != fseek(fh, 0, SEEK_SET) || 1 != fwrite(&header, sizeof(header), 1, fh) || 0 != fflush(fh)) RETURN_DEFER(0);
+    if ((FZ_DB_DURABLE & ctx->db_profile) && 0 != fdatasync(fileno(fh))) RETURN_DEFER(0);
+    if (0 != fclose(fh)) {fh = NULL; RETURN_DEFER(0);}
+    fh = NULL;
+    if (0 != rename(temp_path, path)) RETURN_DEFER(0);
+    if (!map_run(ctx, seq, run)) {
+        remove(path);
+        RETURN_DEFER(0);
+    }
+    lsm->next_seq++;
+    defer:
+        if (NULL != fh) fclose(fh);
+        if (!result) {
+            fz_log(FZ_ERROR, "Failed to write chunk index run %lu", seq);
+            remove(temp_path);
+        }
+        if (NULL != state) XXH3_freeState(state);
+        if (NULL != file_ids) hmfree(file_ids);
+        if (NULL != sorted_ids) arrfree(sorted_ids);
+        return result;
+}
+
+
+static int merge_pass(fz_chunk_lsm_t *lsm, lsm_cursor_t *cursors, size_t ncursors, lsm_id_set_t *adding, FILE *fh, XXH3_state_t *state, int locs, lsm_run_header_t *header, lsm_id_set_t **file_ids, fz_lsm_zero_t **dropped){
+    uint64_t group_key = 0;
+    int in_group = 0;
+    int group_live = 0;
+    int64_t now = (int64_t)time(NULL);
+    if (!locs) header->count = 0;
+    while (1){
+        lsm_cursor_t *next = NULL;
+        uint64_t key = 0;
+        const fz_lsm_loc_t *loc = NULL;
+        /* Runs are few, a linear pick of the smallest (key, file, cutpoint) is enough */
+        for (size_t c = 0; c < ncursors; c++){
+            lsm_cursor_t *cursor = &cursors[c];
+            if (cursor->pos >= cursor->count) continue;
+            uint64_t k = *(const uint64_t *)(cursor->keys + cursor->pos * cursor->key_stride);
+            const fz_lsm_loc_t *l = (const fz_lsm_loc_t *)(cursor->locs + cursor->pos * cursor->loc_stride);
+            if (NULL != next && (k > key || (k == key && (l->file_id > loc->file_id || (l->file_id == loc->file_id && l->cutpoint >= loc->cutpoint))))) continue;
+            next = cursor;
+            key = k;
+            loc = l;
+        }
+        /* A key whose rows in the merge are all dead lost its last location here, unless another run still holds one */
+        if (in_group && (NULL == next || key != group_key)) {
+            if (!group_live && NULL != dropped) {
+                fz_lsm_zero_t zero = {.key = group_key, .since = now};
+                arrput(*dropped, zero);
+            }
+            in_group = 0;
+        }
+        if (NULL == next) break;
+        next->pos++;
+        if (!in_group) {
+            group_key = key;
+            group_live = 0;
+            in_group = 1;
+        }
+        if (0 > hmgeti(lsm->files, loc->file_id) && (NULL == adding || 0 > hmgeti(adding, loc->file_id))) continue;
+        group_live = 1;
+        if (locs) {
+            if (1 != fwrite(loc, sizeof(*loc), 1, fh)) return 0;
+            XXH3_64bits_update(state, loc, sizeof(*loc));
+            continue;
+        }
+        if (1 != fwrite(&key, sizeof(key), 1, fh)) return 0;
+        XXH3_64bits_update(state, &key, sizeof(key));
+        if (0 == header->count) header->min_key = key;
+        header->max_key = key;
+        header->count++;
+        hmput(*file_ids, loc->file_id, 1);
+    }
+    return 1;
+}
+
+
+/* Merges the runs at `indices` into one that takes the place of the first, dropped files without rows left anywhere are purged */
+static int compact(fz_ctx_t *ctx, size_t *indices, size_t nruns){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    lsm_cursor_t *cursors = NULL;
+    fz_lsm_zero_t *dropped = NULL;
+    fz_lsm_run_t *runs = NULL;
+    fz_lsm_run_t *merged_runs = NULL;
+    char *file_records = NULL;
+    fz_lsm_run_t run = {0};
+    int written = 0;
+
+    for (size_t i = 0; i < nruns; i++){
+        fz_lsm_run_t *source = &lsm->runs[indices[i]];
+        lsm_cursor_t cursor = {
+            .keys = (const char *)source->keys, .key_stride = sizeof(uint64_t),
+            .locs = (const char *)source->locs, .loc_stride = sizeof(fz_lsm_loc_t),
+            .count = source->count,
+        };
+        arrput(cursors, cursor);
+        arrput(merged_runs, *source);
+    }
+    if (0 < nruns) {
+        if (!write_run(ctx, cursors, nruns, NULL, &run, &dropped)) RETURN_DEFER(0);
+        written = 1;
+    }
+    for (size_t r = 0; r < arrlenu(lsm->runs); r++){
+        int merged = 0;
+        for (size_t i = 0; i < nruns; i++) merged |= indices[i] == r;
+        if (!merged) arrput(runs, lsm->runs[r]);
+        else if (r == indices[0] && 0 < run.count) arrput(runs, run);
+    }
+    for (size_t p = 0; p < hmlenu(lsm->pending); p++){
+        int held = 0;
+        for (size_t r = 0; r < arrlenu(runs) && !held; r++){
+            held = NULL != bsearch(&lsm->pending[p].key, runs[r].file_ids, runs[r].nfiles, sizeof(uint64_t), compare_ids);
+        }
+        if (!held) put_file_record(&file_records, LSM_FILE_PURGE, lsm->pending[p].key, 0, NULL);
+    }
+    if (!commit(ctx, runs, file_records, dropped, lsm->chunks_epoch)) RETURN_DEFER(0);
+    /* The merged runs are no longer named by the manifest */
+    for (size_t i = 0; i < arrlenu(merged_runs); i++){
+        char path[RESERVED];
+        munmap(merged_runs[i].map, merged_runs[i].map_size);
+        if (lsm_path(ctx, path, sizeof(path), "run-%08llx.idx", merged_runs[i].seq)) remove(path);
+    }
+    if (written && 0 == run.count) {
+        char path[RESERVED];
+        munmap(run.map, run.map_size);
+        if (lsm_path(ctx, path, sizeof(path), "run-%08llx.idx", run.seq)) remove(path);
+    }
+    if (0 < nruns) fz_log(FZ_INFO, "Merged %lu chunk index run(s) into %lu row(s), %lu key(s) lost their last location", nruns, run.count, arrlenu(dropped));
+    defer:
+        if (!result && written) {
+            char path[RESERVED];
+            munmap(run.map, run.map_size);
+            if (lsm_path(ctx, path, sizeof(path), "run-%08llx.idx", run.seq)) remove(path);
+        }
+        if (NULL != cursors) arrfree(cursors);
+        if (NULL != dropped) arrfree(dropped);
+        if (NULL != runs) arrfree(runs);
+        if (NULL != merged_runs) arrfree(merged_runs);
+        if (NULL != file_records) arrfree(file_records);
+        return result;
+}
+
+
+/* Appends the records to the logs and replaces the manifest with one naming `runs`, then applies the change in memory.
+Nothing in memory changes if it fails, bytes appended past the old lengths are overwritten by the next commit */
+static int commit(fz_ctx_t *ctx, fz_lsm_run_t *runs, char *file_records, fz_lsm_zero_t *zero_records, uint64_t chunks_epoch){
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    char path[RESERVED];
+    size_t files_size = arrlenu(file_records);
+    size_t zero_count = arrlenu(zero_records);
+
+    if (0 < files_size) {
+        if (!lsm_path(ctx, path, sizeof(path), "files-%08llx.log", lsm->files_gen)) return 0;
+        if (!write_at(ctx, path, lsm->files_len, file_records, files_size)) return 0;
+    }
+    if (0 < zero_count) {
+        if (!lsm_path(ctx, path, sizeof(path), "zero-%08llx.log", lsm->zero_gen)) return 0;
+        if (!write_at(ctx, path, lsm->zero_len * sizeof(fz_lsm_zero_t), zero_records, zero_count * sizeof(fz_lsm_zero_t))) return 0;
+    }
+    lsm_manifest_t manifest = {
+        .next_seq = lsm->next_seq, .next_file_id = lsm->next_file_id,
+        .files_gen = lsm->files_gen, .files_len = lsm->files_len + files_size,
+        .zero_gen = lsm->zero_gen, .zero_head = lsm->zero_head, .zero_len = lsm->zero_len + zero_count,
+        .chunks_epoch = chunks_epoch,
+    };
+    if (!save_manifest(ctx, &manifest, runs)) return 0;
+
+    if (runs != lsm->runs) {
+        arrfree(lsm->runs);
+        for (size_t i = 0; i < arrlenu(runs); i++) arrput(lsm->runs, runs[i]);
+    }
+    if (0 < files_size) apply_file_records(lsm, file_records, files_size);
+    lsm->files_len += files_size;
+    for (size_t i = 0; i < zero_count; i++) arrput(lsm->zero, zero_records[i]);
+    lsm->zero_len += zero_count;
+    lsm->chunks_epoch = chunks_epoch;
+    return 1;
+}
+
+
+/* Starts new logs holding only what is still needed once the dead part of the old ones dominates */
+static int rewrite_logs(fz_ctx_t *ctx){
+    int result = 1;
+    fz_chunk_lsm_t *lsm = &ctx->chunk_lsm;
+    char *file_records = NULL;
+    char path[RESERVED];
+    size_t live_size = 0;
+    int files = 0;
+    int zero = 0;
+
+    for (size_t i = 0; i < hmlenu(lsm->files); i++) live_size += sizeof(lsm_file_record_t) + strlen(lsm->files[i].value.path);
+    files = lsm->files_len > CHUNK_LSM_LOG_SLACK && lsm->files_len > 2 * live_size;
+    zero = lsm->zero_head * sizeof(fz_lsm_zero_t) > CHUNK_LSM_LOG_SLACK && lsm->zero_head > arrlenu(lsm->zero);
+    if (!files && !zero) return 1;
+
+    lsm_manifest_t manifest = {
+        .next_seq = lsm->next_seq, .next_file_id = lsm->next_file_id,
+        .files_gen = lsm->files_gen, .files_len = lsm->files_len,
+        .zero_gen = lsm->zero_gen, .zero_head = lsm->zero_head, .zero_len = lsm->zero_len,
+        .chunks_epoch = lsm->chunks_epoch,
+    };
+    if (files) {
+        for (size_t i = 0; i < hmlenu(lsm->files); i++){
+            put_file_record(&file_records, LSM_FILE_ADD, lsm->files[i].key, lsm->files[i].value.nrows, lsm->files[i].value.path);
+        }
+        for (size_t i = 0; i < hmlenu(lsm->pending); i++) put_file_record(&file_records, LSM_FILE_DROP, lsm->pending[i].key, 0, NULL);
+        manifest.files_gen++;
+        manifest.files_len = arrlenu(file_records);
+        if (!lsm_path(ctx, path, sizeof(path), "files-%08llx.log", manifest.files_gen)) RETURN_DEFER(0);
+        remove(path);
+        if (0 < manifest.files_len && !write_at(ctx, path, 0, file_records, manifest.files_len)) RETURN_DEFER(0);
+    }
+    if (zero) {
+        manifest.zero_gen++;
+        manifest.zero_head = 0;
+        manifest.zero_len = arrlenu(lsm->zero);
+        if (!lsm_path(ctx, path, sizeof(path), "zero-%08llx.log", manifest.zero_gen)) RETURN_DEFER(0);
+        remove(path);
+        if (0 < manifest.zero_len && !write_at(ctx, path, 0, lsm->zero, manifest.zero_len * sizeof(fz_lsm_zero_t))) RETURN_DEFER(0);
+    }
+    if (!save_manifest(ctx, &manifest, lsm->runs)) RETURN_DEFER(0);
+    if (files && lsm_path(ctx, path, sizeof(path), "files-%08llx.log", lsm->files_gen)) remove(path);
+    if (zero && lsm_path(ctx, path, sizeof(path), "zero-%08llx.log", lsm->zero_gen)) remove(path);
+    lsm->files_gen = manifest.files_gen;
+    lsm->files_len = manifest.files_len;
+    lsm->zero_gen = manifest.zero_gen;
+    lsm->zero_head = manifest.zero_head;
+    lsm->zero_len = manifest.zero_len;
+    defer:
+        if (NULL != file_records) arrfree(file_records);
+        return result;
+}
+
+
+static int save_manifest(fz_ctx_t *ctx, lsm_manifest_t *manifest, fz_lsm_run_t *runs){
+    int result = 1;
+    FILE *fh = NULL;
+    uint64_t *seqs = NULL;
+    char path[RESERVED];
+    char temp_path[RESERVED];
+
+    if (!lsm_path(ctx, path, sizeof(path), "MANIFEST", 0)) RETURN_DEFER(0);
+    int len = snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    if (0 >= len || (size_t)len >= sizeof(temp_path)) RETURN_DEFER(0);
+    for (size_t i = 0; i < arrlenu(runs); i++) arrput(seqs, runs[i].seq);
+    manifest->magic = CHUNK_LSM_MANIFEST_MAGIC;
+    manifest->version = CHUNK_LSM_MANIFEST_VERSION;
+    manifest->nruns = (uint32_t)arrlenu(seqs);
+    manifest->checksum = manifest_checksum(manifest, seqs);
+
+    fh = fopen(temp_path, "wb");
+    if (NULL == fh) RETURN_DEFER(0);
+    if (1 != fwrite(manifest, manifest_size(manifest->version), 1, fh) || arrlenu(seqs) != fwrite(seqs, sizeof(uint64_t), arrlenu(seqs), fh)) RETURN_DEFER(0);
+    if (0 != fflush(fh)) RETURN_DEFER(0);
+    /* Whatever the profile, the rename must never expose a manifest whose bytes are not on disk yet */
+    if (0 != fdatasync(fileno(fh))) RETURN_DEFER(0);
+    if (0 != fclose(fh)) {fh = NULL; RETURN_DEFER(0);}
+    fh = NULL;
+    if (0 != rename(temp_path, path)) RETURN_DEFER(0);
+    defer:
+        if (NULL != fh) fclose(fh);
+        if (!result) {
+            fz_log(FZ_ERROR, "Failed to write the chunk index manifest");
+            remove(temp_path);
+        }
+        if (NULL != seqs) arrfree(seqs);
+        return result;
+}
+
+
+/* Digest of the manifest record with its checksum field zeroed, followed by its `nruns` run numbers */
+static fz_hex_digest_t manifest_checksum(lsm_manifest_t *manifest, uint64_t *seqs){
+    lsm_manifest_t record = *manifest;
+    record.checksum = 0;
+    XXH3_state_t state;
+    XXH3_64bits_reset(&state);
+    XXH3_64bits_update(&state, &record, manifest_size(record.version));
+    if (0 < manifest->nruns) XXH3_64bits_update(&state, seqs, manifest->nruns * sizeof(uint64_t));
+    return XXH3_64bits_digest(&state);
+}
+
+
+/* Bytes of the record a manifest of `version` holds, fields added later follow the checksum */
+static inline size_t manifest_size(uint32_t version){
+    return 3 > version? offsetof(lsm_manifest_t, chunks_epoch) : sizeof(lsm_manifest_t);
+}
+
+
+/* Replays file records, stopping at the first one that does not parse */
+static void apply_file_records(fz_chunk_lsm_t *lsm, const char *records, size_t size){
+    size_t offset = 0;
+    char path[RESERVED];
+    while (offset + sizeof(lsm_file_record_t) <= size){
+        lsm_file_record_t record;
+        memcpy(&record, records + offset, sizeof(record));
+        offset += sizeof(record);
+        if (LSM_FILE_ADD == record.type) {
+            if (record.path_len >= sizeof(path) || offset + record.path_len > size) break;
+            memcpy(path, records + offset, record.path_len);
+            path[record.path_len] = '\0';
+            offset += record.path_len;
+            char *copy = strdup(path);
+            if (NULL == copy) break;
+            fz_lsm_file_t file = {.path = copy, .nrows = record.nrows};
+            hmput(lsm->files, record.file_id, file);
+            shput(lsm->paths, path, record.file_id);
+        } else if (LSM_FILE_DROP == record.type) {
+            struct lsm_file_map_s *file = hmgetp_null(lsm->files, record.file_id);
+            if (NULL != file) {
+                (void)shdel(lsm->paths, file->value.path);
+                free(file->value.path);
+                (void)hmdel(lsm->files, record.file_id);
+            }
+            hmput(lsm->pending, record.file_id, 1);
+        } else if (LSM_FILE_PURGE == record.type) {
+            (void)hmdel(lsm->pending, record.file_id);
+        } else {
+            fz_log(FZ_WARNING, "Chunk index file log is damaged at byte %lu, the files after it are no longer offered", offset - sizeof(record));
+            break;
+        }
+    }
+    lsm->paths_dirty = 1;
+}
+
+
+static void put_file_record(char **records, uint32_t type, uint64_t file_id, uint64_t nrows, const char *path){
+    size_t path_len = (NULL != path)? strlen(path) : 0;
+    lsm_file_record_t record = {.type = type, .path_len = (uint32_t)path_len, .file_id = file_id, .nrows = nrows};
+    size_t offset = arrlenu(*records);
+    arraddnptr(*records, sizeof(record) + path_len);
+    memcpy(*records + offset, &record, sizeof(record));
+    if (0 < path_len) memcpy(*records + offset + sizeof(record), path, path_len);
+}
+
+
+static int is_live(fz_chunk_lsm_t *lsm, uint64_t key){
+    for (size_t r = 0; r < arrlenu(lsm->runs); r++){
+        fz_lsm_run_t *run = &lsm->runs[r];
+        for (size_t i = lower_bound(run, key); i < run->count && key == run->keys[i]; i++){
+            if (0 <= hmgeti(lsm->files, run->locs[i].file_id)) return 1;
+        }
+    }
+    return 0;
+}
+
+
+static size_t lower_bound(const fz_lsm_run_t *run, uint64_t key){
+    if (0 == run->count || key < run->min_key || key > run->max_key) return run->count;
+    size_t lo = 0, hi = run->count;
+    while (lo < hi){
+        size_t mid = lo + (hi - lo) / 2;
+        if (run->keys[mid] < key) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+
+static int write_at(fz_ctx_t *ctx, const char *path, uint64_t offset, const void *data, size_t size){
+    int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (-1 == fd) {
+        fz_log(FZ_ERROR, "Unable to open chunk index log `%s`: %s", path, strerror(errno));
+        return 0;
+    }
+    int ok = (ssize_t)size == pwrite(fd, data, size, (off_t)offset);
+    if (ok && (FZ_DB_DURABLE & ctx->db_profile)) ok = 0 == fdatasync(fd);
+    if (0 != close(fd)) ok = 0;
+    if (!ok) fz_log(FZ_ERROR, "Failed to append to chunk index log `%s`", path);
+    return ok;
+}
+
+
+static int read_prefix(const char *path, uint64_t size, char **data){
+    int result = 1;
+    FILE *fh = fopen(path, "rb");
+    if (NULL == fh) return 0;
+    *data = malloc((size_t)size);
+    if (NULL == *data) RETURN_DEFER(0);
+    if (1 != fread(*data, (size_t)size, 1, fh)) RETURN_DEFER(0);
+    defer:
+        fclose(fh);
+        if (!result && NULL != *data) {free(*data); *data = NULL;}
+        return result;
+}
+
+
+static int compare_rows(const void *a, const void *b){
+    const lsm_row_t *x = (const lsm_row_t *)a;
+    const lsm_row_t *y = (const lsm_row_t *)b;
+    if (x->key != y->key) return (x->key < y->key)? -1 : 1;
+    if (x->loc.file_id != y->loc.file_id) return (x->loc.file_id < y->loc.file_id)? -1 : 1;
+    if (x->loc.cutpoint != y->loc.cutpoint) return (x->loc.cutpoint < y->loc.cutpoint)? -1 : 1;
+    return 0;
+}
+
+
+static int compare_ids(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+
+static int compare_paths(const void *a, const void *b){
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+/* `name` may carry one %llx for `number` */
+static inline int lsm_path(fz_ctx_t *ctx, char *buffer, size_t buffer_size, const char *name, uint64_t number){
+    int len = snprintf(buffer, buffer_size, "%s%s", ctx->metadata_loc, CHUNK_LSM_DIR);
+    if (0 >= len || (size_t)len >= buffer_size) return 0;
+    int tail = snprintf(buffer + len, buffer_size - (size_t)len, name, (unsigned long long)number);
+    return 0 <= tail && (size_t)(len + tail) < buffer_size;
+}
@@ -1,17 +1,38 @@
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 #include "core.h"
 
 
+/* The file digest state is saved with the fingerprint and restored for an append, that needs the state's layout */
+#define XXH_STATIC_LINKING_ONLY
 #include "../hash/xxhash.h"
 
 #define CHUNK_LIST_RESERVED KB(64)
 #define CHUNK_CHECKSUM_SEED 0x000000
 #define FILE_CHECKSUM_SEED 0x123456
 
+/* Chunks of the previous manifest re-read before it is continued, on top of its last full chunk */
+#define APPEND_VERIFY_SAMPLES 8
 
-static inline int fz_chunking_fixed_size(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, FILE *input_fd, size_t file_size, const char* src_file_path);
+/* Layout of the saved digest state: a tag naming the xxHash build that wrote it, then its raw XXH3_state_t.
+A state saved by another build or ABI is not restored, its file is chunked in full */
+#define HASH_STATE_FORMAT 1
+
+typedef struct hash_state_tag_t{
+    uint32_t format;
+    uint32_t xxh_version;
+    uint64_t state_size;
+} hash_state_tag_t;
+
+
+static inline int fz_chunking_fixed_size(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, FILE *input_fd, size_t file_size, const char* src_file_path, fz_file_fingerprint_t *fingerprint, XXH3_state_t *resume_state);
+static int resume_append(fz_ctx_t *ctx, FILE *input_fd, const char *src_file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *previous, XXH3_state_t *state, size_t *nstable);
+static int hash_fixed_chunks(fz_ctx_t *ctx, FILE *input_fd, size_t first_chunk, size_t file_size, fz_chunk_seq_t *seq, XXH3_state_t *state, XXH3_state_t *resume_state);
 static inline int fz_chunking_variable_size(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, FILE *input_fd, size_t file_size, const char* src_file_path);
+static inline fz_file_fingerprint_t fingerprint_of(fz_ctx_t *ctx, struct stat *meta);
+static inline int same_fingerprint(fz_file_fingerprint_t *a, fz_file_fingerprint_t *b);
+static inline hash_state_tag_t hash_state_tag(void);
 
 
 extern int fz_chunk_file(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, const char* src_file_path){
@@ -19,6 +40,8 @@ extern int fz_chunk_file(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, const ch
     FILE *fd = NULL; 
     size_t file_size = 0;
     struct stat file_meta;
+    XXH3_state_t *resume_state = NULL;
+    char saved_state[sizeof(hash_state_tag_t) + sizeof(XXH3_state_t)];
 
     fd = fopen(src_file_path, "rb"); 
     if (NULL == fd){
@@ -35,9 +58,22 @@ extern int fz_chunk_file(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, const ch
         fz_log(FZ_ERROR, "Cannot chunk empty file `%s`", src_file_path);
         RETURN_DEFER(0);
     }
+    fz_file_fingerprint_t fingerprint = fingerprint_of(ctx, &file_meta);
+    if (fz_query_fingerprint(ctx, src_file_path, &fingerprint, file_mnfst)) {
+        fz_log(FZ_INFO, "File `%s` is unchanged since it was last chunked, reusing its manifest", src_file_path);
+        /* Roots recorded before cutpoints and sizes were part of the root would fail on every receiver, it is cheap to redo */
+        if (!xxhash_hexdigest_from_file_prime(&file_mnfst->chunk_root, &file_mnfst->chunk_seq)) RETURN_DEFER(0);
+        RETURN_DEFER(1);
+    }
+    time_t started = time(NULL);
     switch (ctx->chunk_strategy) {
         case FZ_FIXED_SIZED_CHUNK:
-            if (!fz_chunking_fixed_size(ctx, file_mnfst, fd, file_size, src_file_path)){
+            resume_state = XXH3_createState();
+            if (NULL == resume_state) {
+                fz_log(FZ_ERROR, "Out of memory error in %s", __func__);
+                RETURN_DEFER(0);
+            }
+            if (!fz_chunking_fixed_size(ctx, file_mnfst, fd, file_size, src_file_path, &fingerprint, resume_state)){
                 fz_log(FZ_ERROR, "Fixed sized chunking failed"); RETURN_DEFER(0);
             }
             break;
@@ -54,14 +90,52 @@ extern int fz_chunk_file(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, const ch
         fz_log(FZ_ERROR, "Fatal error, file manifest chunk sequence chunk length is 0");
         RETURN_DEFER(0);
     }
+    /* A file changed while it was read does not get a fingerprint. Neither does one whose last change falls in the second
+    chunking started, on filesystems with coarse timestamps a later write in that second would leave the fingerprint as is */
+    struct stat after_meta;
+    if (0 == stat(src_file_path, &after_meta) && file_meta.st_ctim.tv_sec < started){
+        fz_file_fingerprint_t after = fingerprint_of(ctx, &after_meta);
+        hash_state_tag_t tag = hash_state_tag();
+        if (NULL != resume_state) {
+            memcpy(saved_state, &tag, sizeof(tag));
+            memcpy(saved_state + sizeof(tag), resume_state, sizeof(*resume_state));
+        }
+        size_t resume_size = (NULL != resume_state)? sizeof(saved_state) : 0;
+        if (same_fingerprint(&fingerprint, &after) && !fz_commit_fingerprint(ctx, src_file_path, &fingerprint, file_mnfst, (NULL != resume_state)? saved_state : NULL, resume_size)) {
+            fz_log(FZ_WARNING, "Could not record the fingerprint of `%s`, it is chunked again next time", src_file_path);
+        }
+    }
 
     defer:
         if (NULL != fd) fclose(fd);
+        if (NULL != resume_state) XXH3_freeState(resume_state);
         if (!result) fz_file_manifest_destroy(file_mnfst);
         return result;
 }
 
 
+static inline fz_file_fingerprint_t fingerprint_of(fz_ctx_t *ctx, struct stat *meta){
+    return (fz_file_fingerprint_t){
+        .file_size = (size_t)meta->st_size,
+        .mtime_ns = (int64_t)meta->st_mtim.tv_sec * 1000000000LL + meta->st_mtim.tv_nsec,
+        .ctime_ns = (int64_t)meta->st_ctim.tv_sec * 1000000000LL + meta->st_ctim.tv_nsec,
+        .inode = (uint64_t)meta->st_ino,
+        .chunk_strategy = ctx->chunk_strategy,
+        .chunk_size = ctx->ctx_attrs.chunk_size,
+    };
+}
+
+
+static inline int same_fingerprint(fz_file_fingerprint_t *a, fz_file_fingerprint_t *b){
+    return a->file_size == b->file_size && a->mtime_ns == b->mtime_ns && a->ctime_ns == b->ctime_ns && a->inode == b->inode;
+}
+
+
+static inline hash_state_tag_t hash_state_tag(void){
+    return (hash_state_tag_t){.format = HASH_STATE_FORMAT, .xxh_version = XXH_VERSION_NUMBER, .state_size = sizeof(XXH3_state_t)};
+}
+
+
 extern inline int fz_file_manifest_to_chunk_list(fz_file_manifest_t *mnfst, fz_chunk_t *chunk_list){
     for (size_t i = 0; i < mnfst->chunk_seq.chunk_seq_len; i++){
         chunk_list[i].chunk_checksum = mnfst->chunk_seq.chunk_checksum[i];
@@ -73,22 +147,22 @@ extern inline int fz_file_manifest_to_chunk_list(fz_file_manifest_t *mnfst, fz_c
 }
 
 
-static inline int fz_chunking_fixed_size(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, FILE *input_fd, size_t file_size, const char* src_file_path){
-    /* Chunking section here needs to be isolated */
+/* Chunks are `chunk_size` apart, the last one is hashed zero padded to the full size. The file digest is taken in the same pass,
+`resume_state` receives it as it stood at the end of the last full chunk */
+static inline int fz_chunking_fixed_size(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, FILE *input_fd, size_t file_size, const char* src_file_path, fz_file_fingerprint_t *fingerprint, XXH3_state_t *resume_state){
     int result = 1;
     size_t chunk_size = ctx->ctx_attrs.chunk_size;
-    size_t chunk_seq_len = 0;
-    fz_hex_digest_t digest = 0;
-    char *block = NULL;
+    size_t nstable = 0;
     char *file_name = NULL;
-    
-    block = (char *)calloc(ctx->ctx_attrs.in_mem_buffer, sizeof(char));
-    if (NULL == block) {
+    fz_file_manifest_t previous = {0};
+    XXH3_state_t *state = XXH3_createState();
+    if (NULL == state) {
         fz_log(FZ_ERROR, "Out of memory error in %s", __func__);
         RETURN_DEFER(0);
     }
-    size_t allocation_size = (size_t)((file_size / chunk_size) + chunk_size);
+    XXH3_64bits_reset(state);
 
+    size_t allocation_size = (file_size + chunk_size - 1) / chunk_size;
     file_mnfst->chunk_seq.chunk_checksum = (fz_hex_digest_t *)calloc(allocation_size, sizeof(fz_hex_digest_t));
     file_mnfst->chunk_seq.cutpoint = (size_t *)calloc(allocation_size, sizeof(size_t));
     file_mnfst->chunk_seq.chunk_size = (size_t *)calloc(allocation_size, sizeof(size_t));
@@ -97,26 +171,20 @@ static inline int fz_chunking_fixed_size(fz_ctx_t *ctx, fz_file_manifest_t *file
         fz_log(FZ_ERROR, "Out of memory error in %s", __func__);
         RETURN_DEFER(0);
     }
-    size_t size_read = 0;
-    while((size_read = fread(block, 1, ctx->ctx_attrs.in_mem_buffer, input_fd)) > 0){
-        for (size_t i = 0; i < size_read; i += chunk_size){
-            size_t min = chunk_size;
-            xxhash_hexdigest(block + i, min, &digest);
-            file_mnfst->chunk_seq.chunk_checksum[chunk_seq_len] = digest;
-            file_mnfst->chunk_seq.cutpoint[chunk_seq_len] = chunk_size * chunk_seq_len;
-            file_mnfst->chunk_seq.chunk_size[chunk_seq_len] = chunk_size;
-            chunk_seq_len++;
-        }
-        memset(block, 0, ctx->ctx_attrs.in_mem_buffer);
+    if ((FZ_RECHUNK_APPEND & ctx->rechunk_mode) && resume_append(ctx, input_fd, src_file_path, fingerprint, &previous, state, &nstable)) {
+        memcpy(file_mnfst->chunk_seq.chunk_checksum, previous.chunk_seq.chunk_checksum, nstable * sizeof(fz_hex_digest_t));
+        memcpy(file_mnfst->chunk_seq.cutpoint, previous.chunk_seq.cutpoint, nstable * sizeof(size_t));
+        memcpy(file_mnfst->chunk_seq.chunk_size, previous.chunk_seq.chunk_size, nstable * sizeof(size_t));
+        fz_log(FZ_INFO, "File `%s` grew since it was last chunked, continuing after its first %lu chunk(s)", src_file_path, nstable);
     }
-    if (!xxhash_hexdigest_from_file(input_fd, &digest)) {
-        fz_log(FZ_ERROR, "Something went wrong while trying to generate file hash");
+    if (!hash_fixed_chunks(ctx, input_fd, nstable, file_size, &file_mnfst->chunk_seq, state, resume_state)) RETURN_DEFER(0);
+
+    file_mnfst->file_checksum = XXH3_64bits_digest(state);
+    if (!xxhash_hexdigest_from_file_prime(&file_mnfst->chunk_root, &file_mnfst->chunk_seq)) {
+        fz_log(FZ_ERROR, "Something went wrong while trying to generate the chunk root digest");
         RETURN_DEFER(0);
     }
 
-    file_mnfst->file_checksum = digest;
-    file_mnfst->chunk_seq.chunk_seq_len = chunk_seq_len;
-
     file_name = calloc(strlen(src_file_path) + 1, sizeof(char));
     if (NULL == file_name) {
         fz_log(FZ_ERROR, "Out of memory error in %s", __func__);
@@ -128,12 +196,116 @@ static inline int fz_chunking_fixed_size(fz_ctx_t *ctx, fz_file_manifest_t *file
     file_mnfst->file_size = file_size;
 
     defer:
-        if (NULL != block) free(block);
+        if (NULL != state) XXH3_freeState(state);
+        fz_file_manifest_destroy(&previous);
         if (!result) fz_file_manifest_destroy(file_mnfst);
         return result;
 }
 
 
+/* Takes the last manifest of a file that grew in place as its prefix: the full chunks it had are re-hashed at the last one and at
+evenly spaced ones before it, and `state` is set to the file digest saved after them. Anything else, including a file edited in
+the middle at the same size, is chunked in full */
+static int resume_append(fz_ctx_t *ctx, FILE *input_fd, const char *src_file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *previous, XXH3_state_t *state, size_t *nstable){
+    int result = 1;
+    size_t chunk_size = ctx->ctx_attrs.chunk_size;
+    fz_file_fingerprint_t last = {0};
+    char *hash_state = NULL;
+    size_t hash_state_size = 0;
+    char *block = NULL;
+
+    if (!fz_query_last_fingerprint(ctx, src_file_path, &last, previous, &hash_state, &hash_state_size)) return 0;
+    size_t nchunk = last.file_size / chunk_size;
+    if (last.inode != fingerprint->inode || last.chunk_strategy != fingerprint->chunk_strategy || last.chunk_size != chunk_size) RETURN_DEFER(0);
+    if (last.file_size >= fingerprint->file_size || 0 == nchunk || nchunk > previous->chunk_seq.chunk_seq_len) RETURN_DEFER(0);
+    hash_state_tag_t tag = hash_state_tag();
+    if (sizeof(tag) + sizeof(XXH3_state_t) != hash_state_size || 0 != memcmp(hash_state, &tag, sizeof(tag))) {
+        fz_log(FZ_INFO, "Saved digest state of `%s` was written by another build, chunking it in full", src_file_path);
+        RETURN_DEFER(0);
+    }
+
+    block = malloc(chunk_size);
+    if (NULL == block) RETURN_DEFER(0);
+    size_t checked = SIZE_MAX;
+    for (size_t i = 0; i <= APPEND_VERIFY_SAMPLES; i++){
+        size_t index = (nchunk - 1) * (APPEND_VERIFY_SAMPLES - i) / APPEND_VERIFY_SAMPLES;
+        if (index == checked) continue;
+        checked = index;
+        fz_hex_digest_t digest = 0;
+        if (0 != fseek(input_fd, (long)(index * chunk_size), SEEK_SET) || chunk_size != fread(block, 1, chunk_size, input_fd)) RETURN_DEFER(0);
+        xxhash_hexdigest(block, chunk_size, &digest);
+        if (digest != previous->chunk_seq.chunk_checksum[index]) {
+            fz_log(FZ_INFO, "File `%s` changed before its old end, chunking it in full", src_file_path);
+            RETURN_DEFER(0);
+        }
+    }
+    /* The saved state points at the secret of the process that wrote it, the reset one points at ours */
+    XXH3_64bits_reset(state);
+    const unsigned char *secret = state->extSecret;
+    memcpy(state, hash_state + sizeof(tag), sizeof(XXH3_state_t));
+    state->extSecret = secret;
+    *nstable = nchunk;
+    defer:
+        if (NULL != hash_state) free(hash_state);
+        if (NULL != block) free(block);
+        if (!result) {
+            fz_file_manifest_destroy(previous);
+            XXH3_64bits_reset(state);
+        }
+        return result;
+}
+
+
+/* Hashes the chunks from `first_chunk` to the end of the file into `seq`, feeding the same bytes to the file digest `state` */
+static int hash_fixed_chunks(fz_ctx_t *ctx, FILE *input_fd, size_t first_chunk, size_t file_size, fz_chunk_seq_t *seq, XXH3_state_t *state, XXH3_state_t *resume_state){
+    int result = 1;
+    size_t chunk_size = ctx->ctx_attrs.chunk_size;
+    size_t nfull = file_size / chunk_size;
+    size_t index = first_chunk;
+    /* Whole chunks per read, so that the last one can be padded in place */
+    size_t block_size = (ctx->ctx_attrs.in_mem_buffer / chunk_size) * chunk_size;
+    if (0 == block_size) block_size = chunk_size;
+    fz_hex_digest_t digest = 0;
+    char *block = NULL;
+
+    block = (char *)malloc(block_size);
+    if (NULL == block) {
+        fz_log(FZ_ERROR, "Out of memory error in %s", __func__);
+        RETURN_DEFER(0);
+    }
+    if (0 != fseek(input_fd, (long)(first_chunk * chunk_size), SEEK_SET)) {
+        fz_log(FZ_ERROR, "Unable to seek to chunk %lu: %s", first_chunk, strerror(errno));
+        RETURN_DEFER(0);
+    }
+    /* Bytes appended while the file is read are left for the next chunking, the fingerprint is not recorded then */
+    size_t remaining = file_size - first_chunk * chunk_size;
+    size_t size_read = 0;
+    while(0 < remaining && (size_read = fread(block, 1, (remaining < block_size)? remaining : block_size, input_fd)) > 0){
+        remaining -= size_read;
+        for (size_t i = 0; i < size_read; i += chunk_size){
+            size_t len = (size_read - i < chunk_size)? size_read - i : chunk_size;
+            if (index == nfull) XXH3_copyState(resume_state, state);
+            XXH3_64bits_update(state, block + i, len);
+            if (len < chunk_size) memset(block + i + len, 0, chunk_size - len);
+            xxhash_hexdigest(block + i, chunk_size, &digest);
+            seq->chunk_checksum[index] = digest;
+            seq->cutpoint[index] = chunk_size * index;
+            seq->chunk_size[index] = chunk_size;
+            index++;
+        }
+    }
+    if (ferror(input_fd)) {
+        fz_log(FZ_ERROR, "Failed to read the file while chunking it");
+        RETURN_DEFER(0);
+    }
+    if (index == nfull) XXH3_copyState(resume_state, state);
+    seq->chunk_seq_len = index;
+    defer:
+        if (NULL != block) free(block);
+        return result;
+}
+
+
 extern inline void xxhash_hexdigest(char *buffer, size_t stream_len, fz_hex_digest_t *digest){
     XXH64_hash_t hex = XXH3_64bits(buffer, stream_len);
     *digest = hex;
@@ -162,22 +334,33 @@ extern inline int xxhash_hexdigest_from_file(FILE *fd, fz_hex_digest_t *digest){
 }
 
 
-extern inline int xxhash_hexdigest_from_file_prime(fz_hex_digest_t *digest, fz_hex_digest_t *digest_list, size_t digest_len){
+/* Root digest of a file's chunk sequence: each chunk's checksum, cutpoint and size are hashed in order as little endian 64 bit words,
+so a receiver that verified every chunk it placed, and where it placed it, can verify the whole file without reading it back */
+extern inline int xxhash_hexdigest_from_file_prime(fz_hex_digest_t *digest, fz_chunk_seq_t *chunk_seq){
     int result = 1;
-    char *buffer = calloc((digest_len * 16) + 1, sizeof(char));
-    if (NULL == buffer) {
+    XXH3_state_t* state = XXH3_createState();
+    if (NULL == state) {
         fz_log(FZ_ERROR, "Out of memory error in %s", __func__);
         RETURN_DEFER(0);
     }
-    char temp[17] = {0};
-    for (size_t i = 0; i < digest_len; i++){
-        snprintf(temp, HEX_DIGIT_SIZE, "%016llx", digest_list[i]);
-        strncat(buffer, temp, 16);
+    XXH3_64bits_reset(state);
+    unsigned char buffer[KB(4)];
+    size_t count = 0;
+    for (size_t i = 0; i < chunk_seq->chunk_seq_len; i++){
+        uint64_t words[3] = {chunk_seq->chunk_checksum[i], chunk_seq->cutpoint[i], chunk_seq->chunk_size[i]};
+        if (sizeof(buffer) - count < sizeof(words)) {
+            XXH3_64bits_update(state, buffer, count);
+            count = 0;
+        }
+        for (size_t w = 0; w < 3; w++){
+            for (size_t j = 0; j < sizeof(uint64_t); j++){
+                buffer[count++] = (unsigned char)((words[w] >> (8 * j)) & 0xff);
+            }
+        }
     }
-    printf("File hash stream: buffer");
-    XXH64_hash_t hex = XXH3_64bits(buffer, strlen(buffer));
-    *digest = hex;
+    if (0 < count) XXH3_64bits_update(state, buffer, count);
+    *digest = XXH3_64bits_digest(state);
     defer:
-        if (NULL != buffer) free(buffer);
+        if (NULL != state) XXH3_freeState(state);
         return result;
-}
\ No newline at end of file
+}
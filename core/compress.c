@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "core.h"
+
+#define FZLZ_IMPLEMENTATION
+#include "fzlz.h"
+
+/* The probe looks at runs of PROBE_RUN bytes every PROBE_STRIDE bytes, 4K of a 64K chunk. Larger chunks are sampled sparser so
+the sample never exceeds PROBE_MAX_SAMPLE bytes, which keeps the 4th power of any count within 64 bits */
+#define PROBE_RUN 16
+#define PROBE_STRIDE 256
+#define PROBE_MAX_SAMPLE KB(4)
+
+/* Samples whose byte entropy exceeds this percentage of 8 bits are treated as already compressed (media, archives) */
+#define PROBE_ENTROPY_LIMIT 90
+
+/* An encoding is only kept if it saves at least 1/2^COMPRESS_MIN_SAVING_SHIFT of the chunk */
+#define COMPRESS_MIN_SAVING_SHIFT 4
+
+
+static inline unsigned ilog2_pow4(uint64_t value);
+
+
+/* Quick order-0 entropy estimate over a sample of the chunk, integer only: the sum of c*log2(n/c) is taken on the 4th powers to keep two bits of fraction */
+extern int fz_chunk_compressible(const char *buffer, size_t size){
+    uint32_t counts[256] = {0};
+    size_t nsample = 0;
+    if (size <= PROBE_STRIDE) {
+        for (size_t i = 0; i < size; i++) counts[(uint8_t)buffer[i]]++;
+        nsample = size;
+    } else {
+        size_t stride = size / (PROBE_MAX_SAMPLE / PROBE_RUN);
+        if (stride < PROBE_STRIDE) stride = PROBE_STRIDE;
+        for (size_t i = 0; i + PROBE_RUN <= size; i += stride){
+            for (size_t j = 0; j < PROBE_RUN; j++) counts[(uint8_t)buffer[i + j]]++;
+            nsample += PROBE_RUN;
+        }
+    }
+    if (0 == nsample) return 0;
+
+    uint64_t sum = 0;
+    unsigned log_n = ilog2_pow4(nsample);
+    for (size_t i = 0; i < 256; i++){
+        if (0 == counts[i]) continue;
+        sum += (uint64_t)counts[i] * (log_n - ilog2_pow4(counts[i]));
+    }
+    /* `sum / nsample` is the entropy in quarter bits, 32 means every byte value is equally likely */
+    return (sum * 100) / (nsample * 32) < PROBE_ENTROPY_LIMIT;
+}
+
+
+/* Encodes `src` into `*buffer`, growing it as needed. Returns 0 when the chunk fails the entropy probe or the encoding would not save enough */
+extern int fz_chunk_compress(const char *src, size_t size, char **buffer, size_t *max_alloc, size_t *compressed_size){
+    if (!fz_chunk_compressible(src, size)) return 0;
+    size_t bound = fzlz_compress_bound(size);
+    if (*max_alloc < bound){
+        char *temp = realloc(*buffer, bound);
+        if (NULL == temp) return 0;
+        *buffer = temp;
+        *max_alloc = bound;
+    }
+    size_t limit = size - (size >> COMPRESS_MIN_SAVING_SHIFT);
+    size_t n = fzlz_compress(src, size, *buffer, limit);
+    if (0 == n) return 0;
+    *compressed_size = n;
+    return 1;
+}
+
+
+/* Decodes exactly `raw_size` bytes into `dst`, a block that decodes to any other length is rejected */
+extern int fz_chunk_decompress(const char *src, size_t compressed_size, char *dst, size_t raw_size){
+    return (long)raw_size == fzlz_decompress(src, compressed_size, dst, raw_size);
+}
+
+
+/* floor(log2(value^4)), `value` is at most PROBE_MAX_SAMPLE */
+static inline unsigned ilog2_pow4(uint64_t value){
+    uint64_t v = value * value;
+    v *= v;
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(v);
+#else
+    unsigned log = 0;
+    while (v >>= 1) log++;
+    return log;
+#endif
+}
@@ -41,6 +41,12 @@ extern int fz_ctx_init(
     if (NULL == target_dir) return 0;
     ctx->target_dir = target_dir;
     ctx->chunk_strategy = chunk_strategy;
+    if (0 == ctx->assembly_mode) ctx->assembly_mode = FZ_ASSEMBLE_DIRECT;
+    if (0 == ctx->compression) ctx->compression = FZ_CODEC_LZ;
+    if (0 == ctx->db_profile) ctx->db_profile = FZ_DB_THROUGHPUT;
+    if (0 == ctx->rechunk_mode) ctx->rechunk_mode = FZ_RECHUNK_FULL;
+    if (0 == ctx->meta_backend) ctx->meta_backend = FZ_META_SQLITE;
+    ctx->meta_ops = (FZ_META_LSM & ctx->meta_backend)? &fz_meta_lsm_ops : &fz_meta_sqlite_ops;
 
     if (NULL != metadata_loc) ctx->metadata_loc = metadata_loc;
     else ctx->metadata_loc = DEFAULT_METADATA_LOC;
@@ -63,6 +69,20 @@ extern int fz_ctx_init(
         fz_log(FZ_ERROR, "Unable to create filezap database");
         RETURN_DEFER(0);
     }
+    /* Sender and receiver may share the database file, wait for the other side's lock instead of failing */
+    sqlite3_busy_timeout(ctx->db, FZ_DB_BUSY_TIMEOUT_MS);
+    if (!fz_db_configure(ctx)) RETURN_DEFER(0);
+    if (!fz_init_tables(ctx)) {
+        fz_log(FZ_ERROR, "Unable to create filezap tables");
+        RETURN_DEFER(0);
+    }
+    fz_chunk_filter_init(ctx);
+    fz_janitor_init(ctx);
+    fz_meta_writer_init(ctx);
+    fz_chunk_lsm_init(ctx);
+    fz_db_pool_init(ctx);
+    fz_chunk_cache_init(&ctx->chunk_cache, ctx->ctx_attrs.chunk_cache_size);
+    if (!fz_blob_state_init(ctx)) RETURN_DEFER(0);
     defer:
         return result;
 }
@@ -70,7 +90,25 @@ extern int fz_ctx_init(
 
 extern void fz_ctx_destroy(fz_ctx_t *ctx){
     fz_ring_buffer_destroy(&(ctx->wq));
-    if (NULL != ctx->db) sqlite3_close(ctx->db);
+    if (NULL != ctx->db) {
+        /* Queued metadata is committed first, it resumes the janitor as it goes */
+        fz_meta_writer_destroy(ctx);
+        fz_janitor_destroy(ctx);
+        fz_watcher_destroy(ctx);
+        /* Snapshots are written next and name the current epochs, they must not outlive a commit lost to a power failure */
+        if (NULL != ctx->blob_state_dirty) fz_blob_state_flush(ctx);
+        if (!fz_db_sync(ctx)) {
+            fz_log(FZ_WARNING, "Could not checkpoint the database, snapshots are rebuilt on the next start");
+            ctx->blob_state_unsaved = 0;
+            ctx->chunk_filter.unsaved = 0;
+        }
+        fz_blob_state_destroy(ctx);
+        fz_chunk_filter_destroy(ctx);
+        fz_chunk_lsm_destroy(ctx);
+        fz_chunk_cache_destroy(&ctx->chunk_cache);
+        fz_db_pool_destroy(ctx);
+        fz_db_close(ctx);
+    }
 }
 
 
@@ -96,6 +134,7 @@ extern void fz_chunk_destroy(fz_chunk_seq_t *chnk){
 extern int fz_file_manifest_init(fz_file_manifest_t *mnfst){
     fz_chunk_init(&mnfst->chunk_seq);
     mnfst->file_checksum = 0;
+    mnfst->chunk_root = 0;
     mnfst->source_id = 0;
     mnfst->file_name = NULL;
     mnfst->file_size = 0;
@@ -107,6 +146,7 @@ extern int fz_file_manifest_init(fz_file_manifest_t *mnfst){
 extern void fz_file_manifest_destroy(fz_file_manifest_t *mnfst){
     fz_chunk_destroy(&mnfst->chunk_seq);
     mnfst->file_checksum = 0;
+    mnfst->chunk_root = 0;
     mnfst->source_id = 0;
     if (NULL != mnfst->file_name) free(mnfst->file_name);
     mnfst->file_name = NULL;
@@ -51,6 +51,18 @@ extern "C" {
 #define XXSMALL_RESERVED 128
 #define MAX_MANIFEST_SIZE MB(64)
 #define HEX_DIGIT_SIZE 17
+#define FZ_CACHE_SHARDS 16
+#define FZ_DB_BUSY_TIMEOUT_MS 5000
+
+/* Keys of `filezap_meta` */
+#define FZ_META_BLOB_STATE_EPOCH "blob_state_epoch"
+#define FZ_META_CHUNKS_EPOCH "chunks_epoch"
+
+/* Keys of `filezap_meta_text` */
+#define FZ_META_JANITOR_CURSOR "janitor_file_cursor"
+
+/* `PRAGMA user_version` of the current table layout */
+#define FZ_SCHEMA_VERSION 1
 
 #define RETURN_DEFER(val) do{result = val; goto defer;} while(0)
 #define SERIALIZE_CHUNK(buffer, chunk_checksum, cutpoint, chunk_size)\
@@ -122,6 +134,9 @@ typedef struct fz_chunk_seq_t{
 typedef struct fz_file_manifest_t {
     char *file_name;
     fz_hex_digest_t file_checksum;
+
+    /* Digest over the chunk checksum sequence, lets the receiver verify a file from its already verified chunks */
+    fz_hex_digest_t chunk_root;
     fz_chunk_seq_t chunk_seq;
     size_t file_size;
 
@@ -138,9 +153,120 @@ typedef struct fz_ctx_attr_t {
 
     size_t prefetch_size;
     size_t in_mem_buffer;
+
+    /* Seconds after which a verified blob is rehashed by the scrubber */
+    size_t scrub_interval;
+
+    /* Size at which the active pack of the blob store is sealed */
+    size_t pack_size;
+
+    /* Memory budget of the receiver's hot chunk cache */
+    size_t chunk_cache_size;
+
+    /* Milliseconds a janitor run may spend, and how many files or chunks it handles per step */
+    size_t gc_time_budget;
+    size_t gc_batch_size;
+
+    /* Seconds between sweeps of the background janitor, and the percentage of wall time it may spend working */
+    size_t gc_interval;
+    size_t gc_duty_percent;
+
+    /* Bytes of the database file mapped into memory and the page cache budget under FZ_DB_THROUGHPUT */
+    size_t db_mmap_size;
+    size_t db_cache_size;
+
+    /* Received files whose metadata may wait for the writer thread before the receiver blocks */
+    size_t meta_queue_depth;
+
+    /* Read-only connections lookups may hold at once, threads beyond that wait for one to be released */
+    size_t db_readers;
 } fz_ctx_attr_t;
 
 
+/* What the receiver knew about a blob file when it last verified its content */
+typedef struct fz_blob_state_t{
+    size_t blob_size;
+    int64_t mtime_ns;
+    uint64_t inode;
+    int64_t verified_at;
+
+    /* Packed blobs live at `pack_offset` of pack `pack_id`, loose blobs have a zero `pack_id` */
+    uint32_t pack_id;
+
+    /* Non-zero for packed blobs stored compressed, `blob_size` bytes decode to `raw_size` bytes */
+    uint32_t raw_size;
+    size_t pack_offset;
+} fz_blob_state_t;
+
+/* What the sender knew about a source file when it chunked it. A file that still matches, under the same chunking parameters,
+has the manifest recorded with the fingerprint */
+typedef struct fz_file_fingerprint_t{
+    size_t file_size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint64_t inode;
+    int chunk_strategy;
+    size_t chunk_size;
+} fz_file_fingerprint_t;
+
+/* Open-addressing map of chunk checksum -> blob state with inline 64-bit keys, a zero key marks an empty slot.
+Storage is either heap allocated or a private mapping of the on-disk snapshot */
+typedef struct fz_chunk_index_t{
+    fz_hex_digest_t *keys;
+    fz_blob_state_t *values;
+    size_t capacity;
+    size_t count;
+
+    /* The zero checksum cannot live in a slot */
+    int has_zero;
+    fz_blob_state_t zero_value;
+
+    void *map;
+    size_t map_size;
+} fz_chunk_index_t;
+
+
+/* Readable byte range of a stored chunk */
+typedef struct fz_blob_handle_t{
+    int fd;
+    size_t offset;
+    size_t size;
+    int owned;
+
+    /* Non-zero if the range holds a compressed chunk, read it with `fz_blob_store_read` */
+    size_t raw_size;
+
+    /* Set for loose blobs that differ from their recorded state, their content has to be verified before use */
+    int changed;
+    fz_blob_state_t state;
+
+    /* Pack the range lies in, its descriptor stays open until the handle is released */
+    struct fz_pack_store_t *store;
+} fz_blob_handle_t;
+
+
+typedef struct fz_pack_info_t{
+    uint32_t pack_id;
+    size_t length;
+    int sealed;
+} fz_pack_info_t;
+
+
+/* Append-only segments under `metadata_loc`, one pack is open for appends and sealed once it reaches `pack_size` */
+typedef struct fz_pack_store_t{
+    int *fds;
+
+    /* Open handles per pack. A repacked pack is retired and its descriptor closed once the last handle on it is released */
+    size_t *refs;
+    uint8_t *retired;
+
+    uint32_t active_id;
+    int active_fd;
+    size_t active_len;
+    pthread_mutex_t mtx;
+} fz_pack_store_t;
+
+
 enum FZ_CHUNK_STRATEGY {
     FZ_FIXED_SIZED_CHUNK = (0x1 << 0),
     FZ_GEAR_CDC_CHUNK = (0x1 << 1)
@@ -153,6 +279,51 @@ enum FZ_HASHING_ALGORITHM {
 };
 
 
+enum FZ_ASSEMBLY_MODE {
+    FZ_ASSEMBLE_STAGED = (0x1 << 0),
+    FZ_ASSEMBLE_DIRECT = (0x1 << 1)
+};
+
+
+enum FZ_BLOB_LAYOUT {
+    FZ_BLOB_LOOSE = (0x1 << 0),
+    FZ_BLOB_PACKED = (0x1 << 1)
+};
+
+
+enum FZ_RECHUNK_MODE {
+    FZ_RECHUNK_FULL = (0x1 << 0),
+    FZ_RECHUNK_APPEND = (0x1 << 1)
+};
+
+
+enum FZ_META_BACKEND {
+    FZ_META_SQLITE = (0x1 << 0),
+    FZ_META_LSM = (0x1 << 1)
+};
+
+
+enum FZ_DB_PROFILE {
+    FZ_DB_DURABLE = (0x1 << 0),
+    FZ_DB_THROUGHPUT = (0x1 << 1)
+};
+
+
+enum FZ_CHUNK_CODEC {
+    FZ_CODEC_RAW = (0x1 << 0),
+    FZ_CODEC_LZ = (0x1 << 1)
+};
+
+/* Chunk frame header, the codec of the payload then its size. A peer that predates the codec byte fails to parse it instead of misreading the payload */
+#define FZ_CHUNK_FRAME_FMT "%d:%lu"
+
+
+enum FZ_CHUNK_FILTER_SOURCE {
+    FZ_FILTER_BLOB_STATE = (0x1 << 0),
+    FZ_FILTER_CHUNKS = (0x1 << 1)
+};
+
+
 enum FZ_CHANNEL_DESC_T {
     FZ_FIFO = (0x1 << 0),
     FZ_TCP_SOCKET = (0x1 << 1),
@@ -237,11 +408,215 @@ struct fz_fifo_channel_s{
 };
 
 
+/* Blocked Bloom filter over every chunk the receiver may hold locally, persisted under `metadata_loc` */
+typedef struct fz_chunk_filter_t{
+    uint32_t *blocks;
+    size_t nblocks;
+    size_t nkeys;
+
+    /* Epochs of `filezap_blob_state` and `filezap_chunk_locs` the filter covers */
+    uint64_t blob_state_epoch;
+    uint64_t chunks_epoch;
+
+    int ready;
+    int failed;
+    int unsaved;
+    int stale;
+    pthread_mutex_t mtx;
+} fz_chunk_filter_t;
+
+
+/* Location of a chunk in a run of the LSM chunk index, the file is named by its id in the file log */
+typedef struct fz_lsm_loc_t{
+    uint64_t file_id;
+    uint64_t cutpoint;
+    uint64_t chunk_size;
+} fz_lsm_loc_t;
+
+/* Immutable run of the LSM chunk index, mapped read-only: `count` sorted keys with their locations and the distinct file ids in it */
+typedef struct fz_lsm_run_t{
+    uint64_t seq;
+    const uint64_t *keys;
+    const fz_lsm_loc_t *locs;
+    const uint64_t *file_ids;
+    size_t count;
+    size_t nfiles;
+    uint64_t min_key;
+    uint64_t max_key;
+    void *map;
+    size_t map_size;
+} fz_lsm_run_t;
+
+/* Chunk that lost its last location at `since`, collectable unless it was recorded again */
+typedef struct fz_lsm_zero_t{
+    uint64_t key;
+    int64_t since;
+} fz_lsm_zero_t;
+
+typedef struct fz_lsm_file_t{
+    char *path;
+    uint64_t nrows;
+} fz_lsm_file_t;
+
+struct lsm_file_map_s {uint64_t key; fz_lsm_file_t value;};
+struct lsm_path_map_s {char *key; uint64_t value;};
+struct lsm_id_set_s {uint64_t key; uint8_t value;};
+
+/* Chunk location index under `metadata_loc` for FZ_META_LSM: immutable sorted runs of 64-bit keys, an append-only log of recorded files
+and one of chunks left without locations, tied together by a manifest that is replaced on every commit. Set up on first use */
+typedef struct fz_chunk_lsm_t{
+    fz_lsm_run_t *runs;
+
+    /* Live files by id and by path. Ids of dropped files stay pending until no run holds their rows */
+    struct lsm_file_map_s *files;
+    struct lsm_path_map_s *paths;
+    struct lsm_id_set_s *pending;
+    char **sorted_paths;
+    int paths_dirty;
+
+    /* Log entries from `zero_head` on, and keys collected out of order that the head has not passed yet */
+    fz_lsm_zero_t *zero;
+    struct lsm_id_set_s *collected;
+
+    uint64_t next_seq;
+    uint64_t next_file_id;
+    uint64_t files_gen;
+    uint64_t files_len;
+    uint64_t zero_gen;
+    uint64_t zero_head;
+    uint64_t zero_len;
+    uint64_t chunks_epoch;
+
+    int lock_fd;
+    int ready;
+    int failed;
+    pthread_mutex_t mtx;
+} fz_chunk_lsm_t;
+
+
+/* Watch descriptor -> every prefix under which recorded files name its directory, and canonical directory -> watch descriptor */
+struct watch_dir_map_s {int key; char **value;};
+struct watch_wd_map_s {char *key; int value;};
+
+/* inotify watches on the directories of recorded files, keyed both ways */
+typedef struct fz_watcher_t{
+    int fd;
+    int running;
+    struct watch_wd_map_s *dirs;
+    struct watch_dir_map_s *wds;
+} fz_watcher_t;
+
+
+typedef struct fz_cache_entry_t{
+    fz_hex_digest_t chunk_checksum;
+    char *data;
+    size_t size;
+    int referenced;
+} fz_cache_entry_t;
+
+struct cache_slot_map_s {fz_hex_digest_t key; size_t value;};
+
+typedef struct fz_cache_shard_t{
+    struct cache_slot_map_s *slots;
+    fz_cache_entry_t *entries;
+    size_t hand;
+    size_t used;
+    pthread_mutex_t mtx;
+} fz_cache_shard_t;
+
+
+/* Verified chunk contents kept in memory with CLOCK eviction, each shard has its own lock and an equal share of the budget */
+typedef struct fz_chunk_cache_t{
+    fz_cache_shard_t shards[FZ_CACHE_SHARDS];
+    size_t shard_budget;
+} fz_chunk_cache_t;
+
+
+struct stmt_cache_map_s {const char *key; sqlite3_stmt *value;};
+
+/* A database connection besides `ctx->db` with its own prepared statements, query functions use it on the thread that bound it */
+typedef struct fz_db_conn_t{
+    sqlite3 *db;
+    struct stmt_cache_map_s *stmt_cache;
+} fz_db_conn_t;
+
+
+/* Read-only connections for lookups, opened on first use. Under WAL each reads the last committed state without waiting for
+`ctx->db` or the metadata writer, which stay the only connections that write */
+typedef struct fz_db_pool_t{
+    fz_db_conn_t *conns;
+    size_t *idle;
+    size_t nopen;
+    size_t max;
+    int failed;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+} fz_db_pool_t;
+
+
+/* A received file whose chunk metadata is not committed yet, the job owns both */
+typedef struct fz_meta_job_t{
+    fz_file_manifest_t mnfst;
+    char *dest_file_path;
+} fz_meta_job_t;
+
+
+struct fz_ctx_t;
+struct missing_chunks_map_s;
+
+/* Where chunk locations and references are kept, `fz_ctx_init` picks the implementation for `meta_backend`. A commit returns the
+chunk table epoch it moved to, moved in the same commit as the rows so the presence filter never trusts an epoch the rows missed */
+typedef struct fz_meta_ops_t{
+    int (*required_chunk_list)(struct fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_t **chunk_buffer, size_t *nchunk, struct missing_chunks_map_s **missing_chunks);
+    int (*commit_group)(struct fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs, uint64_t *epoch);
+    int (*remove_files)(struct fz_ctx_t *ctx, const char **file_paths, size_t nfiles, size_t *nrows);
+    int (*list_files)(struct fz_ctx_t *ctx, const char *after, size_t limit, char ***file_paths);
+    int (*unreferenced)(struct fz_ctx_t *ctx, size_t limit, fz_hex_digest_t **checksums);
+    int (*collect)(struct fz_ctx_t *ctx, fz_hex_digest_t *checksums, size_t nchunk);
+    int (*checksums)(struct fz_ctx_t *ctx, fz_hex_digest_t **checksums);
+    int (*chunks_epoch)(struct fz_ctx_t *ctx, uint64_t *epoch);
+} fz_meta_ops_t;
+
+
+/* Commits received files on its own connection, several per transaction. Every queued job holds a janitor pause until its rows are committed */
+typedef struct fz_meta_writer_t{
+    pthread_t thread;
+    fz_db_conn_t conn;
+    fz_meta_job_t *jobs;
+    size_t depth;
+    uint64_t submitted;
+    uint64_t committed;
+    int running;
+    int stop;
+    int failed;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+} fz_meta_writer_t;
+
+
+/* Background janitor, it only takes a step while no transfer is active and a transfer waits at most for the step in flight */
+typedef struct fz_janitor_t{
+    pthread_t thread;
+    size_t active_transfers;
+    int running;
+    int busy;
+    int stop;
+    pthread_mutex_t mtx;
+    pthread_cond_t cv;
+} fz_janitor_t;
+
+
 typedef struct fz_ctx_t{
     // fz_ctx_desc_t ctx_id;
     int chunk_strategy;
     int hash_algorithm;
 
+    /* FZ_ASSEMBLE_DIRECT copies locally found chunks straight from their source file instead of staging them as blobs */
+    int assembly_mode;
+
+    /* FZ_RECHUNK_APPEND hashes only the tail of a file that grew since its last fingerprint, FZ_RECHUNK_FULL reads it all again */
+    int rechunk_mode;
+
     /* this is location where all the data and metadata are kept after chunking */
     const char* metadata_loc;
     const char* target_dir;
@@ -251,6 +626,47 @@ typedef struct fz_ctx_t{
     size_t max_threads;
 
     sqlite3 *db;
+
+    /* FZ_DB_THROUGHPUT runs the database in WAL mode with synchronous=NORMAL, memory mapped reads and an in-memory temp store,
+    FZ_DB_DURABLE keeps SQLite's journal and syncs every commit */
+    int db_profile;
+    struct stmt_cache_map_s *stmt_cache;
+    fz_db_pool_t db_pool;
+
+    /* Where chunk locations and references live: FZ_META_SQLITE keeps them in the database, FZ_META_LSM in `chunk_lsm`, `meta_ops`
+    is the matching implementation. Switching backends starts from an empty chunk table, the other backend's records are left as they are */
+    int meta_backend;
+    const fz_meta_ops_t *meta_ops;
+    fz_chunk_lsm_t chunk_lsm;
+
+    /* Blob state index: checksum -> state of the verified blob, persisted in `filezap_blob_state`.
+    `blob_state_epoch` is the table version the index reflects, the snapshot under `metadata_loc` is only trusted at that epoch */
+    fz_chunk_index_t blob_state;
+    fz_hex_digest_t *blob_state_dirty;
+    pthread_mutex_t blob_state_mtx;
+    uint64_t blob_state_epoch;
+    int blob_state_unsaved;
+
+    /* Answers "definitely not held locally" for chunks missing from the blob state index */
+    fz_chunk_filter_t chunk_filter;
+
+    /* Recently downloaded or verified chunks, assembly writes them from memory when it cannot reflink */
+    fz_chunk_cache_t chunk_cache;
+
+    /* FZ_BLOB_PACKED appends new chunks to pack files, FZ_BLOB_LOOSE writes one file per chunk */
+    int blob_layout;
+    fz_pack_store_t packs;
+
+    /* FZ_CODEC_LZ compresses chunks that pass the entropy probe on the wire and in packs, FZ_CODEC_RAW sends and stores them as is */
+    int compression;
+
+    fz_janitor_t janitor;
+
+    /* Takes chunk metadata commits off the receiving thread once started, without it they run inline */
+    fz_meta_writer_t meta_writer;
+
+    /* Invalidates scavengeable files as they change instead of when the janitor or a checksum mismatch finds out */
+    fz_watcher_t watcher;
 } fz_ctx_t;
 
 
@@ -262,8 +678,20 @@ typedef struct fz_cutpoint_list_t{
 } fz_cutpoint_list_t;
 
 
+/* Location of a chunk inside an existing local file, a NULL `file_path` means the chunk is read from the blob store */
+typedef struct fz_chunk_loc_t{
+    const char *file_path;
+    size_t offset;
+
+    /* State of the source file when the chunk was verified, assembly refuses to copy from a file that changed since */
+    size_t file_size;
+    int64_t mtime_ns;
+} fz_chunk_loc_t;
+
+
 struct cutpoint_map_s {char *key; fz_cutpoint_list_t *value;};
 struct missing_chunks_map_s {fz_hex_digest_t key; int8_t value;};
+struct chunk_loc_map_s {fz_hex_digest_t key; fz_chunk_loc_t value;};
 
 
 extern int fz_ctx_init(fz_ctx_t *ctx, int chunk_strategy, const char *metadata_loc, const char *target_dir, const char *db_file, int *max_threads, fz_ctx_attr_t *ctx_attrs);
@@ -284,7 +712,16 @@ extern void* fz_fetch_chunk(void *);
 /* Fetch file from manifest */ 
 extern int fz_fetch_file(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, fz_channel_t *channel, fz_dyn_queue_t *download_queue);
 extern int fz_retrieve_file(fz_ctx_t *ctx, fz_file_manifest_t *file_mnfst, fz_channel_t *channel, char *file_name);
-extern int fz_fetch_file_st(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_channel_t *channel, fz_dyn_queue_t *download_queue, struct cutpoint_map_s **cutpoint_map, struct missing_chunks_map_s **missing_chunks, char *dest_file_path);
+extern int fz_assemble_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_loc_t *chunk_locs, int dest_fd);
+extern int fz_fetch_file_st(
+    fz_ctx_t *ctx, 
+    fz_file_manifest_t *mnfst, 
+    fz_channel_t *channel, 
+    fz_dyn_queue_t *download_queue, 
+    struct cutpoint_map_s **cutpoint_map, 
+    struct missing_chunks_map_s **missing_chunks, 
+    struct chunk_loc_map_s **chunk_locs, 
+    char *dest_file_path);
 
 extern int fz_chunk_init(fz_chunk_seq_t *chnk);
 extern void fz_chunk_destroy(fz_chunk_seq_t *chnk);
@@ -316,7 +753,7 @@ extern void fz_dyn_queue_destroy(fz_dyn_queue_t *dyn_queue);
 
 extern void xxhash_hexdigest(char *buffer, size_t stream_len, fz_hex_digest_t *digest);
 extern int xxhash_hexdigest_from_file(FILE *fd, fz_hex_digest_t *digest);
-extern int xxhash_hexdigest_from_file_prime(fz_hex_digest_t *digest, fz_hex_digest_t *digest_list, size_t digest_list_len);
+extern int xxhash_hexdigest_from_file_prime(fz_hex_digest_t *digest, fz_chunk_seq_t *chunk_seq);
 
 
 extern int fz_serialize_response(fz_chunk_response_t *response, char **json, size_t *json_size);
@@ -340,21 +777,173 @@ extern int fz_fetch_chunks_from_file_cutpoint(
     size_t nchunk, 
     struct cutpoint_map_s **cutpoint_map,
     struct missing_chunks_map_s **missing_chunks,
+    struct chunk_loc_map_s **chunk_locs,
     char *dest_file_path);
 
 extern int fz_janitor_clean_up(fz_ctx_t *ctx);
+extern void fz_janitor_init(fz_ctx_t *ctx);
+extern void fz_janitor_destroy(fz_ctx_t *ctx);
+extern int fz_janitor_start(fz_ctx_t *ctx);
+extern void fz_janitor_stop(fz_ctx_t *ctx);
+extern void fz_janitor_pause(fz_ctx_t *ctx);
+extern void fz_janitor_resume(fz_ctx_t *ctx);
+extern void fz_meta_writer_init(fz_ctx_t *ctx);
+extern void fz_meta_writer_destroy(fz_ctx_t *ctx);
+extern int fz_meta_writer_start(fz_ctx_t *ctx);
+extern int fz_meta_writer_submit(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, const char *dest_file_path);
+extern int fz_meta_writer_flush(fz_ctx_t *ctx);
+extern int fz_watcher_start(fz_ctx_t *ctx);
+extern void fz_watcher_destroy(fz_ctx_t *ctx);
+extern void fz_watcher_watch(fz_ctx_t *ctx, const char *file_path);
+extern int fz_watcher_poll(fz_ctx_t *ctx, const char *ignore_path);
+
+
+extern int fz_blob_path(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size);
+extern int fz_blob_state_init(fz_ctx_t *ctx);
+extern void fz_blob_state_destroy(fz_ctx_t *ctx);
+extern int fz_blob_state_get(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, fz_blob_state_t *state);
+extern int fz_blob_state_record(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum);
+extern void fz_blob_state_forget(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum);
+extern int fz_blob_state_flush(fz_ctx_t *ctx);
+extern int fz_blob_locate(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size);
+extern int fz_blob_store_migrate(fz_ctx_t *ctx);
+extern int fz_blob_store_list_loose(fz_ctx_t *ctx, fz_hex_digest_t **checksums);
+extern int fz_chunk_compressible(const char *buffer, size_t size);
+extern int fz_chunk_compress(const char *src, size_t size, char **buffer, size_t *max_alloc, size_t *compressed_size);
+extern int fz_chunk_decompress(const char *src, size_t compressed_size, char *dst, size_t raw_size);
+extern void fz_chunk_cache_init(fz_chunk_cache_t *cache, size_t budget);
+extern void fz_chunk_cache_destroy(fz_chunk_cache_t *cache);
+extern void fz_chunk_cache_put(fz_chunk_cache_t *cache, fz_hex_digest_t chunk_checksum, const char *data, size_t size);
+extern int fz_chunk_cache_get(fz_chunk_cache_t *cache, fz_hex_digest_t chunk_checksum, char **buffer, size_t *max_alloc, size_t *size);
+extern void fz_chunk_filter_init(fz_ctx_t *ctx);
+extern void fz_chunk_filter_destroy(fz_ctx_t *ctx);
+extern int fz_chunk_filter_may_contain(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum);
+extern void fz_chunk_filter_commit(fz_ctx_t *ctx, int source, uint64_t epoch, fz_hex_digest_t *keys, size_t nkeys);
+extern int fz_chunk_index_init(fz_chunk_index_t *index, size_t capacity);
+extern void fz_chunk_index_destroy(fz_chunk_index_t *index);
+extern fz_blob_state_t *fz_chunk_index_get(fz_chunk_index_t *index, fz_hex_digest_t key);
+extern int fz_chunk_index_put(fz_chunk_index_t *index, fz_hex_digest_t key, fz_blob_state_t *value);
+extern int fz_chunk_index_del(fz_chunk_index_t *index, fz_hex_digest_t key);
+extern int fz_chunk_index_next(fz_chunk_index_t *index, size_t *cursor, fz_hex_digest_t *key, fz_blob_state_t **value);
+extern size_t fz_chunk_index_len(fz_chunk_index_t *index);
+extern int fz_chunk_index_load(fz_chunk_index_t *index, const char *path, uint64_t epoch);
+extern int fz_chunk_index_save(fz_chunk_index_t *index, const char *path, uint64_t epoch);
+extern void fz_chunk_lsm_init(fz_ctx_t *ctx);
+extern void fz_chunk_lsm_destroy(fz_ctx_t *ctx);
+extern const fz_meta_ops_t fz_meta_lsm_ops;
+extern int fz_blob_store_put(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size);
+extern int fz_blob_store_put_compressed(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, const char *buffer, size_t size, const char *compressed, size_t compressed_size);
+extern int fz_blob_store_read(fz_blob_handle_t *handle, char **buffer, size_t *max_alloc, size_t *size);
+extern int fz_blob_store_open(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum, fz_blob_handle_t *handle);
+extern void fz_blob_store_release(fz_blob_handle_t *handle);
+extern int fz_blob_store_remove(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum);
+extern int fz_blob_store_repack(fz_ctx_t *ctx, size_t max_bytes, int *more);
+extern int fz_blob_store_reconcile(fz_ctx_t *ctx);
+extern int fz_blob_store_scrub(fz_ctx_t *ctx, size_t limit, int *more);
+
+/* Query: chunk location backend kept in `filezap_files`, `filezap_chunk_locs` and `filezap_chunk_refs` */
+extern const fz_meta_ops_t fz_meta_sqlite_ops;
 
 /* Query: find required chunk list */
 extern int fz_query_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_t **chunk_buffer, size_t *nchunk, struct missing_chunks_map_s **missing_chunks);
 
 /* Query: commit chunk metadata */
-extern int fz_commit_chunk_metadata(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, char *dest_file_path);
+extern int fz_commit_chunk_metadata(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, char *dest_file_path, uint64_t *epoch);
+
+/* Query: commit the chunk metadata of several received files in one transaction */
+extern int fz_commit_chunk_metadata_group(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs, uint64_t *epoch);
+
+/* Query: commit removal of a file, the chunks it referenced are released. `*nrows` (optional) receives the number of chunk rows dropped */
+extern int fz_commit_file_removal(fz_ctx_t *ctx, const char *file_path, size_t *nrows);
+
+/* Query: commit removal of `nfiles` files in one transaction. `*nrows` (optional) receives the total number of chunk rows dropped */
+extern int fz_commit_file_removals(fz_ctx_t *ctx, const char **file_paths, size_t nfiles, size_t *nrows);
+
+/* Query: up to `limit` recorded file paths ordered after `after` (NULL for the first) */
+extern int fz_query_chunk_files(fz_ctx_t *ctx, const char *after, size_t limit, char ***file_paths);
+
+/* Query: up to `limit` chunks without references, longest unreferenced first */
+extern int fz_query_unreferenced_chunks(fz_ctx_t *ctx, size_t limit, fz_hex_digest_t **checksums);
+
+/* Query: commit collection of unreferenced chunks */
+extern int fz_commit_chunk_collection(fz_ctx_t *ctx, fz_hex_digest_t *checksums, size_t nchunk);
+
+/* Query: store `value` under `key` in `filezap_meta` */
+extern int fz_commit_meta_value(fz_ctx_t *ctx, const char *key, uint64_t value);
+
+/* Query: create missing filezap tables */
+extern int fz_init_tables(fz_ctx_t *ctx);
+
+/* Query: apply the journal, sync and cache settings of `db_profile` */
+extern int fz_db_configure(fz_ctx_t *ctx);
+
+/* Query: checkpoint the WAL so every commit so far survives a power failure */
+extern int fz_db_sync(fz_ctx_t *ctx);
+
+/* Query: finalize the cached statements and close the connection */
+extern void fz_db_close(fz_ctx_t *ctx);
+
+/* Query: open another connection to the same database with the same profile */
+extern int fz_db_conn_open(fz_ctx_t *ctx, fz_db_conn_t *conn);
+
+/* Query: finalize the cached statements of `conn` and close it */
+extern void fz_db_conn_close(fz_db_conn_t *conn);
+
+/* Query: run the calling thread's queries on `conn`, NULL returns them to `ctx->db` */
+extern void fz_db_bind(fz_db_conn_t *conn);
+
+/* Query: set up an empty read-only pool, connections open on first acquire */
+extern void fz_db_pool_init(fz_ctx_t *ctx);
+
+/* Query: close every read-only connection, none may be acquired */
+extern void fz_db_pool_destroy(fz_ctx_t *ctx);
+
+/* Query: take a read-only connection, waiting while all of them are in use */
+extern int fz_db_read_acquire(fz_ctx_t *ctx, fz_db_conn_t **conn);
+
+/* Query: hand a connection from `fz_db_read_acquire` back to the pool */
+extern void fz_db_read_release(fz_ctx_t *ctx, fz_db_conn_t *conn);
+
+/* Query: load blob state index */
+extern int fz_query_blob_state(fz_ctx_t *ctx, fz_chunk_index_t *blob_state);
+
+/* Query: store the text `value` under `key` in `filezap_meta_text` */
+extern int fz_commit_meta_text(fz_ctx_t *ctx, const char *key, const char *value);
+
+/* Query: text stored under `key` in `filezap_meta_text`, NULL if unset. The caller frees it */
+extern int fz_query_meta_text(fz_ctx_t *ctx, const char *key, char **value);
+
+/* Query: value stored under `key` in `filezap_meta`, 0 if unset */
+extern int fz_query_meta_value(fz_ctx_t *ctx, const char *key, uint64_t *value);
+
+/* Query: every checksum with a recorded location */
+extern int fz_query_chunk_checksums(fz_ctx_t *ctx, fz_hex_digest_t **checksums);
+
+/* Query: epoch of the chunk locations, it moves with every commit of received files */
+extern int fz_query_chunks_epoch(fz_ctx_t *ctx, uint64_t *epoch);
+
+/* Query: manifest recorded for `file_path` under `fingerprint`, returns 0 without touching `mnfst` if there is none */
+extern int fz_query_fingerprint(fz_ctx_t *ctx, const char *file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *mnfst);
+
+/* Query: the last fingerprint and manifest recorded for `file_path` whatever the file looks like now, with the saved file digest
+state (malloc'ed, NULL if none was recorded). Returns 0 if the file has no fingerprint */
+extern int fz_query_last_fingerprint(fz_ctx_t *ctx, const char *file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *mnfst, char **hash_state, size_t *hash_state_size);
+
+/* Query: record the manifest of `file_path` under `fingerprint`, replacing the previous one. `hash_state` is the file digest state
+at the end of the last full chunk, NULL records none */
+extern int fz_commit_fingerprint(fz_ctx_t *ctx, const char *file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *mnfst, const void *hash_state, size_t hash_state_size);
+
+/* Query: commit blob state changes, entries with `present` unset are removed */
+extern int fz_commit_blob_state(fz_ctx_t *ctx, fz_hex_digest_t *chunk_checksum, fz_blob_state_t *states, uint8_t *present, size_t nchunk, uint64_t *epoch);
+
+/* Query: list blob store packs */
+extern int fz_query_packs(fz_ctx_t *ctx, fz_pack_info_t **packs);
 
-/* Query: fetch unused chunks */
-extern int fz_query_unused_chunk(fz_ctx_t *ctx, fz_hex_digest_t **unused_chunk_list, size_t *nchunk);
+/* Query: commit pack length and seal */
+extern int fz_commit_pack(fz_ctx_t *ctx, uint32_t pack_id, size_t length, int sealed);
 
-/* Query: commit janitor change */
-extern int fz_commit_janitor_change(fz_ctx_t *ctx, fz_hex_digest_t *unused_chunk_list, size_t nchunk);
+/* Query: commit pack removal */
+extern int fz_commit_pack_removal(fz_ctx_t *ctx, uint32_t pack_id);
 
 
 extern void fz_log(int level, const char *fmt, ...) FZ_PRINTF_FORMAT(2, 3);
@@ -0,0 +1,168 @@
+#include <string.h>
+#include "core.h"
+
+#define META_QUEUE_DEPTH_DEFAULT 16
+
+/* Jobs committed in one transaction at most, a backlog larger than this is worked off in several */
+#define META_GROUP_MAX 64
+
+
+static void *writer_main(void *arg);
+static void commit_group(fz_ctx_t *ctx, fz_meta_job_t *group, size_t njobs);
+static int commit_jobs(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs);
+
+
+extern void fz_meta_writer_init(fz_ctx_t *ctx){
+    fz_meta_writer_t *writer = &ctx->meta_writer;
+    memset(writer, 0, sizeof(*writer));
+    pthread_mutex_init(&writer->mtx, NULL);
+    pthread_cond_init(&writer->cv, NULL);
+}
+
+
+/* Commits whatever is still queued before the thread exits */
+extern void fz_meta_writer_destroy(fz_ctx_t *ctx){
+    fz_meta_writer_t *writer = &ctx->meta_writer;
+    if (writer->running){
+        pthread_mutex_lock(&writer->mtx);
+        writer->stop = 1;
+        pthread_cond_broadcast(&writer->cv);
+        pthread_mutex_unlock(&writer->mtx);
+        pthread_join(writer->thread, NULL);
+        fz_db_conn_close(&writer->conn);
+        writer->running = 0;
+    }
+    if (NULL != writer->jobs) arrfree(writer->jobs);
+    pthread_mutex_destroy(&writer->mtx);
+    pthread_cond_destroy(&writer->cv);
+}
+
+
+/* Starts the writer thread on a connection of its own, from here on `fz_receive_file` acknowledges a file before its metadata is committed */
+extern int fz_meta_writer_start(fz_ctx_t *ctx){
+    fz_meta_writer_t *writer = &ctx->meta_writer;
+    if (writer->running) return 1;
+    writer->depth = (0 != ctx->ctx_attrs.meta_queue_depth)? ctx->ctx_attrs.meta_queue_depth : META_QUEUE_DEPTH_DEFAULT;
+    writer->stop = 0;
+    if (!fz_db_conn_open(ctx, &writer->conn)) return 0;
+    if (0 != pthread_create(&writer->thread, NULL, writer_main, ctx)){
+        fz_log(FZ_ERROR, "Unable to start the metadata writer thread");
+        fz_db_conn_close(&writer->conn);
+        return 0;
+    }
+    writer->running = 1;
+    return 1;
+}
+
+
+/* Hands the chunk metadata of a received file to the writer, `mnfst` is taken over and left empty. Blocks while the queue is full.
+The janitor stays paused until the rows are committed, it never sees a file that is on disk but not yet recorded.
+Without a running writer the commit happens here */
+extern int fz_meta_writer_submit(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, const char *dest_file_path){
+    fz_meta_writer_t *writer = &ctx->meta_writer;
+    fz_meta_job_t job = {.mnfst = *mnfst, .dest_file_path = strdup(dest_file_path)};
+    if (NULL == job.dest_file_path) return 0;
+    memset(mnfst, 0, sizeof(*mnfst));
+    if (!writer->running) {
+        int result = commit_jobs(ctx, &job, 1);
+        fz_file_manifest_destroy(&job.mnfst);
+        free(job.dest_file_path);
+        return result;
+    }
+
+    fz_janitor_pause(ctx);
+    pthread_mutex_lock(&writer->mtx);
+    while (arrlenu(writer->jobs) >= writer->depth) pthread_cond_wait(&writer->cv, &writer->mtx);
+    arrput(writer->jobs, job);
+    writer->submitted++;
+    pthread_cond_broadcast(&writer->cv);
+    pthread_mutex_unlock(&writer->mtx);
+    return 1;
+}
+
+
+/* Waits until every file submitted so far is committed, returns 0 if any of them could not be recorded since the last flush */
+extern int fz_meta_writer_flush(fz_ctx_t *ctx){
+    fz_meta_writer_t *writer = &ctx->meta_writer;
+    if (!writer->running) return 1;
+    pthread_mutex_lock(&writer->mtx);
+    uint64_t target = writer->submitted;
+    while (writer->committed < target) pthread_cond_wait(&writer->cv, &writer->mtx);
+    int result = !writer->failed;
+    writer->failed = 0;
+    pthread_mutex_unlock(&writer->mtx);
+    return result;
+}
+
+
+static void *writer_main(void *arg){
+    fz_ctx_t *ctx = (fz_ctx_t *)arg;
+    fz_meta_writer_t *writer = &ctx->meta_writer;
+    fz_meta_job_t *group = NULL;
+
+    fz_db_bind(&writer->conn);
+    while (1){
+        pthread_mutex_lock(&writer->mtx);
+        while (0 == arrlenu(writer->jobs) && !writer->stop) pthread_cond_wait(&writer->cv, &writer->mtx);
+        size_t njobs = arrlenu(writer->jobs);
+        if (0 == njobs) {
+            pthread_mutex_unlock(&writer->mtx);
+            break;
+        }
+        /* Everything queued while the previous group was committing goes into the next transaction */
+        if (njobs > META_GROUP_MAX) njobs = META_GROUP_MAX;
+        for (size_t i = 0; i < njobs; i++) arrput(group, writer->jobs[i]);
+        arrdeln(writer->jobs, 0, njobs);
+        pthread_cond_broadcast(&writer->cv);
+        pthread_mutex_unlock(&writer->mtx);
+
+        commit_group(ctx, group, njobs);
+        arrdeln(group, 0, njobs);
+    }
+    fz_db_bind(NULL);
+    if (NULL != group) arrfree(group);
+    return NULL;
+}
+
+
+/* A group that fails as a whole is retried file by file, one bad job must not cost the others their rows */
+static void commit_group(fz_ctx_t *ctx, fz_meta_job_t *group, size_t njobs){
+    fz_meta_writer_t *writer = &ctx->meta_writer;
+    size_t nfailed = 0;
+    if (!commit_jobs(ctx, group, njobs)) {
+        for (size_t i = 0; i < njobs; i++){
+            if (1 < njobs && commit_jobs(ctx, &group[i], 1)) continue;
+            fz_log(FZ_ERROR, "Could not record `%s`, its chunks are not offered for reuse", group[i].dest_file_path);
+            nfailed++;
+        }
+    }
+    for (size_t i = 0; i < njobs; i++){
+        fz_file_manifest_destroy(&group[i].mnfst);
+        free(group[i].dest_file_path);
+        fz_janitor_resume(ctx);
+    }
+    pthread_mutex_lock(&writer->mtx);
+    writer->committed += njobs;
+    if (0 < nfailed) writer->failed = 1;
+    pthread_cond_broadcast(&writer->cv);
+    pthread_mutex_unlock(&writer->mtx);
+}
+
+
+static int commit_jobs(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs){
+    uint64_t chunks_epoch = 0;
+    fz_hex_digest_t *keys = NULL;
+    if (!fz_commit_chunk_metadata_group(ctx, jobs, njobs, &chunks_epoch)) return 0;
+    if (1 == njobs) {
+        fz_chunk_filter_commit(ctx, FZ_FILTER_CHUNKS, chunks_epoch, jobs[0].mnfst.chunk_seq.chunk_checksum, jobs[0].mnfst.chunk_seq.chunk_seq_len);
+        return 1;
+    }
+    /* The group moved the epoch once, the filter has to take all of its keys in one step */
+    for (size_t i = 0; i < njobs; i++){
+        fz_chunk_seq_t *seq = &jobs[i].mnfst.chunk_seq;
+        for (size_t j = 0; j < seq->chunk_seq_len; j++) arrput(keys, seq->chunk_checksum[j]);
+    }
+    fz_chunk_filter_commit(ctx, FZ_FILTER_CHUNKS, chunks_epoch, keys, arrlenu(keys));
+    if (NULL != keys) arrfree(keys);
+    return 1;
+}
@@ -1,34 +1,325 @@
+#include <time.h>
+#include <string.h>
 #include "core.h"
 
+#define GC_TIME_BUDGET_DEFAULT 500
+#define GC_BATCH_SIZE_DEFAULT 256
+#define GC_INTERVAL_DEFAULT 60
+#define GC_DUTY_PERCENT_DEFAULT 10
+/* Conservative copy rate used to turn what is left of the time budget into a repack byte cap */
+#define GC_REPACK_BYTES_PER_MS KB(64)
+/* Below this many files per thread the stats run on the calling thread */
+#define STAT_FILES_PER_THREAD 32
+
+
+struct stat_thread_arg {
+    char **file_paths;
+    int *gone;
+    size_t *next_file;
+    pthread_mutex_t *mtx;
+};
+
+
+static inline int64_t monotonic_ms(void);
+static int check_files(fz_ctx_t *ctx, size_t batch, int *done);
+static void stat_files(fz_ctx_t *ctx, char **file_paths, int *gone);
+static void *stat_worker(void *arg);
+static int collect_chunks(fz_ctx_t *ctx, size_t batch, int *more);
+static int gc_step(fz_ctx_t *ctx, size_t batch, int *files_done, int *chunks_left);
+static void *janitor_main(void *arg);
+static int janitor_acquire(fz_janitor_t *janitor);
+static void janitor_release(fz_janitor_t *janitor);
+static int janitor_sleep(fz_janitor_t *janitor, int64_t ms);
+
+
+/* Incremental garbage collection: a run checks a slice of the recorded files, releases the chunk references of those that vanished
+and deletes the blobs of chunks left without references, until both are exhausted or the time budget is spent.
+The file scan resumes where the previous run stopped */
 extern int fz_janitor_clean_up(fz_ctx_t *ctx){
     int result = 1;
-    fz_hex_digest_t *unused_checksum = NULL;
-    size_t buffer_len = 0;
-    char *temp_buffer = NULL;
-    size_t temp_buffer_len = strlen(ctx->metadata_loc) + HEX_DIGIT_SIZE + 1;
-    
-    temp_buffer = calloc(temp_buffer_len, sizeof(char));
-    if (NULL == temp_buffer) RETURN_DEFER(0);
-
-    if (!fz_query_unused_chunk(ctx, &unused_checksum, &buffer_len)){
-        fz_log(FZ_ERROR, "Could not fetch unused chunks");
-        RETURN_DEFER(0);
-    }
-    if (0 != buffer_len){
-        fz_log(FZ_INFO, "Trashing unused chunk reference...");
-        for (size_t i = 0; i < buffer_len; i++){
-            snprintf(temp_buffer, temp_buffer_len, "%s%016llx", ctx->metadata_loc, unused_checksum[i]);
-            fz_log(FZ_INFO, "Deleting %s chunk", temp_buffer);
-            int status = remove(temp_buffer);
-            if (0 == status) fz_log(FZ_ERROR, "Failed to delete chunk %s", temp_buffer);
+    size_t budget = (0 != ctx->ctx_attrs.gc_time_budget)? ctx->ctx_attrs.gc_time_budget : GC_TIME_BUDGET_DEFAULT;
+    size_t batch = (0 != ctx->ctx_attrs.gc_batch_size)? ctx->ctx_attrs.gc_batch_size : GC_BATCH_SIZE_DEFAULT;
+    int64_t deadline = monotonic_ms() + (int64_t)budget;
+    int files_done = 0;
+    int chunks_left = 1;
+
+    /* Files received so far are recorded before their chunks are judged unreferenced */
+    if (!fz_meta_writer_flush(ctx)) fz_log(FZ_WARNING, "Some received files could not be recorded");
+    /* A background janitor of the same context must not step in between */
+    fz_janitor_pause(ctx);
+    while ((!files_done || chunks_left) && monotonic_ms() < deadline){
+        if (!gc_step(ctx, batch, &files_done, &chunks_left)) RETURN_DEFER(0);
+    }
+    if (!files_done || chunks_left) fz_log(FZ_INFO, "Janitor ran out of its %lums budget, the next run picks up from here", budget);
+
+    /* Scrub and repack share what is left of the budget, scrubbing in batches and repacking no more than it can copy in time */
+    int scrub_left = 1;
+    while (scrub_left && monotonic_ms() < deadline){
+        if (!fz_blob_store_scrub(ctx, batch, &scrub_left)) {
+            fz_log(FZ_ERROR, "Could not scrub the blob store");
+            break;
         }
     }
+    int64_t remaining = deadline - monotonic_ms();
+    int repack_left = 0;
+    if (0 < remaining && !fz_blob_store_repack(ctx, (size_t)remaining * GC_REPACK_BYTES_PER_MS, &repack_left)){
+        fz_log(FZ_ERROR, "Could not repack the blob store");
+    }
+    if (scrub_left || repack_left || 0 >= remaining) fz_log(FZ_INFO, "Scrub and repack are left to the next run or the background janitor");
+    defer:
+        fz_janitor_resume(ctx);
+        return result;
+}
+
+
+extern void fz_janitor_init(fz_ctx_t *ctx){
+    fz_janitor_t *janitor = &ctx->janitor;
+    pthread_condattr_t attr;
+    memset(janitor, 0, sizeof(*janitor));
+    pthread_mutex_init(&janitor->mtx, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&janitor->cv, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+
+extern void fz_janitor_destroy(fz_ctx_t *ctx){
+    fz_janitor_stop(ctx);
+    pthread_mutex_destroy(&ctx->janitor.mtx);
+    pthread_cond_destroy(&ctx->janitor.cv);
+}
+
+
+/* Runs garbage collection on a background thread: a sweep is the same sequence of steps as `fz_janitor_clean_up` followed by
+an incremental scrub and a repack, after each step the thread idles long enough to stay within `gc_duty_percent` of wall time */
+extern int fz_janitor_start(fz_ctx_t *ctx){
+    fz_janitor_t *janitor = &ctx->janitor;
+    if (janitor->running) return 1;
+    janitor->stop = 0;
+    if (0 != pthread_create(&janitor->thread, NULL, janitor_main, ctx)){
+        fz_log(FZ_ERROR, "Unable to start the janitor thread");
+        return 0;
+    }
+    janitor->running = 1;
+    return 1;
+}
+
+
+/* Waits for the step in flight, an interrupted sweep resumes from the persisted cursor on the next start */
+extern void fz_janitor_stop(fz_ctx_t *ctx){
+    fz_janitor_t *janitor = &ctx->janitor;
+    if (!janitor->running) return;
+    pthread_mutex_lock(&janitor->mtx);
+    janitor->stop = 1;
+    pthread_cond_broadcast(&janitor->cv);
+    pthread_mutex_unlock(&janitor->mtx);
+    pthread_join(janitor->thread, NULL);
+    janitor->running = 0;
+}
+
+
+/* Marks a transfer as active: returns once the janitor finished its current step, no new step starts until the matching resume */
+extern void fz_janitor_pause(fz_ctx_t *ctx){
+    fz_janitor_t *janitor = &ctx->janitor;
+    pthread_mutex_lock(&janitor->mtx);
+    janitor->active_transfers++;
+    while (janitor->busy) pthread_cond_wait(&janitor->cv, &janitor->mtx);
+    pthread_mutex_unlock(&janitor->mtx);
+}
+
 
-    if (!fz_commit_janitor_change(ctx, unused_checksum, buffer_len)){
-        fz_log(FZ_ERROR, "Could not commit janitor changes");
+extern void fz_janitor_resume(fz_ctx_t *ctx){
+    fz_janitor_t *janitor = &ctx->janitor;
+    pthread_mutex_lock(&janitor->mtx);
+    if (0 < janitor->active_transfers) janitor->active_transfers--;
+    pthread_cond_broadcast(&janitor->cv);
+    pthread_mutex_unlock(&janitor->mtx);
+}
+
+
+static void *janitor_main(void *arg){
+    fz_ctx_t *ctx = arg;
+    fz_janitor_t *janitor = &ctx->janitor;
+    size_t batch = (0 != ctx->ctx_attrs.gc_batch_size)? ctx->ctx_attrs.gc_batch_size : GC_BATCH_SIZE_DEFAULT;
+    size_t interval = (0 != ctx->ctx_attrs.gc_interval)? ctx->ctx_attrs.gc_interval : GC_INTERVAL_DEFAULT;
+    size_t duty = (0 != ctx->ctx_attrs.gc_duty_percent)? ctx->ctx_attrs.gc_duty_percent : GC_DUTY_PERCENT_DEFAULT;
+    if (duty > 100) duty = 100;
+
+    for (;;){
+        int files_done = 0;
+        int chunks_left = 1;
+        int scrub_left = 1;
+        while (!files_done || chunks_left || scrub_left){
+            if (!janitor_acquire(janitor)) return NULL;
+            int64_t started = monotonic_ms();
+            int ok = 1;
+            if (!files_done || chunks_left) ok = gc_step(ctx, batch, &files_done, &chunks_left);
+            else {
+                ok = fz_blob_store_scrub(ctx, batch, &scrub_left);
+                if (ok && !scrub_left) ok = fz_blob_store_repack(ctx, 0, NULL);
+            }
+            janitor_release(janitor);
+            if (!ok) {
+                fz_log(FZ_WARNING, "Janitor sweep failed, retrying in %lus", interval);
+                break;
+            }
+            if (!janitor_sleep(janitor, (monotonic_ms() - started) * (int64_t)(100 - duty) / (int64_t)duty)) return NULL;
+        }
+        if (!janitor_sleep(janitor, (int64_t)interval * 1000)) return NULL;
     }
+}
+
+
+/* Waits until no transfer is active and claims the next step. Returns 0 when the janitor is stopping */
+static int janitor_acquire(fz_janitor_t *janitor){
+    pthread_mutex_lock(&janitor->mtx);
+    while (!janitor->stop && 0 < janitor->active_transfers) pthread_cond_wait(&janitor->cv, &janitor->mtx);
+    int proceed = !janitor->stop;
+    if (proceed) janitor->busy = 1;
+    pthread_mutex_unlock(&janitor->mtx);
+    return proceed;
+}
+
+
+static void janitor_release(fz_janitor_t *janitor){
+    pthread_mutex_lock(&janitor->mtx);
+    janitor->busy = 0;
+    pthread_cond_broadcast(&janitor->cv);
+    pthread_mutex_unlock(&janitor->mtx);
+}
+
+
+/* Idles for `ms` milliseconds, returns 0 early when the janitor is stopping */
+static int janitor_sleep(fz_janitor_t *janitor, int64_t ms){
+    int64_t deadline = monotonic_ms() + ms;
+    struct timespec until = {.tv_sec = deadline / 1000, .tv_nsec = (deadline % 1000) * 1000000};
+    pthread_mutex_lock(&janitor->mtx);
+    /* Pause and resume broadcast on the same condition, keep waiting until the deadline */
+    while (!janitor->stop && monotonic_ms() < deadline) pthread_cond_timedwait(&janitor->cv, &janitor->mtx, &until);
+    int proceed = !janitor->stop;
+    pthread_mutex_unlock(&janitor->mtx);
+    return proceed;
+}
+
+
+/* One bounded unit of garbage collection: applies watched file changes, checks the next slice of recorded files until the scan wrapped, then collects a batch of chunks */
+static int gc_step(fz_ctx_t *ctx, size_t batch, int *files_done, int *chunks_left){
+    if (!fz_watcher_poll(ctx, NULL)) {
+        fz_log(FZ_ERROR, "Could not apply file change events");
+        return 0;
+    }
+    if (!*files_done && !check_files(ctx, batch, files_done)) {
+        fz_log(FZ_ERROR, "Could not check recorded files");
+        return 0;
+    }
+    if (!collect_chunks(ctx, batch, chunks_left)) {
+        fz_log(FZ_ERROR, "Could not collect unreferenced chunks");
+        return 0;
+    }
+    return 1;
+}
+
+
+/* Stats the next `batch` distinct files of the chunk table, a file that is gone releases its chunks. `*done` is set once the scan wrapped around */
+static int check_files(fz_ctx_t *ctx, size_t batch, int *done){
+    int result = 1;
+    char *cursor = NULL;
+    char **file_paths = NULL;
+    int *gone = NULL;
+    char **gone_paths = NULL;
+
+    if (!fz_query_meta_text(ctx, FZ_META_JANITOR_CURSOR, &cursor)) RETURN_DEFER(0);
+    if (!fz_query_chunk_files(ctx, cursor, batch, &file_paths)) RETURN_DEFER(0);
+    if (0 < arrlenu(file_paths)) {
+        gone = calloc(arrlenu(file_paths), sizeof(int));
+        if (NULL == gone) RETURN_DEFER(0);
+        stat_files(ctx, file_paths, gone);
+    }
+    for (size_t i = 0; i < arrlenu(file_paths); i++){
+        if (!gone[i]) continue;
+        fz_log(FZ_INFO, "File %s is no longer available", file_paths[i]);
+        arrput(gone_paths, file_paths[i]);
+    }
+    if (!fz_commit_file_removals(ctx, (const char **)gone_paths, arrlenu(gone_paths), NULL)) RETURN_DEFER(0);
+    *done = arrlenu(file_paths) < batch;
+    if (!fz_commit_meta_text(ctx, FZ_META_JANITOR_CURSOR, *done? "" : file_paths[arrlenu(file_paths) - 1])) RETURN_DEFER(0);
     defer:
-        if (NULL != unused_checksum) free(unused_checksum);
-        if (NULL != temp_buffer) free(temp_buffer);
+        for (size_t i = 0; i < arrlenu(file_paths); i++) free(file_paths[i]);
+        if (NULL != file_paths) arrfree(file_paths);
+        if (NULL != gone) free(gone);
+        if (NULL != gone_paths) arrfree(gone_paths);
+        if (NULL != cursor) free(cursor);
         return result;
-}
\ No newline at end of file
+}
+
+
+/* Sets `gone[i]` for every file that no longer exists. Stats block on cold metadata, so large batches are spread over up to `max_threads` workers */
+static void stat_files(fz_ctx_t *ctx, char **file_paths, int *gone){
+    size_t next_file = 0;
+    size_t nthreads = arrlenu(file_paths) / STAT_FILES_PER_THREAD;
+    pthread_t *threads = NULL;
+    pthread_mutex_t mtx;
+
+    pthread_mutex_init(&mtx, NULL);
+    struct stat_thread_arg arg = {.file_paths = file_paths, .gone = gone, .next_file = &next_file, .mtx = &mtx};
+    if (nthreads > ctx->max_threads) nthreads = ctx->max_threads;
+    if (1 < nthreads) threads = calloc(nthreads, sizeof(pthread_t));
+    size_t spawned = 0;
+    if (NULL != threads){
+        for (; spawned < nthreads; spawned++){
+            if (0 != pthread_create(&threads[spawned], NULL, stat_worker, &arg)) break;
+        }
+    }
+    /* The calling thread works through the batch as well, on its own if no worker could be started */
+    stat_worker(&arg);
+    for (size_t i = 0; i < spawned; i++) pthread_join(threads[i], NULL);
+    if (NULL != threads) free(threads);
+    pthread_mutex_destroy(&mtx);
+}
+
+
+static void *stat_worker(void *arg){
+    struct stat_thread_arg *t_arg = (struct stat_thread_arg *)arg;
+    while (1){
+        pthread_mutex_lock(t_arg->mtx);
+        size_t i = (*t_arg->next_file)++;
+        pthread_mutex_unlock(t_arg->mtx);
+        if (i >= arrlenu(t_arg->file_paths)) break;
+
+        /* A parent directory replaced by a file makes the path unreachable just like a removed file. Other errors keep the row */
+        struct stat file_meta = {0};
+        t_arg->gone[i] = 0 != stat(t_arg->file_paths[i], &file_meta) && (ENOENT == errno || ENOTDIR == errno);
+    }
+    return NULL;
+}
+
+
+/* Deletes the blobs of up to `batch` unreferenced chunks. Their blob state is made durable before the reference rows go,
+a crash in between leaves rows that the next run collects again */
+static int collect_chunks(fz_ctx_t *ctx, size_t batch, int *more){
+    int result = 1;
+    fz_hex_digest_t *unreferenced = NULL;
+    size_t removed = 0;
+
+    if (!fz_query_unreferenced_chunks(ctx, batch, &unreferenced)) RETURN_DEFER(0);
+    *more = arrlenu(unreferenced) == batch;
+    if (0 == arrlenu(unreferenced)) RETURN_DEFER(1);
+    for (size_t i = 0; i < arrlenu(unreferenced); i++){
+        /* Chunks that were only ever copied from local files have no blob */
+        if (fz_blob_store_remove(ctx, unreferenced[i])) removed++;
+    }
+    if (!fz_blob_state_flush(ctx)) RETURN_DEFER(0);
+    if (!fz_commit_chunk_collection(ctx, unreferenced, arrlenu(unreferenced))) RETURN_DEFER(0);
+    fz_log(FZ_INFO, "Collected %lu unreferenced chunk(s), %lu held a blob", arrlenu(unreferenced), removed);
+    defer:
+        if (NULL != unreferenced) arrfree(unreferenced);
+        return result;
+}
+
+
+static inline int64_t monotonic_ms(void){
+    struct timespec now = {0};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
@@ -1,51 +1,293 @@
+#include <time.h>
 #include "core.h"
 #include <sys/stat.h>
 
-/* This is a big issue I need to tackle */
+
+#define DB_MMAP_SIZE_DEFAULT MB(256)
+#define DB_CACHE_SIZE_DEFAULT MB(16)
+#define DB_READERS_DEFAULT 4
+/* Checksums are bound as a JSON array of signed decimals, each takes at most 20 bytes plus its separator */
+#define CHECKSUM_ARRAY_BOUND(n) ((n) * 21 + 3)
+
+
+/* Connection the calling thread's queries run on instead of `ctx->db`, see `fz_db_bind` */
+static _Thread_local fz_db_conn_t *bound_conn = NULL;
+
+
+static int release_file_chunks(fz_ctx_t *ctx, const char *file_path, size_t *nrows);
+static int migrate_schema(fz_ctx_t *ctx);
+static int add_columns(fz_ctx_t *ctx, const char *probe_sql, const char *alter_sql);
+static int prepare_cached(fz_ctx_t *ctx, const char *sql, sqlite3_stmt **stmt);
+static int configure(fz_ctx_t *ctx, sqlite3 *db);
+static int open_conn(fz_ctx_t *ctx, fz_db_conn_t *conn, int flags);
+static void read_begin(fz_ctx_t *ctx, fz_db_conn_t **conn);
+static void read_end(fz_ctx_t *ctx, fz_db_conn_t *conn);
+static void close_conn(sqlite3 *db, struct stmt_cache_map_s **stmt_cache);
+static int record_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, const char *dest_file_path);
+static int bump_meta_value(fz_ctx_t *ctx, const char *key, uint64_t *value);
+static inline sqlite3 *conn_db(fz_ctx_t *ctx);
+static inline size_t checksum_array_put(char *array, size_t len, fz_hex_digest_t chunk_checksum);
+static int sqlite_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_t **chunk_buffer, size_t *nchunk, struct missing_chunks_map_s **missing_chunks);
+static int sqlite_commit_group(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs, uint64_t *epoch);
+static int sqlite_remove_files(fz_ctx_t *ctx, const char **file_paths, size_t nfiles, size_t *nrows);
+static int sqlite_list_files(fz_ctx_t *ctx, const char *after, size_t limit, char ***file_paths);
+static int sqlite_unreferenced(fz_ctx_t *ctx, size_t limit, fz_hex_digest_t **checksums);
+static int sqlite_collect(fz_ctx_t *ctx, fz_hex_digest_t *checksums, size_t nchunk);
+static int sqlite_checksums(fz_ctx_t *ctx, fz_hex_digest_t **checksums);
+static int sqlite_chunks_epoch(fz_ctx_t *ctx, uint64_t *epoch);
+
+
+extern int fz_db_configure(fz_ctx_t *ctx){
+    return configure(ctx, ctx->db);
+}
+
+
+/* Applies `db_profile` to a freshly opened connection. A journal mode the database refuses to switch is not fatal, it only costs throughput */
+static int configure(fz_ctx_t *ctx, sqlite3 *db){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    char pragmas[XSMALL_RESERVED];
+    size_t mmap_size = (0 != ctx->ctx_attrs.db_mmap_size)? ctx->ctx_attrs.db_mmap_size : DB_MMAP_SIZE_DEFAULT;
+    size_t cache_size = (0 != ctx->ctx_attrs.db_cache_size)? ctx->ctx_attrs.db_cache_size : DB_CACHE_SIZE_DEFAULT;
+
+    if (FZ_DB_DURABLE & ctx->db_profile) {
+        if (SQLITE_OK != sqlite3_exec(db, "PRAGMA synchronous = FULL;", NULL, NULL, NULL)) RETURN_DEFER(0);
+        RETURN_DEFER(1);
+    }
+    if (SQLITE_OK != sqlite3_prepare_v2(db, "PRAGMA journal_mode = WAL;", -1, &stmt, NULL)) RETURN_DEFER(0);
+    if (SQLITE_ROW != sqlite3_step(stmt) || 0 != strcmp("wal", (const char *)sqlite3_column_text(stmt, 0))) {
+        fz_log(FZ_WARNING, "Database stays in its current journal mode: %s", sqlite3_errmsg(db));
+    }
+    /* cache_size takes KiB when negative */
+    snprintf(pragmas, sizeof(pragmas),
+        "PRAGMA synchronous = NORMAL;"
+        "PRAGMA temp_store = MEMORY;"
+        "PRAGMA mmap_size = %lu;"
+        "PRAGMA cache_size = -%lu;", mmap_size, cache_size / 1024);
+    if (SQLITE_OK != sqlite3_exec(db, pragmas, NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to tune the database: %s", sqlite3_errmsg(db));
+        RETURN_DEFER(0);
+    }
+    defer:
+        if (NULL != stmt) sqlite3_finalize(stmt);
+        return result;
+}
+
+
+/* Makes every commit so far durable. With synchronous=NORMAL a WAL commit may be lost on power failure, so this runs before
+snapshots that name an epoch are written, an epoch reused after such a loss would otherwise validate a snapshot of other content */
+extern int fz_db_sync(fz_ctx_t *ctx){
+    if (FZ_DB_DURABLE & ctx->db_profile) return 1;
+    return SQLITE_OK == sqlite3_wal_checkpoint_v2(ctx->db, NULL, SQLITE_CHECKPOINT_FULL, NULL, NULL);
+}
+
+
+extern void fz_db_close(fz_ctx_t *ctx){
+    close_conn(ctx->db, &ctx->stmt_cache);
+    ctx->db = NULL;
+}
+
+
+/* Opens another connection to the database of `ctx` with the same profile. It has its own transactions and statement cache,
+a thread that binds it commits without interleaving with whatever runs on `ctx->db` */
+extern int fz_db_conn_open(fz_ctx_t *ctx, fz_db_conn_t *conn){
+    return open_conn(ctx, conn, SQLITE_OPEN_READWRITE);
+}
+
+
+static int open_conn(fz_ctx_t *ctx, fz_db_conn_t *conn, int flags){
+    memset(conn, 0, sizeof(*conn));
+    const char *db_file = sqlite3_db_filename(ctx->db, "main");
+    if (NULL == db_file || '\0' == db_file[0] || SQLITE_OK != sqlite3_open_v2(db_file, &conn->db, flags, NULL)) {
+        fz_log(FZ_ERROR, "Unable to open another database connection: %s", (NULL != conn->db)? sqlite3_errmsg(conn->db) : "no database file");
+        fz_db_conn_close(conn);
+        return 0;
+    }
+    sqlite3_busy_timeout(conn->db, FZ_DB_BUSY_TIMEOUT_MS);
+    if (!configure(ctx, conn->db)) {
+        fz_db_conn_close(conn);
+        return 0;
+    }
+    return 1;
+}
+
+
+extern void fz_db_conn_close(fz_db_conn_t *conn){
+    close_conn(conn->db, &conn->stmt_cache);
+    conn->db = NULL;
+}
+
+
+/* Query functions called from this thread run on `conn` until it is unbound with NULL */
+extern void fz_db_bind(fz_db_conn_t *conn){
+    bound_conn = conn;
+}
+
+
+extern void fz_db_pool_init(fz_ctx_t *ctx){
+    fz_db_pool_t *pool = &ctx->db_pool;
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->mtx, NULL);
+    pthread_cond_init(&pool->cv, NULL);
+}
+
+
+extern void fz_db_pool_destroy(fz_ctx_t *ctx){
+    fz_db_pool_t *pool = &ctx->db_pool;
+    for (size_t i = 0; i < pool->nopen; i++) fz_db_conn_close(&pool->conns[i]);
+    if (NULL != pool->conns) free(pool->conns);
+    if (NULL != pool->idle) arrfree(pool->idle);
+    pthread_mutex_destroy(&pool->mtx);
+    pthread_cond_destroy(&pool->cv);
+}
+
+
+/* Hands out an idle connection, opens another while fewer than `db_readers` exist and waits otherwise. A connection is opened
+outside the pool lock, the slot is reserved first so concurrent callers never open more than the limit */
+extern int fz_db_read_acquire(fz_ctx_t *ctx, fz_db_conn_t **conn){
+    fz_db_pool_t *pool = &ctx->db_pool;
+    pthread_mutex_lock(&pool->mtx);
+    if (NULL == pool->conns) {
+        pool->max = (0 != ctx->ctx_attrs.db_readers)? ctx->ctx_attrs.db_readers : DB_READERS_DEFAULT;
+        pool->conns = calloc(pool->max, sizeof(fz_db_conn_t));
+        if (NULL == pool->conns) pool->failed = 1;
+    }
+    while (!pool->failed && 0 == arrlenu(pool->idle) && pool->nopen >= pool->max) pthread_cond_wait(&pool->cv, &pool->mtx);
+    if (pool->failed) {
+        pthread_mutex_unlock(&pool->mtx);
+        return 0;
+    }
+    if (0 < arrlenu(pool->idle)) {
+        *conn = &pool->conns[arrpop(pool->idle)];
+        pthread_mutex_unlock(&pool->mtx);
+        return 1;
+    }
+    size_t slot = pool->nopen++;
+    pthread_mutex_unlock(&pool->mtx);
+
+    int ok = open_conn(ctx, &pool->conns[slot], SQLITE_OPEN_READONLY);
+    pthread_mutex_lock(&pool->mtx);
+    if (!ok) {
+        /* Without a database file of its own there is nothing to share, lookups stay on the calling thread's connection */
+        pool->nopen--;
+        pool->failed = 1;
+        pthread_cond_broadcast(&pool->cv);
+    }
+    pthread_mutex_unlock(&pool->mtx);
+    if (ok) *conn = &pool->conns[slot];
+    return ok;
+}
+
+
+extern void fz_db_read_release(fz_ctx_t *ctx, fz_db_conn_t *conn){
+    fz_db_pool_t *pool = &ctx->db_pool;
+    pthread_mutex_lock(&pool->mtx);
+    arrput(pool->idle, (size_t)(conn - pool->conns));
+    pthread_cond_signal(&pool->cv);
+    pthread_mutex_unlock(&pool->mtx);
+}
+
+
+/* Runs the calling thread's lookups on a pooled reader unless it already bound a connection of its own. `*conn` is NULL when
+nothing was acquired, the lookups then run where they would have without the pool. A failed pool is noticed under its lock */
+static void read_begin(fz_ctx_t *ctx, fz_db_conn_t **conn){
+    *conn = NULL;
+    if (NULL != bound_conn) return;
+    if (fz_db_read_acquire(ctx, conn)) fz_db_bind(*conn);
+}
+
+
+static void read_end(fz_ctx_t *ctx, fz_db_conn_t *conn){
+    if (NULL == conn) return;
+    fz_db_bind(NULL);
+    fz_db_read_release(ctx, conn);
+}
+
+
+static void close_conn(sqlite3 *db, struct stmt_cache_map_s **stmt_cache){
+    for (size_t i = 0; i < hmlenu(*stmt_cache); i++) sqlite3_finalize((*stmt_cache)[i].value);
+    if (NULL != *stmt_cache) hmfree(*stmt_cache);
+    if (NULL != db) sqlite3_close(db);
+}
+
+
+static inline sqlite3 *conn_db(fz_ctx_t *ctx){
+    return (NULL != bound_conn)? bound_conn->db : ctx->db;
+}
+
+
+/* Statements are prepared once per connection and kept, keyed by the address of their SQL literal. The caller resets the statement
+when done instead of finalizing it. Like the connection, a statement is only used by one thread at a time */
+static int prepare_cached(fz_ctx_t *ctx, const char *sql, sqlite3_stmt **stmt){
+    struct stmt_cache_map_s **stmt_cache = (NULL != bound_conn)? &bound_conn->stmt_cache : &ctx->stmt_cache;
+    struct stmt_cache_map_s *cached = hmgetp_null(*stmt_cache, sql);
+    if (NULL != cached) {
+        sqlite3_reset(cached->value);
+        sqlite3_clear_bindings(cached->value);
+        *stmt = cached->value;
+        return SQLITE_OK;
+    }
+    int ret = sqlite3_prepare_v3(conn_db(ctx), sql, -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL);
+    if (SQLITE_OK != ret) return ret;
+    hmput(*stmt_cache, sql, *stmt);
+    return SQLITE_OK;
+}
+
+
+/* Appends `chunk_checksum` to a JSON array opened at `array[0]`, signed so SQLite compares it with the stored INTEGER */
+static inline size_t checksum_array_put(char *array, size_t len, fz_hex_digest_t chunk_checksum){
+    return len + (size_t)sprintf(array + len, (1 < len)? ",%lld" : "%lld", (long long)(int64_t)chunk_checksum);
+}
+
+
 extern int fz_query_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_t **chunk_buffer, size_t *nchunk, struct missing_chunks_map_s **missing_chunks){
+    return ctx->meta_ops->required_chunk_list(ctx, mnfst, chunk_buffer, nchunk, missing_chunks);
+}
+
+
+/* Looks up every missing chunk the presence filter does not rule out in one statement: the checksums are bound as a JSON array
+and `json_each` drives a seek into the location key per checksum, no temp table or per chunk insert is involved */
+static int sqlite_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_chunk_t **chunk_buffer, size_t *nchunk, struct missing_chunks_map_s **missing_chunks){
     int result = 1;
     fz_chunk_t *buffer = NULL;
     size_t local_nchunk = 0;
-    sqlite3_stmt *insert = NULL;
     sqlite3_stmt *stmt = NULL;
+    fz_db_conn_t *reader = NULL;
+    char *checksums = NULL;
+    size_t nkeys = 0;
     int ret;
 
-    /* SQL templates */
-    const char *create_tbl_sql = "CREATE TEMP TABLE IF NOT EXISTS temp_manifest_chunks (chunk_checksum INTEGER);";
-    const char *insert_sql = "INSERT INTO temp_manifest_chunks (chunk_checksum) VALUES (?);";
-    const char *clear_temp_sql = "DELETE FROM temp_manifest_chunks;";
+    /* CROSS JOIN keeps the array as the outer loop */
     const char *sql =
-        "SELECT f.id, f.chunk_checksum, f.cutpoint, f.chunk_size, f.file_path "
-        "FROM filezap_chunks AS f "
-        "JOIN temp_manifest_chunks t ON f.chunk_checksum = t.chunk_checksum;";
-
-    ret = sqlite3_exec(ctx->db, create_tbl_sql, 0, NULL, NULL);
-    if (SQLITE_OK != ret) {
-        fz_log(FZ_INFO, "Something went wrong while creating temporary table");
-        RETURN_DEFER(0);
-    }
+        "SELECT l.file_id, l.chunk_checksum, l.cutpoint, l.chunk_size, f.file_path "
+        "FROM json_each(?1) AS j "
+        "CROSS JOIN filezap_chunk_locs AS l ON l.chunk_checksum = j.value "
+        "JOIN filezap_files AS f ON f.file_id = l.file_id;";
 
-    ret = sqlite3_exec(ctx->db, clear_temp_sql, NULL, NULL, NULL);
-    if (SQLITE_OK != ret) {
-        fz_log(FZ_INFO, "Failed to clear temp table: %s", sqlite3_errmsg(ctx->db));
-        RETURN_DEFER(0);
+    checksums = malloc(CHECKSUM_ARRAY_BOUND(hmlenu(*missing_chunks)));
+    if (NULL == checksums) RETURN_DEFER(0);
+    size_t len = 0;
+    checksums[len++] = '[';
+    for (size_t i = 0; i < hmlenu(*missing_chunks); i++){
+        fz_hex_digest_t key = (*missing_chunks)[i].key;
+        if (1 != (*missing_chunks)[i].value || !fz_chunk_filter_may_contain(ctx, key)) continue;
+        len = checksum_array_put(checksums, len, key);
+        nkeys++;
     }
+    checksums[len++] = ']';
 
-    sqlite3_prepare_v2(ctx->db, insert_sql, -1, &insert, NULL);
-    for (size_t i = 0; i < mnfst->chunk_seq.chunk_seq_len; i++){
-        if (0 == hmget(*missing_chunks, mnfst->chunk_seq.chunk_checksum[i])) continue;
-        else {
-            sqlite3_bind_int64(insert, 1, mnfst->chunk_seq.chunk_checksum[i]);
-            sqlite3_step(insert);
-            sqlite3_reset(insert);
-        }
+    buffer = calloc(mnfst->chunk_seq.chunk_seq_len, sizeof(fz_chunk_t));
+    if (NULL == buffer) RETURN_DEFER(0);
+    if (0 == nkeys) {
+        *nchunk = 0;
+        *chunk_buffer = buffer;
+        RETURN_DEFER(1);
     }
-
-    ret = sqlite3_prepare_v2(ctx->db, sql, -1, &stmt, NULL);
+    read_begin(ctx, &reader);
+    ret = prepare_cached(ctx, sql, &stmt);
     if (SQLITE_OK != ret) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, checksums, (int)len, SQLITE_STATIC);
 
-    buffer = calloc(mnfst->chunk_seq.chunk_seq_len, sizeof(fz_chunk_t));
-    if (NULL == buffer) RETURN_DEFER(0);
     size_t max_alloc = mnfst->chunk_seq.chunk_seq_len;
     /* I need to fix this part */
     while (SQLITE_ROW == (ret = sqlite3_step(stmt))){
@@ -74,8 +316,9 @@ extern int fz_query_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst
     *chunk_buffer = buffer;
     fz_log(FZ_INFO, "Found chunk size: %lu", local_nchunk);
     defer:
-        if (NULL != insert) sqlite3_finalize(insert);
-        if (NULL != stmt) sqlite3_finalize(stmt);
+        if (NULL != stmt) sqlite3_reset(stmt);
+        read_end(ctx, reader);
+        if (NULL != checksums) free(checksums);
         if (!result && NULL != buffer) {
             for (size_t i = 0; i < local_nchunk; i++){
                 if (NULL != buffer[i].src_file_path) {free((char *)buffer[i].src_file_path); buffer[i].src_file_path = NULL;}
@@ -86,171 +329,864 @@ extern int fz_query_required_chunk_list(fz_ctx_t *ctx, fz_file_manifest_t *mnfst
 }
 
 
-extern int fz_commit_chunk_metadata(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, char *dest_file_path){
+/* Epochs in `filezap_meta` move inside the transaction that changes their table.
+They start at a random value so a snapshot taken before the database was reset never matches the new tables */
+#define BUMP_META_VALUE_SQL \
+    "INSERT INTO filezap_meta (key, value) VALUES (?, (random() & 281474976710655) + 1) "\
+    "ON CONFLICT(key) DO UPDATE SET value = value + 1 RETURNING value;"
+
+extern int fz_commit_chunk_metadata(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, char *dest_file_path, uint64_t *epoch){
+    fz_meta_job_t job = {.mnfst = *mnfst, .dest_file_path = dest_file_path};
+    return fz_commit_chunk_metadata_group(ctx, &job, 1, epoch);
+}
+
+
+extern int fz_commit_chunk_metadata_group(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs, uint64_t *epoch){
+    return ctx->meta_ops->commit_group(ctx, jobs, njobs, epoch);
+}
+
+
+/* Records the files of `njobs` jobs in one transaction that moves the chunk table epoch once. A later job for the same
+path replaces the rows of an earlier one like a separate commit would */
+static int sqlite_commit_group(fz_ctx_t *ctx, fz_meta_job_t *jobs, size_t njobs, uint64_t *epoch){
+    int result = 1;
+
+    fz_log(FZ_INFO, "Committing chunk metadata of %lu file(s)", njobs);
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "BEGIN IMMEDIATE;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to begin chunk metadata commit: %s", sqlite3_errmsg(conn_db(ctx)));
+        return 0;
+    }
+    for (size_t i = 0; i < njobs; i++){
+        if (!record_file(ctx, &jobs[i].mnfst, jobs[i].dest_file_path)) RETURN_DEFER(0);
+    }
+    if (!bump_meta_value(ctx, FZ_META_CHUNKS_EPOCH, epoch)) RETURN_DEFER(0);
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "COMMIT;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to commit chunk metadata: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    fz_log(FZ_INFO, "Chunk metadata committed successfully");
+    defer:
+        if (!result) sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+        return result;
+}
+
+
+/* Moves the epoch named `key`, in the caller's transaction if one is open */
+static int bump_meta_value(fz_ctx_t *ctx, const char *key, uint64_t *value){
+    sqlite3_stmt *bump = NULL;
+    if (SQLITE_OK != prepare_cached(ctx, BUMP_META_VALUE_SQL, &bump)) return 0;
+    sqlite3_bind_text(bump, 1, key, -1, SQLITE_STATIC);
+    int ok = SQLITE_ROW == sqlite3_step(bump);
+    if (ok) *value = (uint64_t)sqlite3_column_int64(bump, 0);
+    else fz_log(FZ_ERROR, "Failed to bump epoch `%s`: %s", key, sqlite3_errmsg(conn_db(ctx)));
+    sqlite3_reset(bump);
+    return ok;
+}
+
+
+/* Replaces the chunk rows of `dest_file_path` with those of `mnfst` and counts their references. Caller runs it inside a transaction */
+static int record_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, const char *dest_file_path){
     int result = 1;
-    int ret;
     sqlite3_stmt *insert = NULL;
+    sqlite3_stmt *reference = NULL;
+    sqlite3_stmt *add_file = NULL;
     struct{fz_hex_digest_t key; uint8_t value;} *seen_chunk_map = NULL;
-    const char *temp_table = 
-        "CREATE TEMP TABLE temp_filezap_chunks("
-            "id INTEGER PRIMARY KEY AUTOINCREMENT,"
-            "chunk_checksum INTEGER NOT NULL,"
-            "cutpoint INTEGER NOT NULL,"
-            "chunk_size INTEGER NOT NULL,"
-            "file_path TEXT NOT NULL"
-        ");";
-    const char *insert_into_temp_filezap = "INSERT INTO temp_filezap_chunks (chunk_checksum, cutpoint, chunk_size, file_path) VALUES (?,?,?,?);";
-    const char *unique_entries = 
-        "CREATE TEMP TABLE unique_filezap_chunks AS "
-        "SELECT t.chunk_checksum, t.cutpoint, t.chunk_size, t.file_path FROM temp_filezap_chunks AS t "
-        "EXCEPT "
-        "SELECT f.chunk_checksum, f.cutpoint, f.chunk_size, f.file_path FROM filezap_chunks AS f "
-        ";";
-    const char *insert_into_filezap = 
-        "INSERT INTO filezap_chunks (chunk_checksum, cutpoint, chunk_size, file_path) "
-        "SELECT t.chunk_checksum, t.cutpoint, t.chunk_size, t.file_path FROM unique_filezap_chunks AS t "
-        ";";
-
-    fz_log(FZ_INFO, "Committing chunk metadata");
-    sqlite3_exec(ctx->db, "BEGIN TRANSACTION;", NULL, NULL, NULL);
-    ret = sqlite3_exec(ctx->db, temp_table, NULL, NULL, NULL);
-    if (SQLITE_OK != ret) {
-        fz_log(FZ_INFO, "Something went wrong while creating temporary table `temp_filezap_chunks`");
+    sqlite3_int64 file_id = 0;
+    const char *add_file_sql = "INSERT INTO filezap_files (file_path) VALUES (?) RETURNING file_id;";
+    /* The location key is the uniqueness check, the cost of a commit follows the file's chunks and not the size of the table */
+    const char *insert_sql =
+        "INSERT INTO filezap_chunk_locs (chunk_checksum, file_id, cutpoint, chunk_size) VALUES (?,?,?,?) "
+        "ON CONFLICT(chunk_checksum, file_id, cutpoint) DO NOTHING;";
+    const char *reference_sql =
+        "INSERT INTO filezap_chunk_refs (chunk_checksum, refcount) "
+        "SELECT chunk_checksum, COUNT(*) FROM filezap_chunk_locs WHERE file_id = ?1 GROUP BY chunk_checksum "
+        "ON CONFLICT(chunk_checksum) DO UPDATE SET refcount = refcount + excluded.refcount, zero_since = NULL;";
+
+    /* The file at `dest_file_path` was replaced, the chunks of its previous content lose their reference */
+    if (!release_file_chunks(ctx, dest_file_path, NULL)) RETURN_DEFER(0);
+    if (SQLITE_OK != prepare_cached(ctx, add_file_sql, &add_file)) RETURN_DEFER(0);
+    sqlite3_bind_text(add_file, 1, dest_file_path, -1, SQLITE_STATIC);
+    if (SQLITE_ROW != sqlite3_step(add_file)) {
+        fz_log(FZ_ERROR, "Failed to record file `%s`: %s", dest_file_path, sqlite3_errmsg(conn_db(ctx)));
         RETURN_DEFER(0);
     }
+    file_id = sqlite3_column_int64(add_file, 0);
+    sqlite3_reset(add_file);
+
     hmdefault(seen_chunk_map, 0);
-    sqlite3_prepare_v2(ctx->db, insert_into_temp_filezap, -1, &insert, NULL);
+    if (SQLITE_OK != prepare_cached(ctx, insert_sql, &insert)) RETURN_DEFER(0);
+    sqlite3_bind_int64(insert, 2, file_id);
     for (size_t i = 0; i < mnfst->chunk_seq.chunk_seq_len; i++){
         if (1 == hmget(seen_chunk_map, mnfst->chunk_seq.chunk_checksum[i])) continue;
         sqlite3_bind_int64(insert, 1, mnfst->chunk_seq.chunk_checksum[i]);
-        sqlite3_bind_int64(insert, 2, mnfst->chunk_seq.cutpoint[i]);
-        sqlite3_bind_int64(insert, 3, mnfst->chunk_seq.chunk_size[i]);
-        sqlite3_bind_text(insert, 4, dest_file_path, -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64(insert, 3, mnfst->chunk_seq.cutpoint[i]);
+        sqlite3_bind_int64(insert, 4, mnfst->chunk_seq.chunk_size[i]);
         if (SQLITE_DONE != sqlite3_step(insert)) {
-            fz_log(FZ_ERROR, "Insert failed for chunk %zu: %s", i, sqlite3_errmsg(ctx->db));
-            sqlite3_exec(ctx->db, "ROLLBACK;", NULL, NULL, NULL);
+            fz_log(FZ_ERROR, "Insert failed for chunk %zu: %s", i, sqlite3_errmsg(conn_db(ctx)));
             RETURN_DEFER(0);
         }
         sqlite3_reset(insert);
         hmput(seen_chunk_map, mnfst->chunk_seq.chunk_checksum[i], 1);
     }
-    ret = sqlite3_exec(ctx->db, unique_entries, NULL, NULL, NULL);
-    if (SQLITE_OK != ret) {
-        fz_log(FZ_INFO, "Something went wrong while creating unique entries table `filezap_chunks`");
-        sqlite3_exec(ctx->db, "ROLLBACK;", NULL, NULL, NULL);
+    if (SQLITE_OK != prepare_cached(ctx, reference_sql, &reference)) RETURN_DEFER(0);
+    sqlite3_bind_int64(reference, 1, file_id);
+    if (SQLITE_DONE != sqlite3_step(reference)) {
+        fz_log(FZ_ERROR, "Failed to count chunk references: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    defer:
+        if (NULL != insert) sqlite3_reset(insert);
+        if (NULL != reference) sqlite3_reset(reference);
+        if (NULL != add_file) sqlite3_reset(add_file);
+        if (NULL != seen_chunk_map) hmfree(seen_chunk_map);
+        return result;
+}
+
+
+/* Drops the chunk rows recorded for `file_path` with the file itself and releases the references they held, chunks left without one
+become collectable. Caller runs it inside a transaction. `*nrows`, if given, receives the number of rows dropped */
+static int release_file_chunks(fz_ctx_t *ctx, const char *file_path, size_t *nrows){
+    int result = 1;
+    sqlite3_stmt *release = NULL;
+    sqlite3_stmt *delete = NULL;
+    sqlite3_stmt *delete_file = NULL;
+    const char *release_sql =
+        "UPDATE filezap_chunk_refs SET "
+            "refcount = refcount - r.n, "
+            "zero_since = CASE WHEN refcount - r.n <= 0 THEN ?2 ELSE NULL END "
+        "FROM ("
+            "SELECT l.chunk_checksum, COUNT(*) AS n FROM filezap_files AS f "
+            "JOIN filezap_chunk_locs AS l ON l.file_id = f.file_id WHERE f.file_path = ?1 GROUP BY l.chunk_checksum"
+        ") AS r "
+        "WHERE filezap_chunk_refs.chunk_checksum = r.chunk_checksum;";
+    const char *delete_sql = "DELETE FROM filezap_chunk_locs WHERE file_id = (SELECT file_id FROM filezap_files WHERE file_path = ?1);";
+    const char *delete_file_sql = "DELETE FROM filezap_files WHERE file_path = ?1;";
+
+    if (SQLITE_OK != prepare_cached(ctx, release_sql, &release)) RETURN_DEFER(0);
+    if (SQLITE_OK != prepare_cached(ctx, delete_sql, &delete)) RETURN_DEFER(0);
+    if (SQLITE_OK != prepare_cached(ctx, delete_file_sql, &delete_file)) RETURN_DEFER(0);
+    sqlite3_bind_text(release, 1, file_path, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(release, 2, (sqlite3_int64)time(NULL));
+    sqlite3_bind_text(delete, 1, file_path, -1, SQLITE_STATIC);
+    sqlite3_bind_text(delete_file, 1, file_path, -1, SQLITE_STATIC);
+    if (SQLITE_DONE != sqlite3_step(release) || SQLITE_DONE != sqlite3_step(delete)) {
+        fz_log(FZ_ERROR, "Failed to release chunks of `%s`: %s", file_path, sqlite3_errmsg(conn_db(ctx)));
         RETURN_DEFER(0);
     }
-    ret = sqlite3_exec(ctx->db, insert_into_filezap, NULL, NULL, NULL);
-    if (SQLITE_OK != ret) {
-        fz_log(FZ_INFO, "Something went wrong while inserting chunk metadata into `filezap_chunks`");
-        sqlite3_exec(ctx->db, "ROLLBACK;", NULL, NULL, NULL);
+    if (NULL != nrows) *nrows = (size_t)sqlite3_changes(conn_db(ctx));
+    if (SQLITE_DONE != sqlite3_step(delete_file)) {
+        fz_log(FZ_ERROR, "Failed to drop file `%s`: %s", file_path, sqlite3_errmsg(conn_db(ctx)));
         RETURN_DEFER(0);
     }
-    sqlite3_exec(ctx->db, "COMMIT;", NULL, NULL, NULL);
-    fz_log(FZ_INFO, "Chunk metadata committed successfully");
     defer:
-        if (NULL != insert) sqlite3_finalize(insert);
+        if (NULL != release) sqlite3_reset(release);
+        if (NULL != delete) sqlite3_reset(delete);
+        if (NULL != delete_file) sqlite3_reset(delete_file);
         return result;
 }
 
 
-extern int fz_query_unused_chunk(fz_ctx_t *ctx, fz_hex_digest_t **unused_chunk_list, size_t *nchunk){
+extern int fz_commit_file_removal(fz_ctx_t *ctx, const char *file_path, size_t *nrows){
+    return fz_commit_file_removals(ctx, &file_path, 1, nrows);
+}
+
+
+extern int fz_commit_file_removals(fz_ctx_t *ctx, const char **file_paths, size_t nfiles, size_t *nrows){
+    return ctx->meta_ops->remove_files(ctx, file_paths, nfiles, nrows);
+}
+
+
+/* Releases the chunks of every file in one transaction, `*nrows` receives the total number of location rows dropped */
+static int sqlite_remove_files(fz_ctx_t *ctx, const char **file_paths, size_t nfiles, size_t *nrows){
+    int result = 1;
+    size_t total = 0;
+
+    if (0 == nfiles) RETURN_DEFER(1);
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "BEGIN IMMEDIATE;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to begin file removal: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    for (size_t i = 0; i < nfiles; i++){
+        size_t n = 0;
+        if (!release_file_chunks(ctx, file_paths[i], &n)) {
+            sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+            RETURN_DEFER(0);
+        }
+        total += n;
+    }
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "COMMIT;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to commit file removal: %s", sqlite3_errmsg(conn_db(ctx)));
+        sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+        RETURN_DEFER(0);
+    }
+    defer:
+        if (result && NULL != nrows) *nrows = total;
+        return result;
+}
+
+
+extern int fz_query_chunk_files(fz_ctx_t *ctx, const char *after, size_t limit, char ***file_paths){
+    return ctx->meta_ops->list_files(ctx, after, limit, file_paths);
+}
+
+
+static int sqlite_list_files(fz_ctx_t *ctx, const char *after, size_t limit, char ***file_paths){
+    int result = 1;
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "SELECT file_path FROM filezap_files WHERE file_path > ? ORDER BY file_path LIMIT ?;";
+
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, (NULL != after)? after : "", -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)limit);
+    while (SQLITE_ROW == (ret = sqlite3_step(stmt))){
+        char *copy = strdup((const char *)sqlite3_column_text(stmt, 0));
+        if (NULL == copy) RETURN_DEFER(0);
+        arrput(*file_paths, copy);
+    }
+    if (SQLITE_DONE != ret) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+extern int fz_query_unreferenced_chunks(fz_ctx_t *ctx, size_t limit, fz_hex_digest_t **checksums){
+    return ctx->meta_ops->unreferenced(ctx, limit, checksums);
+}
+
+
+static int sqlite_unreferenced(fz_ctx_t *ctx, size_t limit, fz_hex_digest_t **checksums){
     int result = 1;
     int ret;
     sqlite3_stmt *stmt = NULL;
-    struct{fz_hex_digest_t key; uint8_t value;} *chunk_is_ref = NULL;
-    fz_hex_digest_t *buffer = NULL;
-    const char *file_list_sql = "SELECT f.chunk_checksum, f.file_path FROM filezap_chunks AS f;";
-
-    struct {
-        fz_hex_digest_t *digest;
-        char **file_path;
-        // uint8_t *file_not_found;
-    } chunk_checksum_file_path = {0};
-
-    ret = sqlite3_prepare_v2(ctx->db, file_list_sql, -1, &stmt, NULL);
-    if (SQLITE_OK != ret) {
-        fz_log(FZ_ERROR, "Something went wrong here");
+    const char *sql = "SELECT chunk_checksum FROM filezap_chunk_refs WHERE refcount <= 0 ORDER BY zero_since LIMIT ?;";
+
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)limit);
+    while (SQLITE_ROW == (ret = sqlite3_step(stmt))){
+        arrput(*checksums, (fz_hex_digest_t)sqlite3_column_int64(stmt, 0));
+    }
+    if (SQLITE_DONE != ret) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+extern int fz_commit_chunk_collection(fz_ctx_t *ctx, fz_hex_digest_t *checksums, size_t nchunk){
+    return ctx->meta_ops->collect(ctx, checksums, nchunk);
+}
+
+
+/* Drops the reference rows of a whole batch with one statement in one transaction. Chunks that were referenced again since they were selected keep their row */
+static int sqlite_collect(fz_ctx_t *ctx, fz_hex_digest_t *checksums, size_t nchunk){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    char *array = NULL;
+    const char *sql = "DELETE FROM filezap_chunk_refs WHERE chunk_checksum IN (SELECT value FROM json_each(?1)) AND refcount <= 0;";
+
+    if (0 == nchunk) RETURN_DEFER(1);
+    array = malloc(CHECKSUM_ARRAY_BOUND(nchunk));
+    if (NULL == array) RETURN_DEFER(0);
+    size_t len = 0;
+    array[len++] = '[';
+    for (size_t i = 0; i < nchunk; i++) len = checksum_array_put(array, len, checksums[i]);
+    array[len++] = ']';
+
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, array, (int)len, SQLITE_STATIC);
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "BEGIN IMMEDIATE;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to begin chunk collection: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    if (SQLITE_DONE != sqlite3_step(stmt)) {
+        fz_log(FZ_ERROR, "Failed to drop chunk reference rows: %s", sqlite3_errmsg(conn_db(ctx)));
+        sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+        RETURN_DEFER(0);
+    }
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "COMMIT;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to commit chunk collection: %s", sqlite3_errmsg(conn_db(ctx)));
+        sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+        RETURN_DEFER(0);
+    }
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        if (NULL != array) free(array);
+        return result;
+}
+
+
+extern int fz_commit_meta_value(fz_ctx_t *ctx, const char *key, uint64_t value){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "INSERT INTO filezap_meta (key, value) VALUES (?, ?) ON CONFLICT(key) DO UPDATE SET value = excluded.value;";
+
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)value);
+    if (SQLITE_DONE != sqlite3_step(stmt)) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+/* Brings a database created by an older build up to FZ_SCHEMA_VERSION, tracked in `PRAGMA user_version`.
+Version 1 split `filezap_chunks`, which repeated the file path on every row, into `filezap_files` and `filezap_chunk_locs`.
+Sender and receiver may open the database at the same time, the version is checked again under the write lock */
+static int migrate_schema(fz_ctx_t *ctx){
+    int result = 1;
+    int version = 0;
+    int legacy = 0;
+    sqlite3_stmt *stmt = NULL;
+    const char *normalize_sql = 
+        "INSERT OR IGNORE INTO filezap_files (file_path) SELECT DISTINCT file_path FROM filezap_chunks;"
+        "INSERT OR IGNORE INTO filezap_chunk_locs (chunk_checksum, file_id, cutpoint, chunk_size) "
+        "SELECT c.chunk_checksum, f.file_id, c.cutpoint, c.chunk_size FROM filezap_chunks AS c "
+        "JOIN filezap_files AS f ON f.file_path = c.file_path;"
+        "DROP TABLE filezap_chunks;";
+    char version_sql[XXSMALL_RESERVED];
+
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "BEGIN IMMEDIATE;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to lock the database for migration: %s", sqlite3_errmsg(conn_db(ctx)));
+        return 0;
+    }
+    if (SQLITE_OK != sqlite3_prepare_v2(conn_db(ctx), "PRAGMA user_version;", -1, &stmt, NULL) || SQLITE_ROW != sqlite3_step(stmt)) RETURN_DEFER(0);
+    version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+    if (FZ_SCHEMA_VERSION <= version) RETURN_DEFER(1);
+
+    if (SQLITE_OK != sqlite3_prepare_v2(conn_db(ctx), "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'filezap_chunks';", -1, &stmt, NULL)) RETURN_DEFER(0);
+    legacy = SQLITE_ROW == sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    stmt = NULL;
+    if (legacy && SQLITE_OK != sqlite3_exec(conn_db(ctx), normalize_sql, NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to move `filezap_chunks` into `filezap_chunk_locs`: %s", sqlite3_errmsg(conn_db(ctx)));
         RETURN_DEFER(0);
     }
+    snprintf(version_sql, sizeof(version_sql), "PRAGMA user_version = %d;", FZ_SCHEMA_VERSION);
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), version_sql, NULL, NULL, NULL)) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_finalize(stmt);
+        sqlite3_exec(conn_db(ctx), result? "COMMIT;" : "ROLLBACK;", NULL, NULL, NULL);
+        if (result && legacy) {
+            fz_log(FZ_INFO, "Migrated the chunk table to schema version %d", FZ_SCHEMA_VERSION);
+            /* The old table's pages go back to the filesystem */
+            sqlite3_exec(conn_db(ctx), "VACUUM;", NULL, NULL, NULL);
+        }
+        return result;
+}
+
+
+/* Runs `alter_sql` if `probe_sql` does not compile. Processes sharing the database race to add the same columns, the loser
+finds them added when it probes again */
+static int add_columns(fz_ctx_t *ctx, const char *probe_sql, const char *alter_sql){
+    sqlite3_stmt *stmt = NULL;
+    if (SQLITE_OK == sqlite3_prepare_v2(conn_db(ctx), probe_sql, -1, &stmt, NULL)) {
+        sqlite3_finalize(stmt);
+        return 1;
+    }
+    if (SQLITE_OK == sqlite3_exec(conn_db(ctx), alter_sql, NULL, NULL, NULL)) return 1;
+    stmt = NULL;
+    if (SQLITE_OK == sqlite3_prepare_v2(conn_db(ctx), probe_sql, -1, &stmt, NULL)) {
+        sqlite3_finalize(stmt);
+        return 1;
+    }
+    return 0;
+}
+
+
+extern int fz_init_tables(fz_ctx_t *ctx){
+    int result = 1;
+    const char *create_tables_sql = 
+        "CREATE TABLE IF NOT EXISTS filezap_files("
+            "file_id INTEGER PRIMARY KEY,"
+            "file_path TEXT NOT NULL UNIQUE"
+        ");"
+        "CREATE TABLE IF NOT EXISTS filezap_chunk_locs("
+            "chunk_checksum INTEGER NOT NULL,"
+            "file_id INTEGER NOT NULL,"
+            "cutpoint INTEGER NOT NULL,"
+            "chunk_size INTEGER NOT NULL,"
+            "PRIMARY KEY (chunk_checksum, file_id, cutpoint)"
+        ") WITHOUT ROWID;"
+        "CREATE INDEX IF NOT EXISTS filezap_chunk_locs_file ON filezap_chunk_locs(file_id);"
+        "CREATE TABLE IF NOT EXISTS filezap_blob_state("
+            "chunk_checksum INTEGER PRIMARY KEY,"
+            "blob_size INTEGER NOT NULL,"
+            "mtime_ns INTEGER NOT NULL,"
+            "inode INTEGER NOT NULL,"
+            "verified_at INTEGER NOT NULL,"
+            "pack_id INTEGER NOT NULL DEFAULT 0,"
+            "pack_offset INTEGER NOT NULL DEFAULT 0,"
+            "raw_size INTEGER NOT NULL DEFAULT 0"
+        ");"
+        "CREATE TABLE IF NOT EXISTS filezap_meta("
+            "key TEXT PRIMARY KEY,"
+            "value INTEGER NOT NULL"
+        ");"
+        "CREATE TABLE IF NOT EXISTS filezap_meta_text("
+            "key TEXT PRIMARY KEY,"
+            "value TEXT NOT NULL"
+        ");"
+        "CREATE TABLE IF NOT EXISTS filezap_packs("
+            "pack_id INTEGER PRIMARY KEY,"
+            "length INTEGER NOT NULL,"
+            "sealed INTEGER NOT NULL DEFAULT 0"
+        ");"
+        "CREATE TABLE IF NOT EXISTS filezap_fingerprints("
+            "file_path TEXT PRIMARY KEY,"
+            "file_size INTEGER NOT NULL,"
+            "mtime_ns INTEGER NOT NULL,"
+            "ctime_ns INTEGER NOT NULL,"
+            "inode INTEGER NOT NULL,"
+            "chunk_strategy INTEGER NOT NULL,"
+            "chunk_size INTEGER NOT NULL,"
+            "file_checksum INTEGER NOT NULL,"
+            "chunk_root INTEGER NOT NULL,"
+            "chunk_seq BLOB NOT NULL,"
+            "hash_state BLOB"
+        ");";
+    const char *pack_columns_sql = 
+        "ALTER TABLE filezap_blob_state ADD COLUMN pack_id INTEGER NOT NULL DEFAULT 0;"
+        "ALTER TABLE filezap_blob_state ADD COLUMN pack_offset INTEGER NOT NULL DEFAULT 0;";
+    const char *raw_size_column_sql = "ALTER TABLE filezap_blob_state ADD COLUMN raw_size INTEGER NOT NULL DEFAULT 0;";
+    const char *hash_state_column_sql = "ALTER TABLE filezap_fingerprints ADD COLUMN hash_state BLOB;";
+    const char *chunk_refs_sql = 
+        "BEGIN TRANSACTION;"
+        "CREATE TABLE filezap_chunk_refs("
+            "chunk_checksum INTEGER PRIMARY KEY,"
+            "refcount INTEGER NOT NULL,"
+            "zero_since INTEGER"
+        ");"
+        "CREATE INDEX filezap_chunk_refs_unreferenced ON filezap_chunk_refs(zero_since) WHERE refcount <= 0;"
+        "INSERT INTO filezap_chunk_refs (chunk_checksum, refcount) SELECT chunk_checksum, COUNT(*) FROM filezap_chunk_locs GROUP BY chunk_checksum;"
+        "COMMIT;";
+    sqlite3_stmt *stmt = NULL;
+
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), create_tables_sql, NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to create filezap tables: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    /* Blob state tables created before the pack store existed lack the pack columns */
+    if (!add_columns(ctx, "SELECT pack_id FROM filezap_blob_state LIMIT 0;", pack_columns_sql)) {
+        fz_log(FZ_ERROR, "Failed to add pack columns to `filezap_blob_state`: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    /* Every blob stored before compression existed is raw */
+    if (!add_columns(ctx, "SELECT raw_size FROM filezap_blob_state LIMIT 0;", raw_size_column_sql)) {
+        fz_log(FZ_ERROR, "Failed to add the raw size column to `filezap_blob_state`: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    /* Fingerprints recorded without a hash state only allow a full rechunk of their file */
+    if (!add_columns(ctx, "SELECT hash_state FROM filezap_fingerprints LIMIT 0;", hash_state_column_sql)) {
+        fz_log(FZ_ERROR, "Failed to add the hash state column to `filezap_fingerprints`: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    if (!migrate_schema(ctx)) RETURN_DEFER(0);
+    /* Reference counts of a database that predates them are rebuilt once from the chunk locations */
+    if (SQLITE_OK != sqlite3_prepare_v2(conn_db(ctx), "SELECT refcount FROM filezap_chunk_refs LIMIT 0;", -1, &stmt, NULL)) {
+        if (SQLITE_OK != sqlite3_exec(conn_db(ctx), chunk_refs_sql, NULL, NULL, NULL)) {
+            fz_log(FZ_ERROR, "Failed to create `filezap_chunk_refs`: %s", sqlite3_errmsg(conn_db(ctx)));
+            sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+            RETURN_DEFER(0);
+        }
+    }
+    defer:
+        if (NULL != stmt) sqlite3_finalize(stmt);
+        return result;
+}
 
-    size_t max_alloc = RESERVED; // preallocate this memory size
-    size_t local_size = 0;
-    chunk_checksum_file_path.digest = calloc(max_alloc, sizeof(fz_hex_digest_t));
-    chunk_checksum_file_path.file_path = calloc(max_alloc, sizeof(char *));
-    if (NULL == chunk_checksum_file_path.digest || NULL == chunk_checksum_file_path.file_path) RETURN_DEFER(0);
+
+extern int fz_query_blob_state(fz_ctx_t *ctx, fz_chunk_index_t *blob_state){
+    int result = 1;
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "SELECT chunk_checksum, blob_size, mtime_ns, inode, verified_at, pack_id, pack_offset, raw_size FROM filezap_blob_state;";
+
+    ret = prepare_cached(ctx, sql, &stmt);
+    if (SQLITE_OK != ret) RETURN_DEFER(0);
     while (SQLITE_ROW == (ret = sqlite3_step(stmt))){
         fz_hex_digest_t chunk_checksum = (fz_hex_digest_t)sqlite3_column_int64(stmt, 0);
-        char *file_path = (char *)sqlite3_column_text(stmt, 1);
-        if (local_size >= max_alloc) {
-            max_alloc *= 2;
-            chunk_checksum_file_path.digest = calloc(max_alloc, sizeof(fz_hex_digest_t));
-            chunk_checksum_file_path.file_path = calloc(max_alloc, sizeof(char *));
-            if (NULL == chunk_checksum_file_path.digest || NULL == chunk_checksum_file_path.file_path) RETURN_DEFER(0);
-        }
-        chunk_checksum_file_path.digest[local_size] = chunk_checksum;
-        chunk_checksum_file_path.file_path[local_size] = calloc(strlen(file_path) + 1, sizeof(char));
-        if (NULL == chunk_checksum_file_path.file_path[local_size]) RETURN_DEFER(0);
+        fz_blob_state_t state = {
+            .blob_size = (size_t)sqlite3_column_int64(stmt, 1),
+            .mtime_ns = (int64_t)sqlite3_column_int64(stmt, 2),
+            .inode = (uint64_t)sqlite3_column_int64(stmt, 3),
+            .verified_at = (int64_t)sqlite3_column_int64(stmt, 4),
+            .pack_id = (uint32_t)sqlite3_column_int64(stmt, 5),
+            .pack_offset = (size_t)sqlite3_column_int64(stmt, 6),
+            .raw_size = (uint32_t)sqlite3_column_int64(stmt, 7),
+        };
+        if (!fz_chunk_index_put(blob_state, chunk_checksum, &state)) RETURN_DEFER(0);
+    }
+    if (SQLITE_DONE != ret) RETURN_DEFER(0);
+    fz_log(FZ_INFO, "Loaded %lu blob state entries", fz_chunk_index_len(blob_state));
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+/* Cursors live in `filezap_meta_text`, the INTEGER affinity of `filezap_meta` would turn a path such as `123` into a number */
+extern int fz_commit_meta_text(fz_ctx_t *ctx, const char *key, const char *value){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "INSERT INTO filezap_meta_text (key, value) VALUES (?, ?) ON CONFLICT(key) DO UPDATE SET value = excluded.value;";
+
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 2, value, -1, SQLITE_STATIC);
+    if (SQLITE_DONE != sqlite3_step(stmt)) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
 
-        strncat(chunk_checksum_file_path.file_path[local_size], file_path, strlen(file_path));
-        local_size++;
+
+extern int fz_query_meta_text(fz_ctx_t *ctx, const char *key, char **value){
+    int result = 1;
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "SELECT value FROM filezap_meta_text WHERE key = ?;";
+
+    *value = NULL;
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+    ret = sqlite3_step(stmt);
+    if (SQLITE_ROW == ret) {
+        *value = strdup((const char *)sqlite3_column_text(stmt, 0));
+        if (NULL == *value) RETURN_DEFER(0);
+    }
+    else if (SQLITE_DONE != ret) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+extern int fz_query_meta_value(fz_ctx_t *ctx, const char *key, uint64_t *value){
+    int result = 1;
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "SELECT value FROM filezap_meta WHERE key = ?;";
+
+    *value = 0;
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, key, -1, SQLITE_STATIC);
+    ret = sqlite3_step(stmt);
+    if (SQLITE_ROW == ret) *value = (uint64_t)sqlite3_column_int64(stmt, 0);
+    else if (SQLITE_DONE != ret) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+extern int fz_query_chunk_checksums(fz_ctx_t *ctx, fz_hex_digest_t **checksums){
+    return ctx->meta_ops->checksums(ctx, checksums);
+}
+
+
+static int sqlite_checksums(fz_ctx_t *ctx, fz_hex_digest_t **checksums){
+    int result = 1;
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    fz_db_conn_t *reader = NULL;
+    const char *sql = "SELECT DISTINCT chunk_checksum FROM filezap_chunk_locs;";
+
+    read_begin(ctx, &reader);
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    while (SQLITE_ROW == (ret = sqlite3_step(stmt))){
+        arrput(*checksums, (fz_hex_digest_t)sqlite3_column_int64(stmt, 0));
     }
     if (SQLITE_DONE != ret) RETURN_DEFER(0);
-    fz_log(FZ_INFO, "Total number of chunks: %lu", local_size);
-
-    hmdefault(chunk_is_ref, 0);
-    for (size_t i = 0; i < local_size; i++){
-        struct stat file_meta = {0};
-        uint8_t temp_ = hmget(chunk_is_ref, chunk_checksum_file_path.digest[i]);
-        if (0 == stat(chunk_checksum_file_path.file_path[i], &file_meta)){
-            temp_ |= 1;
-            hmput(chunk_is_ref, chunk_checksum_file_path.digest[i], temp_);
-        } else {
-            fz_log(FZ_INFO, "File %s is no longer available", chunk_checksum_file_path.file_path[i]);
-            hmput(chunk_is_ref, chunk_checksum_file_path.digest[i], temp_);
-        }
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        read_end(ctx, reader);
+        return result;
+}
+
+
+extern int fz_query_chunks_epoch(fz_ctx_t *ctx, uint64_t *epoch){
+    return ctx->meta_ops->chunks_epoch(ctx, epoch);
+}
+
+
+static int sqlite_chunks_epoch(fz_ctx_t *ctx, uint64_t *epoch){
+    return fz_query_meta_value(ctx, FZ_META_CHUNKS_EPOCH, epoch);
+}
+
+
+const fz_meta_ops_t fz_meta_sqlite_ops = {
+    .required_chunk_list = sqlite_required_chunk_list,
+    .commit_group = sqlite_commit_group,
+    .remove_files = sqlite_remove_files,
+    .list_files = sqlite_list_files,
+    .unreferenced = sqlite_unreferenced,
+    .collect = sqlite_collect,
+    .checksums = sqlite_checksums,
+    .chunks_epoch = sqlite_chunks_epoch,
+};
+
+
+/* The chunk sequence is stored as one blob of (checksum, cutpoint, size) triples of 64-bit words in host byte order,
+the fingerprint names a file on this host only */
+static int read_fingerprint_manifest(sqlite3_stmt *stmt, int col, const char *file_path, size_t file_size, fz_file_manifest_t *mnfst){
+    int result = 1;
+    fz_chunk_seq_t seq = {0};
+    char *file_name = NULL;
+    const uint64_t *words = (const uint64_t *)sqlite3_column_blob(stmt, col + 2);
+    size_t nbytes = (size_t)sqlite3_column_bytes(stmt, col + 2);
+    if (NULL == words || 0 != nbytes % (3 * sizeof(uint64_t))) RETURN_DEFER(0);
+    seq.chunk_seq_len = nbytes / (3 * sizeof(uint64_t));
+    seq.chunk_checksum = calloc(seq.chunk_seq_len, sizeof(fz_hex_digest_t));
+    seq.cutpoint = calloc(seq.chunk_seq_len, sizeof(size_t));
+    seq.chunk_size = calloc(seq.chunk_seq_len, sizeof(size_t));
+    file_name = strdup(file_path);
+    if (NULL == seq.chunk_checksum || NULL == seq.cutpoint || NULL == seq.chunk_size || NULL == file_name) RETURN_DEFER(0);
+    for (size_t i = 0; i < seq.chunk_seq_len; i++){
+        uint64_t triple[3];
+        memcpy(triple, words + 3 * i, sizeof(triple));
+        seq.chunk_checksum[i] = (fz_hex_digest_t)triple[0];
+        seq.cutpoint[i] = (size_t)triple[1];
+        seq.chunk_size[i] = (size_t)triple[2];
     }
+    mnfst->file_checksum = (fz_hex_digest_t)sqlite3_column_int64(stmt, col);
+    mnfst->chunk_root = (fz_hex_digest_t)sqlite3_column_int64(stmt, col + 1);
+    mnfst->chunk_seq = seq;
+    mnfst->file_name = file_name;
+    mnfst->file_size = file_size;
+    defer:
+        if (!result) {
+            fz_chunk_destroy(&seq);
+            if (NULL != file_name) free(file_name);
+        }
+        return result;
+}
 
-    size_t max_buffer_alloc = local_size;
-    size_t buffer_len = 0;
-    buffer = calloc(max_buffer_alloc, sizeof(fz_hex_digest_t));
-    if (NULL == buffer) RETURN_DEFER(0);
-    for (size_t i = 0; i < hmlenu(chunk_is_ref); i++){
-        if (0 == hmget(chunk_is_ref, chunk_checksum_file_path.digest[i])){
-            buffer[buffer_len] = chunk_checksum_file_path.digest[i];
-            buffer_len++;
+
+extern int fz_query_fingerprint(fz_ctx_t *ctx, const char *file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *mnfst){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    fz_db_conn_t *reader = NULL;
+    const char *sql =
+        "SELECT file_checksum, chunk_root, chunk_seq FROM filezap_fingerprints "
+        "WHERE file_path = ? AND file_size = ? AND mtime_ns = ? AND ctime_ns = ? AND inode = ? AND chunk_strategy = ? AND chunk_size = ?;";
+
+    read_begin(ctx, &reader);
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, file_path, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)fingerprint->file_size);
+    sqlite3_bind_int64(stmt, 3, fingerprint->mtime_ns);
+    sqlite3_bind_int64(stmt, 4, fingerprint->ctime_ns);
+    sqlite3_bind_int64(stmt, 5, (sqlite3_int64)fingerprint->inode);
+    sqlite3_bind_int(stmt, 6, fingerprint->chunk_strategy);
+    sqlite3_bind_int64(stmt, 7, (sqlite3_int64)fingerprint->chunk_size);
+    if (SQLITE_ROW != sqlite3_step(stmt)) RETURN_DEFER(0);
+    if (!read_fingerprint_manifest(stmt, 0, file_path, fingerprint->file_size, mnfst)) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        read_end(ctx, reader);
+        return result;
+}
+
+
+extern int fz_query_last_fingerprint(fz_ctx_t *ctx, const char *file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *mnfst, char **hash_state, size_t *hash_state_size){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    fz_db_conn_t *reader = NULL;
+    const char *sql =
+        "SELECT file_size, mtime_ns, ctime_ns, inode, chunk_strategy, chunk_size, file_checksum, chunk_root, chunk_seq, hash_state "
+        "FROM filezap_fingerprints WHERE file_path = ?;";
+
+    *hash_state = NULL;
+    *hash_state_size = 0;
+    read_begin(ctx, &reader);
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, file_path, -1, SQLITE_STATIC);
+    if (SQLITE_ROW != sqlite3_step(stmt)) RETURN_DEFER(0);
+    *fingerprint = (fz_file_fingerprint_t){
+        .file_size = (size_t)sqlite3_column_int64(stmt, 0),
+        .mtime_ns = sqlite3_column_int64(stmt, 1),
+        .ctime_ns = sqlite3_column_int64(stmt, 2),
+        .inode = (uint64_t)sqlite3_column_int64(stmt, 3),
+        .chunk_strategy = sqlite3_column_int(stmt, 4),
+        .chunk_size = (size_t)sqlite3_column_int64(stmt, 5),
+    };
+    if (!read_fingerprint_manifest(stmt, 6, file_path, fingerprint->file_size, mnfst)) RETURN_DEFER(0);
+    size_t nbytes = (size_t)sqlite3_column_bytes(stmt, 9);
+    if (0 < nbytes) {
+        *hash_state = malloc(nbytes);
+        if (NULL == *hash_state) {
+            fz_file_manifest_destroy(mnfst);
+            RETURN_DEFER(0);
         }
+        memcpy(*hash_state, sqlite3_column_blob(stmt, 9), nbytes);
+        *hash_state_size = nbytes;
     }
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        read_end(ctx, reader);
+        return result;
+}
+
 
-    *unused_chunk_list = buffer;
-    *nchunk = buffer_len;
+extern int fz_commit_fingerprint(fz_ctx_t *ctx, const char *file_path, fz_file_fingerprint_t *fingerprint, fz_file_manifest_t *mnfst, const void *hash_state, size_t hash_state_size){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    uint64_t *words = NULL;
+    size_t nchunk = mnfst->chunk_seq.chunk_seq_len;
+    const char *sql =
+        "INSERT INTO filezap_fingerprints (file_path, file_size, mtime_ns, ctime_ns, inode, chunk_strategy, chunk_size, file_checksum, chunk_root, chunk_seq, hash_state) "
+        "VALUES (?,?,?,?,?,?,?,?,?,?,?) ON CONFLICT(file_path) DO UPDATE SET "
+            "file_size = excluded.file_size, mtime_ns = excluded.mtime_ns, ctime_ns = excluded.ctime_ns, inode = excluded.inode, "
+            "chunk_strategy = excluded.chunk_strategy, chunk_size = excluded.chunk_size, file_checksum = excluded.file_checksum, "
+            "chunk_root = excluded.chunk_root, chunk_seq = excluded.chunk_seq, hash_state = excluded.hash_state;";
+
+    if (0 == nchunk || (size_t)INT32_MAX / (3 * sizeof(uint64_t)) < nchunk) RETURN_DEFER(0);
+    words = malloc(nchunk * 3 * sizeof(uint64_t));
+    if (NULL == words) RETURN_DEFER(0);
+    for (size_t i = 0; i < nchunk; i++){
+        words[3 * i] = (uint64_t)mnfst->chunk_seq.chunk_checksum[i];
+        words[3 * i + 1] = (uint64_t)mnfst->chunk_seq.cutpoint[i];
+        words[3 * i + 2] = (uint64_t)mnfst->chunk_seq.chunk_size[i];
+    }
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_text(stmt, 1, file_path, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)fingerprint->file_size);
+    sqlite3_bind_int64(stmt, 3, fingerprint->mtime_ns);
+    sqlite3_bind_int64(stmt, 4, fingerprint->ctime_ns);
+    sqlite3_bind_int64(stmt, 5, (sqlite3_int64)fingerprint->inode);
+    sqlite3_bind_int(stmt, 6, fingerprint->chunk_strategy);
+    sqlite3_bind_int64(stmt, 7, (sqlite3_int64)fingerprint->chunk_size);
+    sqlite3_bind_int64(stmt, 8, (sqlite3_int64)mnfst->file_checksum);
+    sqlite3_bind_int64(stmt, 9, (sqlite3_int64)mnfst->chunk_root);
+    sqlite3_bind_blob(stmt, 10, words, (int)(nchunk * 3 * sizeof(uint64_t)), SQLITE_STATIC);
+    if (NULL != hash_state) sqlite3_bind_blob(stmt, 11, hash_state, (int)hash_state_size, SQLITE_STATIC);
+    else sqlite3_bind_null(stmt, 11);
+    if (SQLITE_DONE != sqlite3_step(stmt)) {
+        fz_log(FZ_ERROR, "Failed to record the fingerprint of `%s`: %s", file_path, sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
     defer:
-        if (NULL != chunk_checksum_file_path.digest) free(chunk_checksum_file_path.digest);
-        if (NULL != chunk_checksum_file_path.file_path) {
-            for (size_t i = 0; i < local_size; i++){
-                if (NULL != chunk_checksum_file_path.file_path[i]) free(chunk_checksum_file_path.file_path[i]);
-            }
-            free(chunk_checksum_file_path.file_path);
-        }
-        if (NULL != stmt) sqlite3_finalize(stmt);
+        if (NULL != stmt) sqlite3_reset(stmt);
+        if (NULL != words) free(words);
         return result;
 }
 
 
-extern int fz_commit_janitor_change(fz_ctx_t *ctx, fz_hex_digest_t *unused_chunk_list, size_t nchunk){
+extern int fz_commit_blob_state(fz_ctx_t *ctx, fz_hex_digest_t *chunk_checksum, fz_blob_state_t *states, uint8_t *present, size_t nchunk, uint64_t *epoch){
     int result = 1;
-    sqlite3_stmt *stmt = NULL; 
-    int ret;
+    sqlite3_stmt *upsert = NULL;
+    sqlite3_stmt *delete = NULL;
+    sqlite3_stmt *bump = NULL;
+    const char *upsert_sql = 
+        "INSERT OR REPLACE INTO filezap_blob_state (chunk_checksum, blob_size, mtime_ns, inode, verified_at, pack_id, pack_offset, raw_size) "
+        "VALUES (?,?,?,?,?,?,?,?);";
+    const char *delete_sql = "DELETE FROM filezap_blob_state WHERE chunk_checksum = ?;";
 
-    const char *delete_chunk_sql = "DELETE FROM filezap_chunks WHERE chunk_checksum = ?;";
-    ret = sqlite3_prepare_v2(ctx->db, delete_chunk_sql, -1, &stmt, NULL);
-    if (SQLITE_OK != ret) {RETURN_DEFER(0);}
+    if (SQLITE_OK != prepare_cached(ctx, upsert_sql, &upsert)) RETURN_DEFER(0);
+    if (SQLITE_OK != prepare_cached(ctx, delete_sql, &delete)) RETURN_DEFER(0);
+    if (SQLITE_OK != prepare_cached(ctx, BUMP_META_VALUE_SQL, &bump)) RETURN_DEFER(0);
+    sqlite3_bind_text(bump, 1, FZ_META_BLOB_STATE_EPOCH, -1, SQLITE_STATIC);
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "BEGIN TRANSACTION;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to begin blob state update: %s", sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
     for (size_t i = 0; i < nchunk; i++){
-        sqlite3_bind_int64(stmt, 1, unused_chunk_list[i]);
-        sqlite3_step(stmt);
+        sqlite3_stmt *stmt = present[i]? upsert : delete;
+        sqlite3_bind_int64(stmt, 1, (sqlite3_int64)chunk_checksum[i]);
+        if (present[i]){
+            sqlite3_bind_int64(stmt, 2, (sqlite3_int64)states[i].blob_size);
+            sqlite3_bind_int64(stmt, 3, (sqlite3_int64)states[i].mtime_ns);
+            sqlite3_bind_int64(stmt, 4, (sqlite3_int64)states[i].inode);
+            sqlite3_bind_int64(stmt, 5, (sqlite3_int64)states[i].verified_at);
+            sqlite3_bind_int64(stmt, 6, (sqlite3_int64)states[i].pack_id);
+            sqlite3_bind_int64(stmt, 7, (sqlite3_int64)states[i].pack_offset);
+            sqlite3_bind_int64(stmt, 8, (sqlite3_int64)states[i].raw_size);
+        }
+        if (SQLITE_DONE != sqlite3_step(stmt)) {
+            fz_log(FZ_ERROR, "Failed to update blob state: %s", sqlite3_errmsg(conn_db(ctx)));
+            sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+            RETURN_DEFER(0);
+        }
         sqlite3_reset(stmt);
     }
+    /* The epoch moves in the same transaction, a snapshot of the index can never claim an epoch it does not reflect */
+    if (SQLITE_ROW != sqlite3_step(bump)) {
+        fz_log(FZ_ERROR, "Failed to bump blob state epoch: %s", sqlite3_errmsg(conn_db(ctx)));
+        sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+        RETURN_DEFER(0);
+    }
+    uint64_t bumped = (uint64_t)sqlite3_column_int64(bump, 0);
+    sqlite3_reset(bump);
+    if (SQLITE_OK != sqlite3_exec(conn_db(ctx), "COMMIT;", NULL, NULL, NULL)) {
+        fz_log(FZ_ERROR, "Failed to commit blob state update: %s", sqlite3_errmsg(conn_db(ctx)));
+        sqlite3_exec(conn_db(ctx), "ROLLBACK;", NULL, NULL, NULL);
+        RETURN_DEFER(0);
+    }
+    *epoch = bumped;
     defer:
-        if (NULL != stmt) sqlite3_finalize(stmt);
+        if (NULL != upsert) sqlite3_reset(upsert);
+        if (NULL != delete) sqlite3_reset(delete);
+        if (NULL != bump) sqlite3_reset(bump);
+        return result;
+}
+
+
+extern int fz_query_packs(fz_ctx_t *ctx, fz_pack_info_t **packs){
+    int result = 1;
+    int ret;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "SELECT pack_id, length, sealed FROM filezap_packs ORDER BY pack_id;";
+
+    ret = prepare_cached(ctx, sql, &stmt);
+    if (SQLITE_OK != ret) RETURN_DEFER(0);
+    while (SQLITE_ROW == (ret = sqlite3_step(stmt))){
+        fz_pack_info_t info = {
+            .pack_id = (uint32_t)sqlite3_column_int64(stmt, 0),
+            .length = (size_t)sqlite3_column_int64(stmt, 1),
+            .sealed = sqlite3_column_int(stmt, 2),
+        };
+        arrput(*packs, info);
+    }
+    if (SQLITE_DONE != ret) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+extern int fz_commit_pack(fz_ctx_t *ctx, uint32_t pack_id, size_t length, int sealed){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "INSERT OR REPLACE INTO filezap_packs (pack_id, length, sealed) VALUES (?,?,?);";
+
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)pack_id);
+    sqlite3_bind_int64(stmt, 2, (sqlite3_int64)length);
+    sqlite3_bind_int(stmt, 3, sealed);
+    if (SQLITE_DONE != sqlite3_step(stmt)) {
+        fz_log(FZ_ERROR, "Failed to commit pack %u: %s", pack_id, sqlite3_errmsg(conn_db(ctx)));
+        RETURN_DEFER(0);
+    }
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
+        return result;
+}
+
+
+extern int fz_commit_pack_removal(fz_ctx_t *ctx, uint32_t pack_id){
+    int result = 1;
+    sqlite3_stmt *stmt = NULL;
+    const char *sql = "DELETE FROM filezap_packs WHERE pack_id = ?;";
+
+    if (SQLITE_OK != prepare_cached(ctx, sql, &stmt)) RETURN_DEFER(0);
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)pack_id);
+    if (SQLITE_DONE != sqlite3_step(stmt)) RETURN_DEFER(0);
+    defer:
+        if (NULL != stmt) sqlite3_reset(stmt);
         return result;
-}
\ No newline at end of file
+}
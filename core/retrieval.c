@@ -9,6 +9,9 @@
 static inline int fetch_chunk_from_source(fz_ctx_t *ctx, fz_hex_digest_t chnk_checksum, size_t chunk_index, fz_dyn_queue_t *download_queue);
 static inline int fetch_chunk_from_blob_store(fz_ctx_t *ctx, fz_hex_digest_t chnk_checksum, char *scratchpad, size_t scratchpad_size);
 
+/* Cutpoints start at 0 and follow each other without gaps, the last chunk reaches the end of the file and may be padded past it */
+static inline int chunks_tile_file(fz_file_manifest_t *mnfst);
+
 /* Single threaded download */
 static inline int download_chunks_st(fz_ctx_t *ctx, fz_dyn_queue_t *download_queue, fz_channel_t *channel, fz_file_manifest_t *mnfst);
 
@@ -16,14 +19,16 @@ static inline int download_chunks_st(fz_ctx_t *ctx, fz_dyn_queue_t *download_que
 /* The file retrieval step is a all-or-nothing step i.e., for all the file to be successfully retrieved all the chunks that make up the file must exist */ 
 extern int fz_retrieve_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_channel_t *channel, char *file_name){
     int result = 1;
-    FILE *fh = NULL;
-    char *buffer = NULL;
     FILE *dest_fh = NULL;
     fz_dyn_queue_t dq = {0};
     struct cutpoint_map_s *cutpoint_map = NULL;
     struct missing_chunks_map_s *missing_chunks = NULL;
+    struct chunk_loc_map_s *chunk_locs = NULL;
+    fz_chunk_loc_t *chunk_loc_list = NULL;
     char *temp_file_path = NULL;
 
+    /* The map owns its keys, direct assembly keeps pointing at them after the scavenged chunk list is freed */
+    sh_new_strdup(cutpoint_map);
     hmdefault(missing_chunks, 1);
     for (size_t i = 0; i < mnfst->chunk_seq.chunk_seq_len; i++){
         hmput(missing_chunks, mnfst->chunk_seq.chunk_checksum[i], 1);
@@ -34,8 +39,25 @@ extern int fz_retrieve_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_channel
         RETURN_DEFER(0);
     }
 
+    /* Every chunk is checked against its checksum when it is fetched, scavenged or downloaded. The root ties those checksums, their
+    cutpoints and sizes to the sender's file and the cutpoints must tile the file, so the assembled bytes need no second read */
+    fz_hex_digest_t digest = 0;
+    if (!xxhash_hexdigest_from_file_prime(&digest, &mnfst->chunk_seq)) RETURN_DEFER(0);
+    if (mnfst->chunk_root != digest) {
+        fz_log(FZ_INFO, "Retrieval error, chunk sequence does not match the chunk root digest");
+        RETURN_DEFER(0);
+    }
+    if (!chunks_tile_file(mnfst)) {
+        fz_log(FZ_INFO, "Retrieval error, chunk cutpoints do not cover the %lu byte(s) of the file", mnfst->file_size);
+        RETURN_DEFER(0);
+    }
+    if (!fz_blob_store_reconcile(ctx)) {
+        fz_log(FZ_ERROR, "Could not reconcile the blob store");
+        RETURN_DEFER(0);
+    }
+
     /* Todo: revisit this multithreaded fetch */
-    if (!fz_fetch_file_st(ctx, mnfst, channel, &dq, &cutpoint_map, &missing_chunks, file_name)){
+    if (!fz_fetch_file_st(ctx, mnfst, channel, &dq, &cutpoint_map, &missing_chunks, &chunk_locs, file_name)){
         fz_log(FZ_ERROR, "Something went wrong trying to scavenge for chunks");
         RETURN_DEFER(0);
     }
@@ -57,32 +79,22 @@ extern int fz_retrieve_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_channel
         fz_log(FZ_INFO, "Destination handle failed");
         RETURN_DEFER(0);
     }
-    char receiver_chnk_loc[RESERVED];
-    size_t max_alloc = 0;
-    for (size_t i = 0; i < mnfst->chunk_seq.chunk_seq_len; i++){
-        size_t min = (mnfst->file_size - (mnfst->chunk_seq.chunk_size[i] * i)) < mnfst->chunk_seq.chunk_size[i]? 
-            (mnfst->file_size - (mnfst->chunk_seq.chunk_size[i] * i)) : mnfst->chunk_seq.chunk_size[i];
-        if (max_alloc < min){
-            max_alloc = min;
-            buffer = realloc(buffer, max_alloc * sizeof(char));
-            memset(buffer, 0, max_alloc * sizeof(char));
+    if (0 < hmlenu(chunk_locs)){
+        chunk_loc_list = calloc(mnfst->chunk_seq.chunk_seq_len, sizeof(fz_chunk_loc_t));
+        if (NULL == chunk_loc_list) RETURN_DEFER(0);
+        for (size_t i = 0; i < mnfst->chunk_seq.chunk_seq_len; i++){
+            struct chunk_loc_map_s *loc = hmgetp_null(chunk_locs, mnfst->chunk_seq.chunk_checksum[i]);
+            if (NULL != loc) chunk_loc_list[i] = loc->value;
         }
-        if (NULL == buffer) RETURN_DEFER(0);
-        snprintf(receiver_chnk_loc, RESERVED, "%s%016llx", ctx->metadata_loc, mnfst->chunk_seq.chunk_checksum[i]);
-
-        fh = fopen(receiver_chnk_loc, "rb");
-        if (NULL == fh) RETURN_DEFER(0);
-        fread(buffer, 1, min, fh);
-        fwrite(buffer, 1, min, dest_fh);
-        fclose(fh);
-        memset(buffer, 0, max_alloc * sizeof(char));
+    }
+    if (!fz_assemble_file(ctx, mnfst, chunk_loc_list, fileno(dest_fh))) {
+        fz_log(FZ_ERROR, "Failed to assemble `%s` from chunks", file_name);
+        RETURN_DEFER(0);
     }
 
-    fz_hex_digest_t digest = 0;
-    xxhash_hexdigest_from_file(dest_fh, &digest); /* this guy is reading the destination file `dest_fh` */
-    fz_log(FZ_INFO, "Calculating the file checksum");
-    if (mnfst->file_checksum != digest) {
-        fz_log(FZ_INFO, "Retrieval error, corrupted file");
+    struct stat dest_stat = {0};
+    if (0 != fstat(fileno(dest_fh), &dest_stat) || (size_t)dest_stat.st_size != mnfst->file_size) {
+        fz_log(FZ_INFO, "Retrieval error, assembled file is %ld bytes instead of %lu", (long)dest_stat.st_size, mnfst->file_size);
         RETURN_DEFER(0);
     }
     if (0 != rename(temp_file_path, file_name)) {
@@ -100,18 +112,45 @@ extern int fz_retrieve_file(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_channel
     }
     fz_log(FZ_INFO, "Here are the missing chunks size(%lu): ", count);
     defer:
-        if (NULL != fh) fclose(fh);
-        if (NULL != buffer) free(buffer);
+        if (!fz_blob_state_flush(ctx)) fz_log(FZ_WARNING, "Blob state index could not be persisted, it will be rebuilt on demand");
         if (NULL != dest_fh) fclose(dest_fh);
         if (NULL != missing_chunks) hmfree(missing_chunks);
-        if (NULL != cutpoint_map){shfree(cutpoint_map);}
+        if (NULL != chunk_locs) hmfree(chunk_locs);
+        if (NULL != chunk_loc_list) free(chunk_loc_list);
+        if (NULL != cutpoint_map){
+            for (size_t i = 0; i < shlenu(cutpoint_map); i++){
+                fz_cutpoint_list_destroy(cutpoint_map[i].value);
+                free(cutpoint_map[i].value);
+            }
+            shfree(cutpoint_map);
+        }
         if (NULL != temp_file_path) free(temp_file_path);
         fz_dyn_queue_destroy(&dq);
         return result;
 }
 
 
-extern int fz_fetch_file_st(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_channel_t *channel, fz_dyn_queue_t *download_queue, struct cutpoint_map_s **cutpoint_map, struct missing_chunks_map_s **missing_chunks, char *dest_file_path){
+static inline int chunks_tile_file(fz_file_manifest_t *mnfst){
+    fz_chunk_seq_t *seq = &mnfst->chunk_seq;
+    size_t end = 0;
+    for (size_t i = 0; i < seq->chunk_seq_len; i++){
+        if (seq->cutpoint[i] != end || end >= mnfst->file_size || seq->chunk_size[i] > SIZE_MAX - end) return 0;
+        end += seq->chunk_size[i];
+    }
+    return end >= mnfst->file_size;
+}
+
+
+extern int fz_fetch_file_st(
+    fz_ctx_t *ctx, 
+    fz_file_manifest_t *mnfst, 
+    fz_channel_t *channel, 
+    fz_dyn_queue_t *download_queue, 
+    struct cutpoint_map_s **cutpoint_map, 
+    struct missing_chunks_map_s **missing_chunks, 
+    struct chunk_loc_map_s **chunk_locs, 
+    char *dest_file_path
+){
     (void)channel;
     int result = 1;
     char *scratchpad = NULL;
@@ -125,14 +164,17 @@ extern int fz_fetch_file_st(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, fz_channel
 
     chunk_seq = calloc(mnfst->chunk_seq.chunk_seq_len, sizeof(fz_chunk_seq_t));
     if (NULL == chunk_seq) RETURN_DEFER(0);
+    size_t nlocal = 0;
     for (size_t i = 0; i < mnfst->chunk_seq.chunk_seq_len; i++){
         if (fetch_chunk_from_blob_store(ctx, mnfst->chunk_seq.chunk_checksum[i], scratchpad, scratchpad_size)){
             hmput(*missing_chunks, mnfst->chunk_seq.chunk_checksum[i], 0);
-        }
+        } else if (fz_chunk_filter_may_contain(ctx, mnfst->chunk_seq.chunk_checksum[i])) nlocal++;
     }
     
-    if (fz_query_required_chunk_list(ctx, mnfst, &chunk_list, &chunk_size, missing_chunks)){
-        if (!fz_fetch_chunks_from_file_cutpoint(ctx, mnfst, chunk_list, chunk_size, cutpoint_map, missing_chunks, dest_file_path)){
+    /* The chunk table is only consulted for chunks the presence filter cannot rule out */
+    if (0 == nlocal) fz_log(FZ_INFO, "No missing chunk left to look up in the chunk table");
+    else if (fz_query_required_chunk_list(ctx, mnfst, &chunk_list, &chunk_size, missing_chunks)){
+        if (!fz_fetch_chunks_from_file_cutpoint(ctx, mnfst, chunk_list, chunk_size, cutpoint_map, missing_chunks, chunk_locs, dest_file_path)){
             fz_log(FZ_ERROR, "Error occurred while trying to fetch chunk from file(s)");
         }
     } else fz_log(FZ_ERROR, "Error occurred while querying for necessary chunk(s) from chunk table");
@@ -161,11 +203,11 @@ extern int fz_fetch_chunks_from_file_cutpoint(
     size_t nchunk, 
     struct cutpoint_map_s **cutpoint_map,
     struct missing_chunks_map_s **missing_chunks,
+    struct chunk_loc_map_s **chunk_locs,
     char *dest_file_path
 ){
     int result = 1;
     char *buffer = NULL;
-    char *chunk_loc_buffer = NULL;
     /* This is wasteful, use a resizable arena allocator; create a map from file to the chunk cutpoint */
     for (size_t i = 0; i < nchunk; i++){
         fz_cutpoint_list_t *val_buffer = (fz_cutpoint_list_t *)shget(*cutpoint_map, chunk_buffer[i].src_file_path);
@@ -194,11 +236,6 @@ extern int fz_fetch_chunks_from_file_cutpoint(
 
     size_t max_alloc = 0;
     fz_hex_digest_t digest = 0;
-    char temp[HEX_DIGIT_SIZE] = {0};
-
-    chunk_loc_buffer = (char *)calloc(strlen(ctx->metadata_loc) + HEX_DIGIT_SIZE, sizeof(char));
-    if (NULL == chunk_loc_buffer) RETURN_DEFER(0);
-    strncat(chunk_loc_buffer, ctx->metadata_loc, sizeof(ctx->metadata_loc));
 
     for (size_t i = 0; i < shlenu(*cutpoint_map); i++){
         char *scvg_file_path = (*cutpoint_map)[i].key;
@@ -206,6 +243,8 @@ extern int fz_fetch_chunks_from_file_cutpoint(
         // fz_log(FZ_INFO, "Open file `%s`", scvg_file_path);
         FILE *fh = fopen(scvg_file_path, "rb");
         if (NULL == fh) continue; /* If it fails to open the file move to next file */
+        struct stat scvg_meta = {0};
+        if (0 != fstat(fileno(fh), &scvg_meta)) {fclose(fh); continue;}
         for (size_t j = 0; j < val_buffer->cutpoint_len; j++){
             if (fseek(fh, val_buffer->cutpoint[j], SEEK_SET) < 0) RETURN_DEFER(0);
             if (max_alloc < val_buffer->chunk_size[j]){
@@ -218,24 +257,27 @@ extern int fz_fetch_chunks_from_file_cutpoint(
             fread(buffer, 1, val_buffer->chunk_size[j], fh);
             size_t min = val_buffer->chunk_size[j];
             xxhash_hexdigest(buffer, val_buffer->chunk_size[j], &digest);
-            if (digest == val_buffer->buffer[j]){
-                snprintf(temp, 17, "%016llx", digest);
-                memcpy(&chunk_loc_buffer[strlen(ctx->metadata_loc)], temp, 17);
-                // fz_log(FZ_INFO, "Chunk location: %s", chunk_loc_buffer);
-                FILE *d_fh = fopen(chunk_loc_buffer, "wb");
-                if (NULL == d_fh) RETURN_DEFER(0);
-                fwrite(buffer, 1, min, d_fh);
-                fclose(d_fh);
+            if (digest == val_buffer->buffer[j] && (FZ_ASSEMBLE_DIRECT & ctx->assembly_mode)){
+                /* Record where the verified chunk lives, assembly copies it from here without staging a blob */
+                fz_chunk_loc_t loc = {
+                    .file_path = scvg_file_path, 
+                    .offset = val_buffer->cutpoint[j],
+                    .file_size = (size_t)scvg_meta.st_size,
+                    .mtime_ns = (int64_t)scvg_meta.st_mtim.tv_sec * 1000000000LL + scvg_meta.st_mtim.tv_nsec,
+                };
+                hmput(*chunk_locs, digest, loc);
+                hmput(*missing_chunks, digest, 0);
+            } else if (digest == val_buffer->buffer[j]){
+                if (!fz_blob_store_put(ctx, digest, buffer, min)) {fclose(fh); RETURN_DEFER(0);}
+                fz_chunk_cache_put(&ctx->chunk_cache, digest, buffer, min);
                 hmput(*missing_chunks, digest, 0);
             }
         }
         // fz_log(FZ_INFO, "Close file `%s`", scvg_file_path);
-        snprintf(temp, HEX_DIGIT_SIZE, "%016llx", digest);
         fclose(fh);
     }
     defer:
         if (NULL != buffer) free(buffer);
-        if (NULL != chunk_loc_buffer) free(chunk_loc_buffer);
         return result;
 }
 
@@ -263,11 +305,23 @@ static inline int fetch_chunk_from_blob_store(fz_ctx_t *ctx, fz_hex_digest_t chn
     int result = 1;
     FILE *fh = NULL;
     char *chnk_loc = scratchpad;
-    memset(chnk_loc, 0, scratchpad_size);
     if (NULL == chnk_loc) RETURN_DEFER(0);
 
-    /* This will be replaced with a cache query */
-    snprintf(chnk_loc, RESERVED, "%s%016llx", ctx->metadata_loc, chnk_checksum);
+    /* Verified blobs are answered from the blob state index, only blobs it does not know about or that changed since are hashed.
+    A blob that vanished behind the index is forgotten and downloaded again instead of failing assembly */
+    if (fz_blob_state_get(ctx, chnk_checksum, NULL)) {
+        fz_blob_handle_t blob = {0};
+        int opened = fz_blob_store_open(ctx, chnk_checksum, &blob);
+        int unchanged = opened && !blob.changed;
+        if (opened) fz_blob_store_release(&blob);
+        if (unchanged) RETURN_DEFER(1);
+        fz_blob_state_forget(ctx, chnk_checksum);
+        if (!opened) RETURN_DEFER(0);
+    }
+    if (!fz_chunk_filter_may_contain(ctx, chnk_checksum)) RETURN_DEFER(0);
+
+    memset(chnk_loc, 0, scratchpad_size);
+    if (!fz_blob_locate(ctx, chnk_checksum, chnk_loc, scratchpad_size)) RETURN_DEFER(0);
 
     fh = fopen(chnk_loc, "rb");
     if (NULL == fh) RETURN_DEFER(0);
@@ -279,6 +333,7 @@ static inline int fetch_chunk_from_blob_store(fz_ctx_t *ctx, fz_hex_digest_t chn
         fz_log(FZ_ERROR, "Corrupted chunk data, expected `%016llx` got `%016llx`", chnk_checksum, digest);
         RETURN_DEFER(0);
     }
+    fz_blob_state_record(ctx, chnk_checksum);
     defer:
         if (NULL != fh) fclose(fh);
         return result;
@@ -324,7 +379,7 @@ extern int fz_deserialize_response(char *json, fz_chunk_response_t *response){
         } 
     }
     defer:
-        if (!root) free(root);
+        if (NULL != root) free(root);
         return result;
 }
 
@@ -335,10 +390,11 @@ static inline int download_chunks_st(fz_ctx_t *ctx, fz_dyn_queue_t *download_que
     size_t content_size = 0;
     char number_as_str[XXSMALL_RESERVED] = {0};
     char *content_buffer = NULL;
-    FILE *chnk_fh = NULL;
+    char *frame_buffer = NULL;
     char *scratchpad = NULL;
     size_t scratchpad_size = LARGE_RESERVED;
     size_t chunk_max_alloc = 0;
+    size_t frame_max_alloc = 0;
     size_t count = 0;
 
     scratchpad = calloc(scratchpad_size, sizeof(char));
@@ -369,21 +425,56 @@ static inline int download_chunks_st(fz_ctx_t *ctx, fz_dyn_queue_t *download_que
                 fz_log(FZ_ERROR, "Something went wrong: %s", json);
                 RETURN_DEFER(0);
             }
+            /* Every request is serialized into a fresh buffer */
+            free(json);
+            json = NULL;
 
             size_t chunk_size = mnfst->chunk_seq.chunk_size[val.chunk_index];
             if (chunk_max_alloc < chunk_size){
-                content_buffer = realloc(content_buffer, chunk_size);
-                if (NULL == content_buffer) RETURN_DEFER(0);
+                char *temp = realloc(content_buffer, chunk_size);
+                if (NULL == temp) RETURN_DEFER(0);
+                content_buffer = temp;
                 chunk_max_alloc = chunk_size;
             }
 
-            if (!fz_channel_read_request(channel, content_buffer, chunk_size, scratchpad, scratchpad_size)) RETURN_DEFER(0);
-            char temp_loc[XXSMALL_RESERVED] = {0};
-            snprintf(temp_loc, XXSMALL_RESERVED, "%s%016llx", ctx->metadata_loc, val.checksum);
-            chnk_fh = fopen(temp_loc, "wb");
-            if (NULL == chnk_fh) RETURN_DEFER(0);
-            fwrite(content_buffer, 1, chunk_size, chnk_fh);
-            fclose(chnk_fh);
+            /* A compressed frame is decoded before the checksum is checked */
+            if (!fz_channel_read_request(channel, number_as_str, XXSMALL_RESERVED, scratchpad, scratchpad_size)) RETURN_DEFER(0);
+            int codec = 0;
+            size_t payload_size = 0;
+            if (2 != sscanf(number_as_str, FZ_CHUNK_FRAME_FMT, &codec, &payload_size) || (FZ_CODEC_RAW != codec && FZ_CODEC_LZ != codec)) {
+                fz_log(FZ_ERROR, "Unknown chunk frame header `%.*s`", XXSMALL_RESERVED, number_as_str);
+                RETURN_DEFER(0);
+            }
+            int compressed = FZ_CODEC_LZ == codec;
+            if (compressed? (0 == payload_size || chunk_size <= payload_size) : chunk_size != payload_size) {
+                fz_log(FZ_ERROR, "Frame of %lu byte(s) does not fit chunk `%016llx` of %lu byte(s)", payload_size, val.checksum, chunk_size);
+                RETURN_DEFER(0);
+            }
+            if (compressed && frame_max_alloc < payload_size){
+                char *temp = realloc(frame_buffer, payload_size);
+                if (NULL == temp) RETURN_DEFER(0);
+                frame_buffer = temp;
+                frame_max_alloc = payload_size;
+            }
+            if (!fz_channel_read_request(channel, compressed? frame_buffer : content_buffer, payload_size, scratchpad, scratchpad_size)) RETURN_DEFER(0);
+            if (compressed && !fz_chunk_decompress(frame_buffer, payload_size, content_buffer, chunk_size)) {
+                fz_log(FZ_ERROR, "Malformed compressed frame for chunk `%016llx`", val.checksum);
+                RETURN_DEFER(0);
+            }
+            fz_hex_digest_t digest = 0;
+            xxhash_hexdigest(content_buffer, chunk_size, &digest);
+            if (val.checksum != digest) {
+                fz_log(FZ_ERROR, "Corrupted chunk received, expected `%016llx` got `%016llx`", val.checksum, digest);
+                RETURN_DEFER(0);
+            }
+            int stored = compressed
+                ? fz_blob_store_put_compressed(ctx, val.checksum, content_buffer, chunk_size, frame_buffer, payload_size)
+                : fz_blob_store_put(ctx, val.checksum, content_buffer, chunk_size);
+            if (!stored) {
+                fz_log(FZ_ERROR, "Failed to store chunk `%016llx`", val.checksum);
+                RETURN_DEFER(0);
+            }
+            fz_chunk_cache_put(&ctx->chunk_cache, val.checksum, content_buffer, chunk_size);
         } else {
             assert(0&&"Unreachable!");
         }
@@ -391,7 +482,9 @@ static inline int download_chunks_st(fz_ctx_t *ctx, fz_dyn_queue_t *download_que
     }
     fz_log(FZ_INFO, "Downloaded %lu missing chunk(s) from sender", count);
     defer:
-        if (NULL == json) free(json);
+        if (NULL != json) free(json);
+        if (NULL != content_buffer) free(content_buffer);
+        if (NULL != frame_buffer) free(frame_buffer);
         if (NULL != scratchpad) free(scratchpad);
         return result;
 }
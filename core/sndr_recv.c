@@ -17,6 +17,9 @@ extern int fz_send_file(fz_ctx_t *ctx, fz_channel_t *channel, const char *src_fi
     char *scratchpad = NULL;
     size_t scratchpad_size = LARGE_RESERVED;
     char *content_buffer = NULL;
+    char *frame_buffer = NULL;
+    size_t frame_max_alloc = 0;
+    size_t sent_raw = 0, sent_wire = 0;
     size_t alloc_size = XSMALL_RESERVED;
     FILE *src_fh = NULL;
 
@@ -109,18 +112,35 @@ extern int fz_send_file(fz_ctx_t *ctx, fz_channel_t *channel, const char *src_fi
         if (fseek(src_fh, cutpoint, SEEK_SET) < 0) RETURN_DEFER(0);
         fread(content_buffer, 1, chunk_size, src_fh);
 
-        if (!fz_channel_write_request(channel, content_buffer, chunk_size)){
+        /* Chunk frame: the codec and payload size header, then the payload */
+        char *payload = content_buffer;
+        size_t payload_size = chunk_size;
+        int codec = FZ_CODEC_RAW;
+        if ((FZ_CODEC_LZ & ctx->compression) && fz_chunk_compress(content_buffer, chunk_size, &frame_buffer, &frame_max_alloc, &payload_size)){
+            payload = frame_buffer;
+            codec = FZ_CODEC_LZ;
+        }
+        snprintf(number_as_str, XXSMALL_RESERVED, FZ_CHUNK_FRAME_FMT, codec, payload_size);
+        if (!fz_channel_write_request(channel, number_as_str, XXSMALL_RESERVED)){
+            fz_log(FZ_ERROR, "Failed to send chunk frame size to destination");
+            RETURN_DEFER(0);
+        }
+        if (!fz_channel_write_request(channel, payload, payload_size)){
             fz_log(FZ_ERROR, "Failed to send chunk to destination");
             RETURN_DEFER(0);
         }
+        sent_raw += chunk_size;
+        sent_wire += payload_size;
 
     }
+    fz_log(FZ_INFO, "Sent %lu chunk byte(s) as %lu byte(s) on the wire", sent_raw, sent_wire);
     fz_log(FZ_INFO, "Closing connection");
     defer:
         fz_log(FZ_INFO, "Closed connection");
         if (NULL != src_fh) fclose(src_fh);
         if (NULL != response_buffer) free(response_buffer);
         if (NULL != content_buffer) free(content_buffer);
+        if (NULL != frame_buffer) free(frame_buffer);
         if (NULL != buffer) free(buffer);
         if (NULL != scratchpad) free(scratchpad);
         fz_file_manifest_destroy(&mnfst);
@@ -147,6 +167,7 @@ extern int fz_receive_file(fz_ctx_t *ctx, fz_channel_t *channel){
     char *scratchpad = NULL;
     size_t scratchpad_size = LARGE_RESERVED;
     size_t flag = 0;
+    int janitor_paused = 0;
 
     scratchpad = calloc(scratchpad_size, sizeof(char));
     if (NULL == scratchpad) RETURN_DEFER(0);
@@ -160,6 +181,11 @@ extern int fz_receive_file(fz_ctx_t *ctx, fz_channel_t *channel){
     if (NULL == buffer) RETURN_DEFER(0);
     
     if (!fz_channel_read_request(channel, buffer, content_size, scratchpad, scratchpad_size)) RETURN_DEFER(0);
+    /* The transfer starts here, the background janitor holds off until it is committed */
+    fz_janitor_pause(ctx);
+    janitor_paused = 1;
+    /* Files changed since the last transfer must not be offered for scavenging */
+    if (!fz_watcher_poll(ctx, NULL)) RETURN_DEFER(0);
     if (!fz_deserialize_manifest(buffer, &mnfst)) RETURN_DEFER(0);
     if (!get_filename(mnfst.file_name, &file_name)) RETURN_DEFER(0);
 
@@ -173,8 +199,11 @@ extern int fz_receive_file(fz_ctx_t *ctx, fz_channel_t *channel){
     if (!fz_retrieve_file(ctx, &mnfst, channel, file_path_buffer)) RETURN_DEFER(0);
     fz_log(FZ_INFO, "Receive file name: %s", file_path_buffer);
 
-    /* Commit new chunk metadata, for now this is just a stub, I have to move thi out of here */
-    if (!fz_commit_chunk_metadata(ctx, &mnfst, file_path_buffer)) RETURN_DEFER(0);
+    /* Writing the file queued change events for it, the rows about to be committed describe the new content */
+    fz_watcher_watch(ctx, file_path_buffer);
+    if (!fz_watcher_poll(ctx, file_path_buffer)) RETURN_DEFER(0);
+    /* With a metadata writer running the sender is acknowledged before the chunk metadata is committed */
+    if (!fz_meta_writer_submit(ctx, &mnfst, file_path_buffer)) RETURN_DEFER(0);
     defer:
         /* Notify sender that the files have been sent successfully 
         Todo: have different code to indicate the result file transfer i.e., FZ_TRANSFER_SUCCESS = 1 etc.
@@ -182,6 +211,7 @@ extern int fz_receive_file(fz_ctx_t *ctx, fz_channel_t *channel){
         flag = 1;
         SEND_CONN_FLAG(flag); /* Non-zero indicates close connection: This is not a very good idea */
 
+        if (janitor_paused) fz_janitor_resume(ctx);
         if (NULL != buffer) free(buffer);
         if (NULL != scratchpad) free(scratchpad);
         if (NULL != file_name) free(file_name);
@@ -241,9 +271,10 @@ extern int fz_serialize_manifest(fz_file_manifest_t *mnfst, char **json, size_t
     snprintf(
         temp_, 
         sizeof(temp_), 
-        "{\"file_name\":\"%s\",\"file_checksum\":\"%016llx\",\"file_size\":%lu,\"source_id\":%lu,\"chunk_seq_len\":%lu, \"chunk_seq\":",
+        "{\"file_name\":\"%s\",\"file_checksum\":\"%016llx\",\"chunk_root\":\"%016llx\",\"file_size\":%lu,\"source_id\":%lu,\"chunk_seq_len\":%lu, \"chunk_seq\":",
         mnfst->file_name, 
         mnfst->file_checksum,
+        mnfst->chunk_root,
         mnfst->file_size,
         mnfst->source_id,
         mnfst->chunk_seq.chunk_seq_len);
@@ -275,6 +306,7 @@ extern int fz_deserialize_manifest(const char *json, fz_file_manifest_t *mnfst){
     if (!file_manifest_json || !file_manifest_json->length) RETURN_DEFER(0);
     
     fz_hex_digest_t digest = 0;
+    fz_hex_digest_t chunk_root = 0;
     size_t chunk_seq_len = 0;
     size_t file_size = 0;
     fz_ctx_desc_t source_id = 0;
@@ -290,6 +322,9 @@ extern int fz_deserialize_manifest(const char *json, fz_file_manifest_t *mnfst){
         } else if (0 == strcmp(elem->name->string, "file_checksum")){
             struct json_number_s *val = (struct json_number_s *)elem->value->payload;
             digest = (fz_hex_digest_t)strtoull(val->number, NULL, 16);
+        } else if (0 == strcmp(elem->name->string, "chunk_root")){
+            struct json_number_s *val = (struct json_number_s *)elem->value->payload;
+            chunk_root = (fz_hex_digest_t)strtoull(val->number, NULL, 16);
         } else if (0 == strcmp(elem->name->string, "file_size")){
             struct json_number_s *val = (struct json_number_s *)elem->value->payload;
             file_size = (size_t)strtoul(val->number, NULL, 10);
@@ -335,6 +370,7 @@ extern int fz_deserialize_manifest(const char *json, fz_file_manifest_t *mnfst){
     mnfst->file_name = file_name;
     mnfst->file_size = file_size;
     mnfst->file_checksum = digest;
+    mnfst->chunk_root = chunk_root;
     mnfst->source_id = source_id;
     mnfst->chunk_seq.chunk_seq_len = chunk_seq_len;
 
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "core.h"
+#if defined(__linux__)
+    #include <sys/inotify.h>
+#endif
+
+#define WATCH_SCAN_BATCH 256
+
+#if defined(__linux__)
+/* A file whose content changed is as useless to scavenging as a deleted one. IN_MOVED_TO covers files replaced by a rename */
+#define WATCH_EVENTS (IN_MODIFY | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR)
+#endif
+
+
+static void free_prefixes(char **prefixes);
+
+
+/* Watches the directories of every file recorded in the chunk table. Changes queue up in the kernel and are applied by `fz_watcher_poll`.
+The janitor is held off while the watch set is built, its steps poll the watcher and share the context's connection */
+extern int fz_watcher_start(fz_ctx_t *ctx){
+    int result = 1;
+    fz_watcher_t *watcher = &ctx->watcher;
+    char **file_paths = NULL;
+    char *last = NULL;
+
+    if (watcher->running) return 1;
+#if defined(__linux__)
+    watcher->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (-1 == watcher->fd) {
+        fz_log(FZ_ERROR, "Unable to create inotify instance: %s", strerror(errno));
+        return 0;
+    }
+    fz_janitor_pause(ctx);
+    sh_new_strdup(watcher->dirs);
+    watcher->running = 1;
+    while (1){
+        if (!fz_query_chunk_files(ctx, last, WATCH_SCAN_BATCH, &file_paths)) RETURN_DEFER(0);
+        size_t nfiles = arrlenu(file_paths);
+        for (size_t i = 0; i < nfiles; i++) fz_watcher_watch(ctx, file_paths[i]);
+        /* The last path is kept as the cursor of the next batch */
+        if (NULL != last) free(last);
+        last = (0 < nfiles)? file_paths[nfiles - 1] : NULL;
+        for (size_t i = 0; i + 1 < nfiles; i++) free(file_paths[i]);
+        arrfree(file_paths);
+        if (nfiles < WATCH_SCAN_BATCH) break;
+    }
+    fz_log(FZ_INFO, "Watching %lu directory(ies) of recorded files", hmlenu(watcher->wds));
+#else
+    fz_log(FZ_WARNING, "File watching is only supported on Linux");
+    RETURN_DEFER(0);
+#endif
+    defer:
+#if defined(__linux__)
+        fz_janitor_resume(ctx);
+#endif
+        if (NULL != last) free(last);
+        for (size_t i = 0; i < arrlenu(file_paths); i++) free(file_paths[i]);
+        if (NULL != file_paths) arrfree(file_paths);
+        if (!result) fz_watcher_destroy(ctx);
+        return result;
+}
+
+
+extern void fz_watcher_destroy(fz_ctx_t *ctx){
+    fz_watcher_t *watcher = &ctx->watcher;
+    if (!watcher->running) return;
+    close(watcher->fd);
+    if (NULL != watcher->dirs) shfree(watcher->dirs);
+    for (size_t i = 0; i < hmlenu(watcher->wds); i++) free_prefixes(watcher->wds[i].value);
+    if (NULL != watcher->wds) hmfree(watcher->wds);
+    memset(watcher, 0, sizeof(*watcher));
+}
+
+
+/* Adds the directory of `file_path` to the watch set. Failing to watch is not an error, the janitor's sweeps still catch the file.
+Directories are keyed by their canonical path, every spelling recorded files use for one (`a/./b/`, a symlink) shares its watch */
+extern void fz_watcher_watch(fz_ctx_t *ctx, const char *file_path){
+#if defined(__linux__)
+    fz_watcher_t *watcher = &ctx->watcher;
+    char real_path[PATH_MAX];
+    if (!watcher->running) return;
+    const char *slash = strrchr(file_path, '/');
+    size_t prefix_len = (NULL != slash)? (size_t)(slash - file_path) + 1 : 0;
+    char *prefix = strndup(file_path, prefix_len);
+    if (NULL == prefix) return;
+    if (NULL == realpath((0 < prefix_len)? prefix : ".", real_path)) {
+        fz_log(FZ_WARNING, "Unable to resolve `%s`: %s", (0 < prefix_len)? prefix : ".", strerror(errno));
+        free(prefix);
+        return;
+    }
+    ptrdiff_t known = shgeti(watcher->dirs, real_path);
+    int wd = (0 <= known)? watcher->dirs[known].value : -1;
+    if (0 > known) {
+        wd = inotify_add_watch(watcher->fd, real_path, WATCH_EVENTS);
+        if (-1 == wd) {
+            fz_log(FZ_WARNING, "Unable to watch `%s`: %s", real_path, strerror(errno));
+            free(prefix);
+            return;
+        }
+        shput(watcher->dirs, real_path, wd);
+    }
+    /* Bind mounts can also lead two canonical paths to one watch descriptor */
+    struct watch_dir_map_s *dir = hmgetp_null(watcher->wds, wd);
+    if (NULL == dir) {
+        hmput(watcher->wds, wd, NULL);
+        dir = hmgetp_null(watcher->wds, wd);
+    }
+    for (size_t i = 0; i < arrlenu(dir->value); i++){
+        if (0 != strcmp(dir->value[i], prefix)) continue;
+        free(prefix);
+        return;
+    }
+    arrput(dir->value, prefix);
+#else
+    (void)ctx;
+    (void)file_path;
+#endif
+}
+
+
+/* Drains the queued change events and releases the chunk rows of every file that changed or vanished, except `ignore_path`
+which the caller just wrote and recorded itself. Call it only where no transfer or janitor step runs concurrently */
+extern int fz_watcher_poll(fz_ctx_t *ctx, const char *ignore_path){
+    int result = 1;
+    struct {char *key; uint8_t value;} *changed = NULL;
+#if defined(__linux__)
+    fz_watcher_t *watcher = &ctx->watcher;
+    char events[KB(4)] __attribute__((aligned(__alignof__(struct inotify_event))));
+    char path[RESERVED];
+
+    if (!watcher->running) return 1;
+    sh_new_strdup(changed);
+    while (1){
+        ssize_t n = read(watcher->fd, events, sizeof(events));
+        if (-1 == n && EINTR == errno) continue;
+        if (-1 == n && EAGAIN == errno) break;
+        if (0 >= n) {
+            fz_log(FZ_ERROR, "Failed to read file change events: %s", strerror(errno));
+            RETURN_DEFER(0);
+        }
+        for (char *p = events; p < events + n;){
+            struct inotify_event *event = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + event->len;
+            if (event->mask & IN_Q_OVERFLOW) {
+                fz_log(FZ_WARNING, "File change events were lost, the janitor's sweeps catch up on them");
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                /* The directory is gone, a later commit into it watches it again */
+                struct watch_dir_map_s *dir = hmgetp_null(watcher->wds, event->wd);
+                if (NULL == dir) continue;
+                free_prefixes(dir->value);
+                (void)hmdel(watcher->wds, event->wd);
+                for (size_t i = shlenu(watcher->dirs); 0 < i; i--){
+                    if (event->wd == watcher->dirs[i - 1].value) (void)shdel(watcher->dirs, watcher->dirs[i - 1].key);
+                }
+                continue;
+            }
+            struct watch_dir_map_s *dir = hmgetp_null(watcher->wds, event->wd);
+            if (NULL == dir || 0 == event->len) continue;
+            for (size_t i = 0; i < arrlenu(dir->value); i++){
+                snprintf(path, sizeof(path), "%s%s", dir->value[i], event->name);
+                shput(changed, path, 1);
+            }
+        }
+    }
+    for (size_t i = 0; i < shlenu(changed); i++){
+        if (NULL != ignore_path && 0 == strcmp(changed[i].key, ignore_path)) continue;
+        size_t nrows = 0;
+        if (!fz_commit_file_removal(ctx, changed[i].key, &nrows)) RETURN_DEFER(0);
+        if (0 < nrows) fz_log(FZ_INFO, "File %s changed, its %lu chunk row(s) are no longer scavenged", changed[i].key, nrows);
+    }
+#else
+    (void)ctx;
+    (void)ignore_path;
+#endif
+    defer:
+        if (NULL != changed) shfree(changed);
+        return result;
+}
+
+
+static void free_prefixes(char **prefixes){
+    for (size_t i = 0; i < arrlenu(prefixes); i++) free(prefixes[i]);
+    if (NULL != prefixes) arrfree(prefixes);
+}
@@ -0,0 +1,195 @@
+/*
+   fzlz.h - single header LZ77 block codec, byte compatible with the LZ4 block format.
+
+   Written for filezap, no code is taken from the reference LZ4 sources. Streams produced by
+   `fzlz_compress` decode with any LZ4 block decoder and `fzlz_decompress` accepts any valid
+   LZ4 block, the frame format (magic, block headers, content checksums) is not implemented.
+
+   Do this:
+      #define FZLZ_IMPLEMENTATION
+   before you include this file in *one* C file to create the implementation.
+
+   API:
+      size_t fzlz_compress_bound(size_t size);
+         Worst case size of a compressed block for `size` input bytes.
+
+      size_t fzlz_compress(const char *src, size_t src_size, char *dst, size_t dst_capacity);
+         Greedy single pass compressor with a 4K entry hash table on the stack.
+         Returns the compressed size, or 0 if the output does not fit in `dst_capacity`.
+
+      long fzlz_decompress(const char *src, size_t src_size, char *dst, size_t dst_capacity);
+         Bounds checked decoder, never reads past `src_size` nor writes past `dst_capacity`.
+         Returns the decompressed size, or -1 if the block is malformed or does not fit.
+
+   This is free and unencumbered software released into the public domain.
+*/
+
+#ifndef FZLZ_H_
+#define FZLZ_H_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t fzlz_compress_bound(size_t size);
+size_t fzlz_compress(const char *src, size_t src_size, char *dst, size_t dst_capacity);
+long fzlz_decompress(const char *src, size_t src_size, char *dst, size_t dst_capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FZLZ_H_ */
+
+
+#ifdef FZLZ_IMPLEMENTATION
+
+#include <stdint.h>
+#include <string.h>
+
+#define FZLZ_MIN_MATCH 4
+#define FZLZ_MAX_OFFSET 65535
+/* The format requires the last 5 bytes to be literals and the last match to start at least 12 bytes before the end */
+#define FZLZ_LAST_LITERALS 5
+#define FZLZ_MF_LIMIT 12
+#define FZLZ_HASH_LOG 12
+/* Every 2^FZLZ_SKIP_TRIGGER bytes without a match the search step grows by one, incompressible input is skipped quickly */
+#define FZLZ_SKIP_TRIGGER 6
+
+
+static inline uint32_t fzlz__read32(const uint8_t *p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+
+static inline uint32_t fzlz__hash(uint32_t sequence){
+    return (sequence * 2654435761U) >> (32 - FZLZ_HASH_LOG);
+}
+
+
+/* Writes the 255-run continuation of a length whose nibble saturated at 15 */
+static inline uint8_t *fzlz__put_length(uint8_t *op, size_t len){
+    for (; len >= 255; len -= 255) *op++ = 255;
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+
+size_t fzlz_compress_bound(size_t size){
+    return size + size / 255 + 16;
+}
+
+
+size_t fzlz_compress(const char *src, size_t src_size, char *dst, size_t dst_capacity){
+    uint32_t table[1 << FZLZ_HASH_LOG];
+    const uint8_t *base = (const uint8_t *)src;
+    const uint8_t *ip = base;
+    const uint8_t *anchor = base;
+    const uint8_t *iend = base + src_size;
+    uint8_t *op = (uint8_t *)dst;
+    uint8_t *oend = op + dst_capacity;
+
+    if (src_size > 0xffffffffu) return 0;
+    memset(table, 0, sizeof(table));
+    if (src_size > FZLZ_MF_LIMIT){
+        const uint8_t *mflimit = iend - FZLZ_MF_LIMIT;
+        const uint8_t *matchlimit = iend - FZLZ_LAST_LITERALS;
+        while (ip < mflimit){
+            uint32_t sequence = fzlz__read32(ip);
+            uint32_t h = fzlz__hash(sequence);
+            const uint8_t *ref = base + table[h];
+            table[h] = (uint32_t)(ip - base);
+            if (ref >= ip || (size_t)(ip - ref) > FZLZ_MAX_OFFSET || fzlz__read32(ref) != sequence){
+                ip += 1 + ((size_t)(ip - anchor) >> FZLZ_SKIP_TRIGGER);
+                continue;
+            }
+            while (ip > anchor && ref > base && ip[-1] == ref[-1]) {ip--; ref--;}
+            const uint8_t *mend = ip + FZLZ_MIN_MATCH;
+            const uint8_t *rend = ref + FZLZ_MIN_MATCH;
+            while (mend < matchlimit && *mend == *rend) {mend++; rend++;}
+
+            size_t literals = (size_t)(ip - anchor);
+            size_t match = (size_t)(mend - ip) - FZLZ_MIN_MATCH;
+            size_t need = 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1;
+            if ((size_t)(oend - op) < need) return 0;
+            uint8_t *token = op++;
+            *token = (uint8_t)(((literals >= 15)? 15 : literals) << 4);
+            if (literals >= 15) op = fzlz__put_length(op, literals - 15);
+            memcpy(op, anchor, literals);
+            op += literals;
+            size_t offset = (size_t)(ip - ref);
+            *op++ = (uint8_t)(offset & 0xff);
+            *op++ = (uint8_t)(offset >> 8);
+            *token |= (uint8_t)((match >= 15)? 15 : match);
+            if (match >= 15) op = fzlz__put_length(op, match - 15);
+
+            ip = mend;
+            anchor = ip;
+            /* Seed the table inside the match, runs right after it are found without a step of skipping */
+            if (ip < mflimit) table[fzlz__hash(fzlz__read32(ip - 2))] = (uint32_t)(ip - 2 - base);
+        }
+    }
+
+    size_t literals = (size_t)(iend - anchor);
+    if ((size_t)(oend - op) < 1 + literals / 255 + 1 + literals) return 0;
+    *op++ = (uint8_t)(((literals >= 15)? 15 : literals) << 4);
+    if (literals >= 15) op = fzlz__put_length(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+    return (size_t)(op - (uint8_t *)dst);
+}
+
+
+long fzlz_decompress(const char *src, size_t src_size, char *dst, size_t dst_capacity){
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + src_size;
+    uint8_t *base = (uint8_t *)dst;
+    uint8_t *op = base;
+    uint8_t *oend = base + dst_capacity;
+
+    while (ip < iend){
+        unsigned token = *ip++;
+        size_t literals = token >> 4;
+        if (15 == literals){
+            unsigned s = 255;
+            while (255 == s){
+                if (ip >= iend) return -1;
+                s = *ip++;
+                literals += s;
+            }
+        }
+        if ((size_t)(iend - ip) < literals || (size_t)(oend - op) < literals) return -1;
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        /* The last sequence carries literals only */
+        if (ip == iend) break;
+
+        if (iend - ip < 2) return -1;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (0 == offset || offset > (size_t)(op - base)) return -1;
+        size_t match = token & 15;
+        if (15 == match){
+            unsigned s = 255;
+            while (255 == s){
+                if (ip >= iend) return -1;
+                s = *ip++;
+                match += s;
+            }
+        }
+        match += FZLZ_MIN_MATCH;
+        if ((size_t)(oend - op) < match) return -1;
+        const uint8_t *ref = op - offset;
+        if (offset >= match) memcpy(op, ref, match);
+        else for (size_t i = 0; i < match; i++) op[i] = ref[i]; /* Overlapping copy repeats the last `offset` bytes */
+        op += match;
+    }
+    return (long)(op - base);
+}
+
+#endif /* FZLZ_IMPLEMENTATION */
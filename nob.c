@@ -27,6 +27,15 @@ int main(int argc, char *argv[]){
         {.src_file = "core/sndr_recv.c", .target_file = BUILD_PATH"sndr_recv.o"},
         {.src_file = "core/query_tables.c", .target_file = BUILD_PATH"query_tables.o"},
         {.src_file = "core/misc.c", .target_file = BUILD_PATH"misc.o"},
+        {.src_file = "core/assembly.c", .target_file = BUILD_PATH"assembly.o"},
+        {.src_file = "core/blob_store.c", .target_file = BUILD_PATH"blob_store.o"},
+        {.src_file = "core/chunk_index.c", .target_file = BUILD_PATH"chunk_index.o"},
+        {.src_file = "core/chunk_lsm.c", .target_file = BUILD_PATH"chunk_lsm.o"},
+        {.src_file = "core/chunk_filter.c", .target_file = BUILD_PATH"chunk_filter.o"},
+        {.src_file = "core/chunk_cache.c", .target_file = BUILD_PATH"chunk_cache.o"},
+        {.src_file = "core/compress.c", .target_file = BUILD_PATH"compress.o"},
+        {.src_file = "core/watcher.c", .target_file = BUILD_PATH"watcher.o"},
+        {.src_file = "core/meta_writer.c", .target_file = BUILD_PATH"meta_writer.o"},
     };
 
     for (int i = 0; i < NOB_ARRAY_LEN(objects); i++){
@@ -54,6 +63,11 @@ int main(int argc, char *argv[]){
         {.src_file = TEST_PATH"test_chunk_dedup.c", .target_file = BUILD_PATH"test_chunk_dedup"},
         {.src_file = TEST_PATH"test_sender_receiver.c", .target_file = BUILD_PATH"test_sender_receiver"},
         {.src_file = TEST_PATH"test_janitor.c", .target_file = BUILD_PATH"test_janitor"},
+        {.src_file = TEST_PATH"test_blob_migrate.c", .target_file = BUILD_PATH"test_blob_migrate"},
+        {.src_file = TEST_PATH"test_fzlz.c", .target_file = BUILD_PATH"test_fzlz"},
+        {.src_file = TEST_PATH"test_rechunk_append.c", .target_file = BUILD_PATH"test_rechunk_append"},
+        {.src_file = TEST_PATH"test_chunk_lsm.c", .target_file = BUILD_PATH"test_chunk_lsm"},
+        {.src_file = TEST_PATH"test_db_pool.c", .target_file = BUILD_PATH"test_db_pool"},
     };
     for (int i = 0; i < NOB_ARRAY_LEN(tests); i++){
         nob_cc(&cmd);
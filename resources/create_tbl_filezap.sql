@@ -1,7 +1,65 @@
-CREATE TABLE IF NOT EXISTS filezap_chunks(
-	id INTEGER PRIMARY KEY AUTOINCREMENT,
+CREATE TABLE IF NOT EXISTS filezap_files(
+    file_id INTEGER PRIMARY KEY,
+    file_path TEXT NOT NULL UNIQUE
+);
+
+CREATE TABLE IF NOT EXISTS filezap_chunk_locs(
     chunk_checksum INTEGER NOT NULL,
+    file_id INTEGER NOT NULL,
     cutpoint INTEGER NOT NULL,
     chunk_size INTEGER NOT NULL,
-    file_path TEXT NOT NULL
+    PRIMARY KEY (chunk_checksum, file_id, cutpoint)
+) WITHOUT ROWID;
+
+CREATE INDEX IF NOT EXISTS filezap_chunk_locs_file ON filezap_chunk_locs(file_id);
+
+CREATE TABLE IF NOT EXISTS filezap_chunk_refs(
+    chunk_checksum INTEGER PRIMARY KEY,
+    refcount INTEGER NOT NULL,
+    zero_since INTEGER
+);
+
+CREATE INDEX IF NOT EXISTS filezap_chunk_refs_unreferenced ON filezap_chunk_refs(zero_since) WHERE refcount <= 0;
+
+CREATE TABLE IF NOT EXISTS filezap_blob_state(
+    chunk_checksum INTEGER PRIMARY KEY,
+    blob_size INTEGER NOT NULL,
+    mtime_ns INTEGER NOT NULL,
+    inode INTEGER NOT NULL,
+    verified_at INTEGER NOT NULL,
+    pack_id INTEGER NOT NULL DEFAULT 0,
+    pack_offset INTEGER NOT NULL DEFAULT 0,
+    raw_size INTEGER NOT NULL DEFAULT 0
+);
+
+CREATE TABLE IF NOT EXISTS filezap_meta(
+    key TEXT PRIMARY KEY,
+    value INTEGER NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS filezap_meta_text(
+    key TEXT PRIMARY KEY,
+    value TEXT NOT NULL
+);
+
+CREATE TABLE IF NOT EXISTS filezap_packs(
+    pack_id INTEGER PRIMARY KEY,
+    length INTEGER NOT NULL,
+    sealed INTEGER NOT NULL DEFAULT 0
+);
+
+CREATE TABLE IF NOT EXISTS filezap_fingerprints(
+    file_path TEXT PRIMARY KEY,
+    file_size INTEGER NOT NULL,
+    mtime_ns INTEGER NOT NULL,
+    ctime_ns INTEGER NOT NULL,
+    inode INTEGER NOT NULL,
+    chunk_strategy INTEGER NOT NULL,
+    chunk_size INTEGER NOT NULL,
+    file_checksum INTEGER NOT NULL,
+    chunk_root INTEGER NOT NULL,
+    chunk_seq BLOB NOT NULL,
+    hash_state BLOB
 );
+
+PRAGMA user_version = 1;
@@ -1 +1,9 @@
-DROP TABLE IF EXISTS filezap_chunks;
\ No newline at end of file
+DROP TABLE IF EXISTS filezap_chunks;
+DROP TABLE IF EXISTS filezap_chunk_locs;
+DROP TABLE IF EXISTS filezap_files;
+DROP TABLE IF EXISTS filezap_chunk_refs;
+DROP TABLE IF EXISTS filezap_blob_state;
+DROP TABLE IF EXISTS filezap_packs;
+DROP TABLE IF EXISTS filezap_meta;
+DROP TABLE IF EXISTS filezap_fingerprints;
+PRAGMA user_version = 0;
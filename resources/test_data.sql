@@ -1,165 +1,168 @@
--- Insert statements for filezap_chunks table
-INSERT INTO filezap_chunks (chunk_checksum, cutpoint, chunk_size, file_path) VALUES
-(13477075595753901201, 0, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2304114769992363309, 65536, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2692542758167785437, 131072, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2704543077279889327, 196608, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12121771075136018378, 262144, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17250159457635769937, 327680, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14496100475515301526, 393216, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12301772460194319561, 458752, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15992994777061387297, 524288, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9173734245907859416, 589824, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(148332303237917181, 655360, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14142189680457678717, 720896, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13035614427888643841, 786432, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(712330407546027371, 851968, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3140898073255068910, 917504, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(262064201968858920, 983040, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17382881851143753399, 1048576, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14998085817389019273, 1114112, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9092973959041214754, 1179648, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3844667637791527604, 1245184, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15560249008787024433, 1310720, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2464438243030359548, 1376256, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(5543175423740427415, 1441792, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13284227928939096764, 1507328, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14463294324743825524, 1572864, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3115802258650258347, 1638400, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4905210454195890083, 1703936, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(1217021006651472592, 1769472, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8519807187601659193, 1835008, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(18350676228492135406, 1900544, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9624039379162824603, 1966080, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11688056801344814879, 2031616, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13068895217237507120, 2097152, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8857603705392367581, 2162688, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(18044437224035026752, 2228224, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2607462040808291474, 2293760, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15789559727082089745, 2359296, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4673411610371093166, 2424832, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13811610795071074348, 2490368, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3012016925624815736, 2555904, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17256317452972517673, 2621440, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13194652474562430246, 2686976, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15836594554029148175, 2752512, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17892072762720725260, 2818048, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(7956184826293839466, 2883584, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15025266795216334971, 2949120, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13311317437446231905, 3014656, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14478210219643313812, 3080192, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14191490440842778000, 3145728, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2852539738393865002, 3211264, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12354049972653256420, 3276800, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(1873950469936323379, 3342336, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3299238108755829542, 3407872, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(16646511095928894624, 3473408, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(18086413463121742045, 3538944, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(6030438559615369164, 3604480, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(16578166223352645437, 3670016, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12156272316695147732, 3735552, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3975015425646533046, 3801088, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12137348066624544627, 3866624, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9858460895682877554, 3932160, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8476909652573388813, 3997696, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3128965204240009616, 4063232, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(16948658480836550707, 4128768, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(18268581234930578017, 4194304, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(10041812266182593081, 4259840, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11954247904179824036, 4325376, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14935844816669970861, 4390912, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(16128896981658868847, 4456448, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15502712351217259161, 4521984, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9503475648655727585, 4587520, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3248996335515177817, 4653056, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14429055643640210254, 4718592, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13531009722280078325, 4784128, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15253772896484337374, 4849664, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(6079558667287231115, 4915200, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8703361724268232554, 4980736, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(1182671216012927189, 5046272, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11012754726148514552, 5111808, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(79968980133974269, 5177344, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(10778190820304482741, 5242880, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2269030743883700655, 5308416, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9370047347279626350, 5373952, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12395545345425808713, 5439488, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(10555755304626753148, 5505024, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13574907373458227718, 5570560, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(10707580681866895336, 5636096, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11649826202632573565, 5701632, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17191572870766009879, 5767168, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17790760878095732082, 5832704, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13686958978753339986, 5898240, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(1595336514378285721, 5963776, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3337365435088688433, 6029312, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11245345188663304992, 6094848, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8128869534906866364, 6160384, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4541494905264573017, 6225920, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4715376621572382722, 6291456, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(1883915121181249690, 6356992, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(5956445666882471542, 6422528, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2686000042453448797, 6488064, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2048583603193661670, 6553600, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14616759078319131789, 6619136, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(7207986735696114018, 6684672, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11589386696671829367, 6750208, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9055480147462232500, 6815744, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(6077173092656717779, 6881280, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12294838096617870431, 6946816, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15493168448953380802, 7012352, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15192695127881368542, 7077888, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11246897149050058049, 7143424, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9687395520353879736, 7208960, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13570317456264931844, 7274496, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4859850430189721146, 7340032, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9192579609452202942, 7405568, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(12688249473120561472, 7471104, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9506112162251438148, 7536640, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13901633607971982266, 7602176, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4655507875649011651, 7667712, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(7236949989250653609, 7733248, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8614430574178513111, 7798784, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17508214597436951009, 7864320, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(6940149992026263312, 7929856, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9726968363187747276, 7995392, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(6831338171912262024, 8060928, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(389846288584471205, 8126464, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(14523441128285911629, 8192000, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11076285560500794062, 8257536, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9012692674432203697, 8323072, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4577361537559145269, 8388608, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11547981311018565905, 8454144, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(10190374546017683278, 8519680, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(7735539170761975555, 8585216, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8084023439243938308, 8650752, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2395483114843101273, 8716288, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(16589109429969831346, 8781824, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(10177156364779073408, 8847360, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(10463716749576582594, 8912896, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(11484652056754019346, 8978432, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(1214663150574795142, 9043968, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17180359045965252052, 9109504, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8862848237226278333, 9175040, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13347046371261203959, 9240576, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(840056881992448721, 9306112, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13078451307198907018, 9371648, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8453434770230560597, 9437184, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3915034771289948644, 9502720, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(15612029088519157587, 9568256, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(5257565911590796390, 9633792, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(17101885332893029631, 9699328, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4851770149438794476, 9764864, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2348904930430659792, 9830400, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(3172930235525042845, 9895936, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(2334391730265868767, 9961472, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(8374945556350702019, 10027008, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(6572077208392837598, 10092544, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(4520640033219092925, 10158080, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(6743829919195295673, 10223616, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(5063600368019674924, 10289152, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(13709939954630006553, 10354688, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(18024374845231681311, 10420224, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(897856569208982135, 10485760, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(9658423860461907508, 10551296, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4"),
-(1258342872410273529, 10616832, 65536, "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4");
\ No newline at end of file
+-- Insert statements for filezap_files and filezap_chunk_locs tables
+INSERT INTO filezap_files (file_path) VALUES ("examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4");
+INSERT INTO filezap_chunk_locs (chunk_checksum, file_id, cutpoint, chunk_size)
+SELECT v.column1, f.file_id, v.column2, v.column3 FROM (VALUES
+(-4969668477955650415, 0, 65536),
+(2304114769992363309, 65536, 65536),
+(2692542758167785437, 131072, 65536),
+(2704543077279889327, 196608, 65536),
+(-6324972998573533238, 262144, 65536),
+(-1196584616073781679, 327680, 65536),
+(-3950643598194250090, 393216, 65536),
+(-6144971613515232055, 458752, 65536),
+(-2453749296648164319, 524288, 65536),
+(9173734245907859416, 589824, 65536),
+(148332303237917181, 655360, 65536),
+(-4304554393251872899, 720896, 65536),
+(-5411129645820907775, 786432, 65536),
+(712330407546027371, 851968, 65536),
+(3140898073255068910, 917504, 65536),
+(262064201968858920, 983040, 65536),
+(-1063862222565798217, 1048576, 65536),
+(-3448658256320532343, 1114112, 65536),
+(9092973959041214754, 1179648, 65536),
+(3844667637791527604, 1245184, 65536),
+(-2886495064922527183, 1310720, 65536),
+(2464438243030359548, 1376256, 65536),
+(5543175423740427415, 1441792, 65536),
+(-5162516144770454852, 1507328, 65536),
+(-3983449748965726092, 1572864, 65536),
+(3115802258650258347, 1638400, 65536),
+(4905210454195890083, 1703936, 65536),
+(1217021006651472592, 1769472, 65536),
+(8519807187601659193, 1835008, 65536),
+(-96067845217416210, 1900544, 65536),
+(-8822704694546727013, 1966080, 65536),
+(-6758687272364736737, 2031616, 65536),
+(-5377848856472044496, 2097152, 65536),
+(8857603705392367581, 2162688, 65536),
+(-402306849674524864, 2228224, 65536),
+(2607462040808291474, 2293760, 65536),
+(-2657184346627461871, 2359296, 65536),
+(4673411610371093166, 2424832, 65536),
+(-4635133278638477268, 2490368, 65536),
+(3012016925624815736, 2555904, 65536),
+(-1190426620737033943, 2621440, 65536),
+(-5252091599147121370, 2686976, 65536),
+(-2610149519680403441, 2752512, 65536),
+(-554671310988826356, 2818048, 65536),
+(7956184826293839466, 2883584, 65536),
+(-3421477278493216645, 2949120, 65536),
+(-5135426636263319711, 3014656, 65536),
+(-3968533854066237804, 3080192, 65536),
+(-4255253632866773616, 3145728, 65536),
+(2852539738393865002, 3211264, 65536),
+(-6092694101056295196, 3276800, 65536),
+(1873950469936323379, 3342336, 65536),
+(3299238108755829542, 3407872, 65536),
+(-1800232977780656992, 3473408, 65536),
+(-360330610587809571, 3538944, 65536),
+(6030438559615369164, 3604480, 65536),
+(-1868577850356906179, 3670016, 65536),
+(-6290471757014403884, 3735552, 65536),
+(3975015425646533046, 3801088, 65536),
+(-6309396007085006989, 3866624, 65536),
+(-8588283178026674062, 3932160, 65536),
+(8476909652573388813, 3997696, 65536),
+(3128965204240009616, 4063232, 65536),
+(-1498085592873000909, 4128768, 65536),
+(-178162838778973599, 4194304, 65536),
+(-8404931807526958535, 4259840, 65536),
+(-6492496169529727580, 4325376, 65536),
+(-3510899257039580755, 4390912, 65536),
+(-2317847092050682769, 4456448, 65536),
+(-2944031722492292455, 4521984, 65536),
+(-8943268425053824031, 4587520, 65536),
+(3248996335515177817, 4653056, 65536),
+(-4017688430069341362, 4718592, 65536),
+(-4915734351429473291, 4784128, 65536),
+(-3192971177225214242, 4849664, 65536),
+(6079558667287231115, 4915200, 65536),
+(8703361724268232554, 4980736, 65536),
+(1182671216012927189, 5046272, 65536),
+(-7433989347561037064, 5111808, 65536),
+(79968980133974269, 5177344, 65536),
+(-7668553253405068875, 5242880, 65536),
+(2269030743883700655, 5308416, 65536),
+(-9076696726429925266, 5373952, 65536),
+(-6051198728283742903, 5439488, 65536),
+(-7890988769082798468, 5505024, 65536),
+(-4871836700251323898, 5570560, 65536),
+(-7739163391842656280, 5636096, 65536),
+(-6796917871076978051, 5701632, 65536),
+(-1255171202943541737, 5767168, 65536),
+(-655983195613819534, 5832704, 65536),
+(-4759785094956211630, 5898240, 65536),
+(1595336514378285721, 5963776, 65536),
+(3337365435088688433, 6029312, 65536),
+(-7201398885046246624, 6094848, 65536),
+(8128869534906866364, 6160384, 65536),
+(4541494905264573017, 6225920, 65536),
+(4715376621572382722, 6291456, 65536),
+(1883915121181249690, 6356992, 65536),
+(5956445666882471542, 6422528, 65536),
+(2686000042453448797, 6488064, 65536),
+(2048583603193661670, 6553600, 65536),
+(-3829984995390419827, 6619136, 65536),
+(7207986735696114018, 6684672, 65536),
+(-6857357377037722249, 6750208, 65536),
+(9055480147462232500, 6815744, 65536),
+(6077173092656717779, 6881280, 65536),
+(-6151905977091681185, 6946816, 65536),
+(-2953575624756170814, 7012352, 65536),
+(-3254048945828183074, 7077888, 65536),
+(-7199846924659493567, 7143424, 65536),
+(-8759348553355671880, 7208960, 65536),
+(-4876426617444619772, 7274496, 65536),
+(4859850430189721146, 7340032, 65536),
+(9192579609452202942, 7405568, 65536),
+(-5758494600588990144, 7471104, 65536),
+(-8940631911458113468, 7536640, 65536),
+(-4545110465737569350, 7602176, 65536),
+(4655507875649011651, 7667712, 65536),
+(7236949989250653609, 7733248, 65536),
+(8614430574178513111, 7798784, 65536),
+(-938529476272600607, 7864320, 65536),
+(6940149992026263312, 7929856, 65536),
+(-8719775710521804340, 7995392, 65536),
+(6831338171912262024, 8060928, 65536),
+(389846288584471205, 8126464, 65536),
+(-3923302945423639987, 8192000, 65536),
+(-7370458513208757554, 8257536, 65536),
+(9012692674432203697, 8323072, 65536),
+(4577361537559145269, 8388608, 65536),
+(-6898762762690985711, 8454144, 65536),
+(-8256369527691868338, 8519680, 65536),
+(7735539170761975555, 8585216, 65536),
+(8084023439243938308, 8650752, 65536),
+(2395483114843101273, 8716288, 65536),
+(-1857634643739720270, 8781824, 65536),
+(-8269587708930478208, 8847360, 65536),
+(-7983027324132969022, 8912896, 65536),
+(-6962092016955532270, 8978432, 65536),
+(1214663150574795142, 9043968, 65536),
+(-1266385027744299564, 9109504, 65536),
+(8862848237226278333, 9175040, 65536),
+(-5099697702448347657, 9240576, 65536),
+(840056881992448721, 9306112, 65536),
+(-5368292766510644598, 9371648, 65536),
+(8453434770230560597, 9437184, 65536),
+(3915034771289948644, 9502720, 65536),
+(-2834714985190394029, 9568256, 65536),
+(5257565911590796390, 9633792, 65536),
+(-1344858740816521985, 9699328, 65536),
+(4851770149438794476, 9764864, 65536),
+(2348904930430659792, 9830400, 65536),
+(3172930235525042845, 9895936, 65536),
+(2334391730265868767, 9961472, 65536),
+(8374945556350702019, 10027008, 65536),
+(6572077208392837598, 10092544, 65536),
+(4520640033219092925, 10158080, 65536),
+(6743829919195295673, 10223616, 65536),
+(5063600368019674924, 10289152, 65536),
+(-4736804119079545063, 10354688, 65536),
+(-422369228477870305, 10420224, 65536),
+(897856569208982135, 10485760, 65536),
+(-8788320213247644108, 10551296, 65536),
+(1258342872410273529, 10616832, 65536)
+) AS v JOIN filezap_files AS f ON f.file_path = "examples/dest/Free Nationals - Beauty & Essex (feat. Daniel Caesar & Unknown Mortal Orchestra)(1).mp4";
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_IMPLEMENTATION
+#define JSN_IMPLEMENTATION
+#define STB_DS_IMPLEMENTATION
+#include "core.h"
+#include <sqlite3.h>
+
+/* The store and its database live in a directory of their own, it is emptied before and after the run */
+#define MIGRATE_TEST_DIR "tmp/migrate_test/"
+#define MIGRATE_TEST_DB MIGRATE_TEST_DIR"filezap.db"
+#define MIGRATE_TEST_BLOBS 6
+#define MIGRATE_TEST_BLOB_SIZE KB(4)
+
+#define EXPECT(cond) \
+    do {\
+        if (!(cond)) {\
+            fz_log(FZ_ERROR, "%s:%d: expected %s", __FILE__, __LINE__, #cond);\
+            RETURN_DEFER(1);\
+        }\
+    } while(0)
+
+
+static void remove_dir(const char *dir_path){
+    char path[RESERVED];
+    DIR *dir = opendir(dir_path);
+    if (NULL == dir) return;
+    struct dirent *entry = NULL;
+    while (NULL != (entry = readdir(dir))){
+        if ('.' == entry->d_name[0]) continue;
+        snprintf(path, sizeof(path), "%s%s/", dir_path, entry->d_name);
+        remove_dir(path);
+        snprintf(path, sizeof(path), "%s%s", dir_path, entry->d_name);
+        remove(path);
+    }
+    closedir(dir);
+}
+
+
+static int open_ctx(fz_ctx_t *ctx){
+    memset(ctx, 0, sizeof(*ctx));
+    return fz_ctx_init(ctx, FZ_FIXED_SIZED_CHUNK, MIGRATE_TEST_DIR, MIGRATE_TEST_DIR, MIGRATE_TEST_DB, NULL, NULL);
+}
+
+
+static void flat_path(fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size){
+    snprintf(buffer, buffer_size, "%s%016llx", MIGRATE_TEST_DIR, chunk_checksum);
+}
+
+
+static void shard_path(fz_hex_digest_t chunk_checksum, char *buffer, size_t buffer_size){
+    snprintf(buffer, buffer_size, "%s%02x/%02x/%016llx",
+        MIGRATE_TEST_DIR, (unsigned)(chunk_checksum >> 56), (unsigned)((chunk_checksum >> 48) & 0xff), chunk_checksum);
+}
+
+
+/* Writes a blob the way stores before sharding did, straight under `metadata_loc`, and records it as verified */
+static int seed_flat_blob(fz_ctx_t *ctx, uint64_t seed, fz_hex_digest_t *chunk_checksum){
+    char data[MIGRATE_TEST_BLOB_SIZE];
+    char path[RESERVED];
+    for (size_t i = 0; i < sizeof(data); i++){
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        data[i] = (char)seed;
+    }
+    xxhash_hexdigest(data, sizeof(data), chunk_checksum);
+    flat_path(*chunk_checksum, path, sizeof(path));
+    FILE *fh = fopen(path, "wb");
+    if (NULL == fh) return 0;
+    int ok = sizeof(data) == fwrite(data, 1, sizeof(data), fh);
+    ok = 0 == fclose(fh) && ok;
+    return ok && fz_blob_state_record(ctx, *chunk_checksum);
+}
+
+
+/* The blob is known to the state index, opens without needing a rehash and still holds data matching its checksum */
+static int blob_usable(fz_ctx_t *ctx, fz_hex_digest_t chunk_checksum){
+    fz_blob_handle_t blob = {0};
+    char *buffer = NULL;
+    size_t max_alloc = 0, size = 0;
+    fz_hex_digest_t digest = 0;
+    if (!fz_blob_state_get(ctx, chunk_checksum, NULL)) return 0;
+    if (!fz_blob_store_open(ctx, chunk_checksum, &blob)) return 0;
+    int ok = !blob.changed && fz_blob_store_read(&blob, &buffer, &max_alloc, &size);
+    if (ok) xxhash_hexdigest(buffer, size, &digest);
+    fz_blob_store_release(&blob);
+    if (NULL != buffer) free(buffer);
+    return ok && chunk_checksum == digest;
+}
+
+
+int main(int argc, char *argv[]){
+    (void)argc;
+    (void)argv;
+
+    int result = 0;
+    int opened = 0;
+    fz_ctx_t ctx = {0};
+    fz_hex_digest_t checksums[MIGRATE_TEST_BLOBS] = {0};
+    struct stat migrated[MIGRATE_TEST_BLOBS];
+    char path[RESERVED];
+
+    remove_dir(MIGRATE_TEST_DIR);
+    mkdir(MIGRATE_TEST_DIR, 0755);
+    EXPECT(opened = open_ctx(&ctx));
+    for (size_t i = 0; i < MIGRATE_TEST_BLOBS; i++) EXPECT(seed_flat_blob(&ctx, 0x9e3779b97f4a7c15ull + i, &checksums[i]));
+    EXPECT(fz_blob_state_flush(&ctx));
+    for (size_t i = 0; i < MIGRATE_TEST_BLOBS; i++) EXPECT(blob_usable(&ctx, checksums[i]));
+
+    /* Every flat blob moves to its shard path and stays usable without being hashed again */
+    EXPECT(fz_blob_store_migrate(&ctx));
+    for (size_t i = 0; i < MIGRATE_TEST_BLOBS; i++){
+        flat_path(checksums[i], path, sizeof(path));
+        EXPECT(0 != access(path, F_OK));
+        shard_path(checksums[i], path, sizeof(path));
+        EXPECT(0 == stat(path, &migrated[i]));
+        EXPECT(blob_usable(&ctx, checksums[i]));
+    }
+
+    /* A reopened store finds them as well, and a second migration leaves every blob where and as it is */
+    fz_ctx_destroy(&ctx);
+    opened = 0;
+    EXPECT(opened = open_ctx(&ctx));
+    EXPECT(fz_blob_store_migrate(&ctx));
+    for (size_t i = 0; i < MIGRATE_TEST_BLOBS; i++){
+        struct stat meta = {0};
+        flat_path(checksums[i], path, sizeof(path));
+        EXPECT(0 != access(path, F_OK));
+        shard_path(checksums[i], path, sizeof(path));
+        EXPECT(0 == stat(path, &meta));
+        EXPECT(meta.st_ino == migrated[i].st_ino && meta.st_mtim.tv_sec == migrated[i].st_mtim.tv_sec && meta.st_mtim.tv_nsec == migrated[i].st_mtim.tv_nsec);
+        EXPECT(blob_usable(&ctx, checksums[i]));
+    }
+    fz_log(FZ_INFO, "Flat blob migration passed");
+    defer:
+        if (opened) fz_ctx_destroy(&ctx);
+        remove_dir(MIGRATE_TEST_DIR);
+        remove(MIGRATE_TEST_DIR);
+        return result;
+}
@@ -0,0 +1,186 @@
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_IMPLEMENTATION
+#define JSN_IMPLEMENTATION
+#define STB_DS_IMPLEMENTATION
+#include "core.h"
+#include <sqlite3.h>
+
+/* The index and its database live in a directory of their own, it is emptied before and after the run */
+#define LSM_TEST_DIR "tmp/lsm_test/"
+#define LSM_TEST_DB LSM_TEST_DIR"filezap.db"
+#define LSM_TEST_MANIFEST LSM_TEST_DIR"chunk_lsm/MANIFEST"
+
+#define EXPECT(cond) \
+    do {\
+        if (!(cond)) {\
+            fz_log(FZ_ERROR, "%s:%d: expected %s", __FILE__, __LINE__, #cond);\
+            RETURN_DEFER(1);\
+        }\
+    } while(0)
+
+
+static void remove_dir(const char *dir_path){
+    char path[RESERVED];
+    DIR *dir = opendir(dir_path);
+    if (NULL == dir) return;
+    struct dirent *entry = NULL;
+    while (NULL != (entry = readdir(dir))){
+        if ('.' == entry->d_name[0]) continue;
+        snprintf(path, sizeof(path), "%s%s/", dir_path, entry->d_name);
+        remove_dir(path);
+        snprintf(path, sizeof(path), "%s%s", dir_path, entry->d_name);
+        remove(path);
+    }
+    closedir(dir);
+}
+
+
+static int open_ctx(fz_ctx_t *ctx){
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->meta_backend = FZ_META_LSM;
+    return fz_ctx_init(ctx, FZ_FIXED_SIZED_CHUNK, LSM_TEST_DIR, LSM_TEST_DIR, LSM_TEST_DB, NULL, NULL);
+}
+
+
+/* Records `nchunk` chunks with consecutive checksums from `first` as the content of `file_path` */
+static int commit_file(fz_ctx_t *ctx, const char *file_path, uint64_t first, size_t nchunk){
+    uint64_t epoch = 0;
+    fz_meta_job_t job = {.dest_file_path = (char *)file_path};
+    fz_chunk_seq_t *seq = &job.mnfst.chunk_seq;
+    seq->chunk_seq_len = nchunk;
+    seq->chunk_checksum = calloc(nchunk, sizeof(fz_hex_digest_t));
+    seq->cutpoint = calloc(nchunk, sizeof(size_t));
+    seq->chunk_size = calloc(nchunk, sizeof(size_t));
+    int ok = NULL != seq->chunk_checksum && NULL != seq->cutpoint && NULL != seq->chunk_size;
+    for (size_t i = 0; ok && i < nchunk; i++){
+        seq->chunk_checksum[i] = first + i;
+        seq->cutpoint[i] = i * KB(4);
+        seq->chunk_size[i] = KB(4);
+    }
+    ok = ok && fz_commit_chunk_metadata_group(ctx, &job, 1, &epoch);
+    fz_file_manifest_destroy(&job.mnfst);
+    return ok;
+}
+
+
+/* Number of the `nchunk` checksums from `first` that have a recorded location, -1 on failure */
+static long count_located(fz_ctx_t *ctx, uint64_t first, size_t nchunk){
+    fz_file_manifest_t mnfst = {0};
+    struct missing_chunks_map_s *missing = NULL;
+    fz_chunk_t *chunks = NULL;
+    size_t nfound = 0;
+    mnfst.chunk_seq.chunk_seq_len = nchunk;
+    for (size_t i = 0; i < nchunk; i++) hmput(missing, first + i, 1);
+    int ok = fz_query_required_chunk_list(ctx, &mnfst, &chunks, &nfound, &missing);
+    for (size_t i = 0; ok && i < nfound; i++) free((char *)chunks[i].src_file_path);
+    if (NULL != chunks) free(chunks);
+    if (NULL != missing) hmfree(missing);
+    return ok? (long)nfound : -1;
+}
+
+
+/* Number of unreferenced chunks, collected as well if `collect` is set. -1 on failure */
+static long count_unreferenced(fz_ctx_t *ctx, int collect){
+    fz_hex_digest_t *checksums = NULL;
+    if (!fz_query_unreferenced_chunks(ctx, SIZE_MAX, &checksums)) return -1;
+    long n = (long)arrlenu(checksums);
+    if (collect && 0 < n && !fz_commit_chunk_collection(ctx, checksums, (size_t)n)) n = -1;
+    if (NULL != checksums) arrfree(checksums);
+    return n;
+}
+
+
+static int flip_manifest_byte(long offset){
+    FILE *fh = fopen(LSM_TEST_MANIFEST, "r+b");
+    if (NULL == fh) return 0;
+    int ok = 0 == fseek(fh, offset, SEEK_SET);
+    int c = ok? fgetc(fh) : EOF;
+    ok = ok && EOF != c && 0 == fseek(fh, offset, SEEK_SET) && EOF != fputc(c ^ 0x01, fh);
+    return 0 == fclose(fh) && ok;
+}
+
+
+int main(int argc, char *argv[]){
+    (void)argc;
+    (void)argv;
+
+    int result = 0;
+    int opened = 0;
+    fz_ctx_t ctx = {0};
+    char names[200][XXSMALL_RESERVED];
+    char **file_paths = NULL;
+    size_t nrows = 0;
+
+    remove_dir(LSM_TEST_DIR);
+    mkdir(LSM_TEST_DIR, 0755);
+    EXPECT(opened = open_ctx(&ctx));
+
+    /* Commit, a path committed twice keeps its latest content */
+    EXPECT(commit_file(&ctx, "/a", 1000, 100));
+    EXPECT(commit_file(&ctx, "/b", 1050, 100));
+    EXPECT(commit_file(&ctx, "/a", 5000, 10));
+    EXPECT(0 == count_located(&ctx, 1000, 50));
+    EXPECT(100 == count_located(&ctx, 1050, 100));
+    EXPECT(10 == count_located(&ctx, 5000, 10));
+    EXPECT(50 == count_unreferenced(&ctx, 0));
+
+    /* Many small commits compact into a logarithmic number of runs */
+    for (size_t i = 0; i < 200; i++){
+        snprintf(names[i], sizeof(names[i]), "/f%03lu", i);
+        EXPECT(commit_file(&ctx, names[i], 100000 + i * 50, 50));
+    }
+    fz_log(FZ_INFO, "%lu run(s) after 203 commits", arrlenu(ctx.chunk_lsm.runs));
+    EXPECT(arrlenu(ctx.chunk_lsm.runs) < 12);
+    EXPECT(10000 == count_located(&ctx, 100000, 200 * 50));
+
+    /* Remove, the chunks of removed files become unreferenced */
+    const char *removed[] = {"/f000", "/f001", "/b"};
+    EXPECT(fz_commit_file_removals(&ctx, removed, 3, &nrows));
+    EXPECT(200 == nrows);
+    EXPECT(0 == count_located(&ctx, 100000, 100));
+    EXPECT(250 == count_unreferenced(&ctx, 0));
+    EXPECT(fz_query_chunk_files(&ctx, "/f100", 5, &file_paths));
+    EXPECT(5 == arrlenu(file_paths) && 0 == strcmp(file_paths[0], "/f101"));
+
+    /* Collect */
+    EXPECT(250 == count_unreferenced(&ctx, 1));
+    EXPECT(0 == count_unreferenced(&ctx, 0));
+
+    /* Reopen */
+    fz_ctx_destroy(&ctx);
+    EXPECT(opened = open_ctx(&ctx));
+    EXPECT(9900 == count_located(&ctx, 100000, 200 * 50));
+    EXPECT(10 == count_located(&ctx, 5000, 10));
+    EXPECT(0 == count_unreferenced(&ctx, 0));
+
+    /* A collected checksum recorded again is collectable again once its file goes */
+    EXPECT(commit_file(&ctx, "/b", 1050, 5));
+    EXPECT(5 == count_located(&ctx, 1050, 5));
+    EXPECT(fz_commit_file_removal(&ctx, "/b", &nrows));
+    EXPECT(5 == nrows);
+    EXPECT(5 == count_unreferenced(&ctx, 1));
+
+    /* A damaged manifest fails the open and leaves the runs alone, the repaired one opens the same index */
+    fz_ctx_destroy(&ctx);
+    opened = 0;
+    EXPECT(flip_manifest_byte(16));
+    EXPECT(opened = open_ctx(&ctx));
+    EXPECT(-1 == count_located(&ctx, 100000, 200 * 50));
+    fz_ctx_destroy(&ctx);
+    opened = 0;
+    EXPECT(flip_manifest_byte(16));
+    EXPECT(opened = open_ctx(&ctx));
+    EXPECT(9900 == count_located(&ctx, 100000, 200 * 50));
+    fz_log(FZ_INFO, "Chunk index commit, remove, compact, collect and reopen passed");
+    defer:
+        for (size_t i = 0; i < arrlenu(file_paths); i++) free(file_paths[i]);
+        if (NULL != file_paths) arrfree(file_paths);
+        if (opened) fz_ctx_destroy(&ctx);
+        remove_dir(LSM_TEST_DIR);
+        remove(LSM_TEST_DIR);
+        return result;
+}
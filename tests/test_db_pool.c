@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_IMPLEMENTATION
+#define JSN_IMPLEMENTATION
+#define STB_DS_IMPLEMENTATION
+#include "core.h"
+#include <sqlite3.h>
+
+/* The database and the chunk filter the contexts leave behind live in a directory of their own */
+#define POOL_TEST_DIR "tmp/pool_test/"
+#define POOL_TEST_DB POOL_TEST_DIR"filezap.db"
+#define POOL_TEST_FILTER POOL_TEST_DIR"chunk_filter"
+#define POOL_TEST_READERS 2
+#define POOL_TEST_THREADS 8
+#define POOL_TEST_FILES 16
+#define POOL_TEST_CHUNKS 500
+
+#define EXPECT(cond) \
+    do {\
+        if (!(cond)) {\
+            fz_log(FZ_ERROR, "%s:%d: expected %s", __FILE__, __LINE__, #cond);\
+            RETURN_DEFER(1);\
+        }\
+    } while(0)
+
+
+typedef struct lookup_thread_arg_t{
+    fz_ctx_t *ctx;
+    size_t first_file;
+    int ok;
+} lookup_thread_arg_t;
+
+
+typedef struct acquire_thread_arg_t{
+    fz_ctx_t *ctx;
+    fz_db_conn_t *conn;
+    int acquired;
+    pthread_mutex_t mtx;
+} acquire_thread_arg_t;
+
+
+static void remove_db(const char *db_file){
+    char path[RESERVED];
+    remove(db_file);
+    snprintf(path, sizeof(path), "%s-wal", db_file);
+    remove(path);
+    snprintf(path, sizeof(path), "%s-shm", db_file);
+    remove(path);
+}
+
+
+static void sleep_ms(long ms){
+    struct timespec duration = {.tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000};
+    nanosleep(&duration, NULL);
+}
+
+
+/* Records `nchunk` chunks with consecutive checksums from `first` as the content of `file_path` */
+static int commit_file(fz_ctx_t *ctx, const char *file_path, uint64_t first, size_t nchunk){
+    uint64_t epoch = 0;
+    fz_meta_job_t job = {.dest_file_path = (char *)file_path};
+    fz_chunk_seq_t *seq = &job.mnfst.chunk_seq;
+    seq->chunk_seq_len = nchunk;
+    seq->chunk_checksum = calloc(nchunk, sizeof(fz_hex_digest_t));
+    seq->cutpoint = calloc(nchunk, sizeof(size_t));
+    seq->chunk_size = calloc(nchunk, sizeof(size_t));
+    int ok = NULL != seq->chunk_checksum && NULL != seq->cutpoint && NULL != seq->chunk_size;
+    for (size_t i = 0; ok && i < nchunk; i++){
+        seq->chunk_checksum[i] = first + i;
+        seq->cutpoint[i] = i * KB(4);
+        seq->chunk_size[i] = KB(4);
+    }
+    ok = ok && fz_commit_chunk_metadata_group(ctx, &job, 1, &epoch);
+    fz_file_manifest_destroy(&job.mnfst);
+    return ok;
+}
+
+
+/* Number of the `nchunk` checksums from `first` that have a recorded location, -1 on failure */
+static long count_located(fz_ctx_t *ctx, uint64_t first, size_t nchunk){
+    fz_file_manifest_t mnfst = {0};
+    struct missing_chunks_map_s *missing = NULL;
+    fz_chunk_t *chunks = NULL;
+    size_t nfound = 0;
+    mnfst.chunk_seq.chunk_seq_len = nchunk;
+    for (size_t i = 0; i < nchunk; i++) hmput(missing, first + i, 1);
+    int ok = fz_query_required_chunk_list(ctx, &mnfst, &chunks, &nfound, &missing);
+    for (size_t i = 0; ok && i < nfound; i++) free((char *)chunks[i].src_file_path);
+    if (NULL != chunks) free(chunks);
+    if (NULL != missing) hmfree(missing);
+    return ok? (long)nfound : -1;
+}
+
+
+/* Looks up every recorded file a few times, starting at a different one per thread */
+static void *lookup_thread(void *arg){
+    lookup_thread_arg_t *t_arg = arg;
+    t_arg->ok = 1;
+    for (size_t round = 0; round < 4 * POOL_TEST_FILES && t_arg->ok; round++){
+        size_t file = (t_arg->first_file + round) % POOL_TEST_FILES;
+        t_arg->ok = POOL_TEST_CHUNKS == count_located(t_arg->ctx, file * POOL_TEST_CHUNKS, POOL_TEST_CHUNKS);
+    }
+    return NULL;
+}
+
+
+static void *acquire_thread(void *arg){
+    acquire_thread_arg_t *t_arg = arg;
+    fz_db_conn_t *conn = NULL;
+    int ok = fz_db_read_acquire(t_arg->ctx, &conn);
+    pthread_mutex_lock(&t_arg->mtx);
+    t_arg->conn = conn;
+    t_arg->acquired = ok;
+    pthread_mutex_unlock(&t_arg->mtx);
+    return NULL;
+}
+
+
+int main(int argc, char *argv[]){
+    (void)argc;
+    (void)argv;
+
+    int result = 0;
+    int opened = 0, memory_opened = 0;
+    fz_ctx_t ctx = {0}, memory_ctx = {0};
+    char file_path[XXSMALL_RESERVED];
+    pthread_t threads[POOL_TEST_THREADS];
+    lookup_thread_arg_t args[POOL_TEST_THREADS];
+    fz_db_conn_t *held[POOL_TEST_READERS] = {0};
+
+    mkdir(POOL_TEST_DIR, 0755);
+    remove_db(POOL_TEST_DB);
+    remove(POOL_TEST_FILTER);
+    EXPECT(opened = fz_ctx_init(&ctx, FZ_FIXED_SIZED_CHUNK, POOL_TEST_DIR, POOL_TEST_DIR, POOL_TEST_DB, NULL, NULL));
+    ctx.ctx_attrs.db_readers = POOL_TEST_READERS;
+    for (size_t i = 0; i < POOL_TEST_FILES; i++){
+        snprintf(file_path, sizeof(file_path), "/pool/file-%02lu", i);
+        EXPECT(commit_file(&ctx, file_path, i * POOL_TEST_CHUNKS, POOL_TEST_CHUNKS));
+    }
+
+    /* More threads than readers, each sees every committed row and the pool never opens more than its limit */
+    for (size_t i = 0; i < POOL_TEST_THREADS; i++){
+        args[i] = (lookup_thread_arg_t){.ctx = &ctx, .first_file = i};
+        EXPECT(0 == pthread_create(&threads[i], NULL, lookup_thread, &args[i]));
+    }
+    for (size_t i = 0; i < POOL_TEST_THREADS; i++) pthread_join(threads[i], NULL);
+    for (size_t i = 0; i < POOL_TEST_THREADS; i++) EXPECT(args[i].ok);
+    EXPECT(0 < ctx.db_pool.nopen && ctx.db_pool.nopen <= POOL_TEST_READERS);
+    EXPECT(!ctx.db_pool.failed);
+
+    /* With every reader handed out the next caller waits for a release */
+    for (size_t i = 0; i < POOL_TEST_READERS; i++) EXPECT(fz_db_read_acquire(&ctx, &held[i]));
+    acquire_thread_arg_t waiting = {.ctx = &ctx, .mtx = PTHREAD_MUTEX_INITIALIZER};
+    pthread_t waiter;
+    EXPECT(0 == pthread_create(&waiter, NULL, acquire_thread, &waiting));
+    sleep_ms(100);
+    pthread_mutex_lock(&waiting.mtx);
+    int acquired_early = waiting.acquired;
+    pthread_mutex_unlock(&waiting.mtx);
+    fz_db_read_release(&ctx, held[0]);
+    held[0] = NULL;
+    pthread_join(waiter, NULL);
+    EXPECT(!acquired_early && waiting.acquired);
+    fz_db_read_release(&ctx, waiting.conn);
+    for (size_t i = 0; i < POOL_TEST_READERS; i++) if (NULL != held[i]) fz_db_read_release(&ctx, held[i]);
+    EXPECT(POOL_TEST_READERS == arrlenu(ctx.db_pool.idle));
+
+    /* An in-memory database has no file to share, the pool fails once and lookups stay on the context's connection */
+    EXPECT(memory_opened = fz_ctx_init(&memory_ctx, FZ_FIXED_SIZED_CHUNK, POOL_TEST_DIR, POOL_TEST_DIR, ":memory:", NULL, NULL));
+    EXPECT(commit_file(&memory_ctx, "/pool/memory", 0, POOL_TEST_CHUNKS));
+    EXPECT(POOL_TEST_CHUNKS == count_located(&memory_ctx, 0, POOL_TEST_CHUNKS));
+    EXPECT(memory_ctx.db_pool.failed && 0 == memory_ctx.db_pool.nopen);
+    EXPECT(POOL_TEST_CHUNKS == count_located(&memory_ctx, 0, POOL_TEST_CHUNKS));
+    fz_log(FZ_INFO, "Read connection pool passed");
+    defer:
+        if (opened) fz_ctx_destroy(&ctx);
+        if (memory_opened) fz_ctx_destroy(&memory_ctx);
+        remove_db(POOL_TEST_DB);
+        remove(POOL_TEST_FILTER);
+        remove(POOL_TEST_DIR);
+        return result;
+}
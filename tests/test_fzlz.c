@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_IMPLEMENTATION
+#define JSN_IMPLEMENTATION
+#define STB_DS_IMPLEMENTATION
+#include "core.h"
+#include "fzlz.h"
+
+#define SAMPLE_SIZE KB(64)
+
+
+static void fill_text(char *buffer, size_t size){
+    const char *words[] = {"filezap ", "chunk ", "manifest ", "receiver ", "sender ", "pack ", "\n"};
+    size_t seed = 7;
+    for (size_t i = 0; i < size;){
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        const char *word = words[(seed >> 33) % (sizeof(words) / sizeof(words[0]))];
+        for (size_t j = 0; '\0' != word[j] && i < size; j++) buffer[i++] = word[j];
+    }
+}
+
+
+static void fill_random(char *buffer, size_t size){
+    uint64_t seed = 42;
+    for (size_t i = 0; i < size; i++){
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        buffer[i] = (char)seed;
+    }
+}
+
+
+/* Compresses `src` and checks that the block decodes back to the same bytes, a block that does not fit its bound is a failure */
+static int round_trip(const char *name, const char *src, size_t size, char *block, char *out){
+    size_t n = fzlz_compress(src, size, block, fzlz_compress_bound(size));
+    if (0 == n) {
+        fz_log(FZ_ERROR, "%s: %lu byte(s) did not fit the compress bound", name, size);
+        return 0;
+    }
+    if ((long)size != fzlz_decompress(block, n, out, size) || 0 != memcmp(src, out, size)) {
+        fz_log(FZ_ERROR, "%s: %lu byte(s) did not round trip", name, size);
+        return 0;
+    }
+    return 1;
+}
+
+
+/* A malformed block must be rejected without reading or writing out of bounds, the sanitizer catches the latter */
+static int reject(const char *name, const char *block, size_t size, size_t capacity){
+    char out[64] = {0};
+    if (capacity > sizeof(out)) capacity = sizeof(out);
+    if (-1 != fzlz_decompress(block, size, out, capacity)) {
+        fz_log(FZ_ERROR, "%s: malformed block was accepted", name);
+        return 0;
+    }
+    return 1;
+}
+
+
+int main(int argc, char *argv[]){
+    (void)argc;
+    (void)argv;
+
+    int result = 0;
+    char *src = malloc(SAMPLE_SIZE);
+    char *block = malloc(fzlz_compress_bound(SAMPLE_SIZE));
+    char *out = malloc(SAMPLE_SIZE);
+    char *frame = NULL;
+    size_t frame_alloc = 0, frame_size = 0;
+    if (NULL == src || NULL == block || NULL == out) RETURN_DEFER(1);
+
+    /* Round trips */
+    size_t sizes[] = {0, 1, 5, 12, 13, 17, 255, 4096, 65535, SAMPLE_SIZE};
+    for (size_t i = 0; i < (sizeof(sizes) / sizeof(sizes[0])); i++){
+        fill_text(src, sizes[i]);
+        if (!round_trip("text", src, sizes[i], block, out)) RETURN_DEFER(1);
+        memset(src, 'a', sizes[i]);
+        if (!round_trip("run", src, sizes[i], block, out)) RETURN_DEFER(1);
+        fill_random(src, sizes[i]);
+        if (!round_trip("random", src, sizes[i], block, out)) RETURN_DEFER(1);
+    }
+
+    /* The chunk codec keeps text, refuses random data and only decodes to the exact raw size */
+    fill_text(src, SAMPLE_SIZE);
+    if (!fz_chunk_compress(src, SAMPLE_SIZE, &frame, &frame_alloc, &frame_size)) {
+        fz_log(FZ_ERROR, "Text chunk was not compressed");
+        RETURN_DEFER(1);
+    }
+    if (!fz_chunk_decompress(frame, frame_size, out, SAMPLE_SIZE) || 0 != memcmp(src, out, SAMPLE_SIZE)) {
+        fz_log(FZ_ERROR, "Text chunk did not round trip");
+        RETURN_DEFER(1);
+    }
+    if (fz_chunk_decompress(frame, frame_size, out, SAMPLE_SIZE - 1)) {
+        fz_log(FZ_ERROR, "Chunk decoded into a smaller raw size");
+        RETURN_DEFER(1);
+    }
+    for (size_t cut = 0; cut < frame_size; cut++){
+        if (fz_chunk_decompress(frame, cut, out, SAMPLE_SIZE)) {
+            fz_log(FZ_ERROR, "Chunk truncated to %lu byte(s) was accepted", cut);
+            RETURN_DEFER(1);
+        }
+    }
+    fill_random(src, SAMPLE_SIZE);
+    if (fz_chunk_compress(src, SAMPLE_SIZE, &frame, &frame_alloc, &frame_size)) {
+        fz_log(FZ_ERROR, "Random chunk was compressed");
+        RETURN_DEFER(1);
+    }
+
+    /* Malformed blocks: token, literals, offset low, offset high, match length runs */
+    if (!reject("literals past the input", "\x50" "abc", 4, 64)) RETURN_DEFER(1);
+    if (!reject("literals past the output", "\x40" "abcd", 5, 3)) RETURN_DEFER(1);
+    if (!reject("truncated literal run", "\xf0\xff\xff", 3, 64)) RETURN_DEFER(1);
+    if (!reject("truncated offset", "\x40" "abcd" "\x01", 6, 64)) RETURN_DEFER(1);
+    if (!reject("zero offset", "\x40" "abcd" "\x00\x00" "\x10" "x", 9, 64)) RETURN_DEFER(1);
+    if (!reject("offset before the output", "\x40" "abcd" "\x05\x00" "\x10" "x", 9, 64)) RETURN_DEFER(1);
+    if (!reject("match past the output", "\x4f" "abcd" "\x04\x00" "\x80" "\x10" "x", 10, 64)) RETURN_DEFER(1);
+    if (!reject("truncated match run", "\x4f" "abcd" "\x04\x00" "\xff", 8, 64)) RETURN_DEFER(1);
+
+    /* Random corruption of a valid block must never touch memory outside the buffers */
+    fill_text(src, SAMPLE_SIZE);
+    size_t n = fzlz_compress(src, SAMPLE_SIZE, block, fzlz_compress_bound(SAMPLE_SIZE));
+    uint64_t seed = 99;
+    for (size_t i = 0; i < 4096; i++){
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        size_t at = seed % n;
+        char saved = block[at];
+        block[at] = (char)(seed >> 32);
+        long decoded = fzlz_decompress(block, n, out, SAMPLE_SIZE);
+        block[at] = saved;
+        if (decoded > (long)SAMPLE_SIZE) {
+            fz_log(FZ_ERROR, "Corrupted block decoded past its capacity");
+            RETURN_DEFER(1);
+        }
+    }
+    fz_log(FZ_INFO, "fzlz round trips and malformed blocks passed");
+    defer:
+        if (NULL != src) free(src);
+        if (NULL != block) free(block);
+        if (NULL != out) free(out);
+        if (NULL != frame) free(frame);
+        return result;
+}
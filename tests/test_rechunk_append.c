@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <string.h>
+
+#define XXH_STATIC_LINKING_ONLY
+#define XXH_IMPLEMENTATION
+#define JSN_IMPLEMENTATION
+#define STB_DS_IMPLEMENTATION
+#include "core.h"
+#include <sqlite3.h>
+
+#define TEST_CHUNK_SIZE KB(4)
+
+/* Both contexts chunk the same files, each records its fingerprints in its own database */
+#define APPEND_DB "tmp/rechunk_append.db"
+#define FULL_DB "tmp/rechunk_full.db"
+
+
+typedef struct append_case_t{
+    const char *file_path;
+    size_t initial_size;
+    size_t appended_size;
+} append_case_t;
+
+
+static int write_bytes(const char *file_path, const char *mode, size_t size, uint64_t *seed){
+    FILE *fh = fopen(file_path, mode);
+    if (NULL == fh) return 0;
+    for (size_t i = 0; i < size; i++){
+        *seed ^= *seed << 13; *seed ^= *seed >> 7; *seed ^= *seed << 17;
+        fputc((int)(*seed & 0xff), fh);
+    }
+    return 0 == fclose(fh);
+}
+
+
+static void remove_db(const char *db_file){
+    char path[RESERVED];
+    remove(db_file);
+    snprintf(path, sizeof(path), "%s-wal", db_file);
+    remove(path);
+    snprintf(path, sizeof(path), "%s-shm", db_file);
+    remove(path);
+}
+
+
+/* A fingerprint is only recorded for a file whose last change lies in an earlier second than the chunking */
+static int chunk_settled(fz_ctx_t *ctx, fz_file_manifest_t *mnfst, const char *file_path){
+    sleep(1);
+    return fz_chunk_file(ctx, mnfst, file_path);
+}
+
+
+static int same_manifest(fz_file_manifest_t *a, fz_file_manifest_t *b){
+    if (a->file_size != b->file_size || a->file_checksum != b->file_checksum || a->chunk_root != b->chunk_root) return 0;
+    if (a->chunk_seq.chunk_seq_len != b->chunk_seq.chunk_seq_len) return 0;
+    for (size_t i = 0; i < a->chunk_seq.chunk_seq_len; i++){
+        if (a->chunk_seq.chunk_checksum[i] != b->chunk_seq.chunk_checksum[i]) return 0;
+        if (a->chunk_seq.cutpoint[i] != b->chunk_seq.cutpoint[i] || a->chunk_seq.chunk_size[i] != b->chunk_seq.chunk_size[i]) return 0;
+    }
+    return 1;
+}
+
+
+/* Chunks a file, grows it and checks that continuing the old manifest gives exactly what a full rechunk gives */
+static int run_case(fz_ctx_t *append_ctx, fz_ctx_t *full_ctx, append_case_t *test){
+    int result = 1;
+    uint64_t seed = 0x9e3779b97f4a7c15ull ^ test->initial_size;
+    fz_file_manifest_t before = {0}, appended = {0}, full = {0};
+    fz_file_fingerprint_t last = {0};
+    fz_file_manifest_t recorded = {0};
+    char *hash_state = NULL;
+    size_t hash_state_size = 0;
+
+    if (!write_bytes(test->file_path, "wb", test->initial_size, &seed)) RETURN_DEFER(0);
+    if (!chunk_settled(append_ctx, &before, test->file_path)) RETURN_DEFER(0);
+    if (!fz_query_last_fingerprint(append_ctx, test->file_path, &last, &recorded, &hash_state, &hash_state_size) || 0 == hash_state_size) {
+        fz_log(FZ_ERROR, "No digest state was recorded for `%s`", test->file_path);
+        RETURN_DEFER(0);
+    }
+    if (!write_bytes(test->file_path, "ab", test->appended_size, &seed)) RETURN_DEFER(0);
+    if (!chunk_settled(append_ctx, &appended, test->file_path)) RETURN_DEFER(0);
+    if (!fz_chunk_file(full_ctx, &full, test->file_path)) RETURN_DEFER(0);
+    if (!same_manifest(&appended, &full)) {
+        fz_log(FZ_ERROR, "Appending %lu byte(s) to %lu byte(s) did not match a full rechunk", test->appended_size, test->initial_size);
+        RETURN_DEFER(0);
+    }
+    fz_log(FZ_INFO, "Append of %lu byte(s) to %lu byte(s) matches a full rechunk", test->appended_size, test->initial_size);
+    defer:
+        fz_file_manifest_destroy(&before);
+        fz_file_manifest_destroy(&appended);
+        fz_file_manifest_destroy(&full);
+        fz_file_manifest_destroy(&recorded);
+        if (NULL != hash_state) free(hash_state);
+        remove(test->file_path);
+        return result;
+}
+
+
+int main(int argc, char *argv[]){
+    (void)argc;
+    (void)argv;
+
+    int result = 0;
+    fz_ctx_t append_ctx = {.rechunk_mode = FZ_RECHUNK_APPEND};
+    fz_ctx_t full_ctx = {.rechunk_mode = FZ_RECHUNK_FULL};
+    append_case_t cases[] = {
+        {.file_path = "tmp/append_aligned.bin", .initial_size = 4 * TEST_CHUNK_SIZE, .appended_size = 2 * TEST_CHUNK_SIZE + 100},
+        {.file_path = "tmp/append_unaligned.bin", .initial_size = 3 * TEST_CHUNK_SIZE + 123, .appended_size = TEST_CHUNK_SIZE},
+        {.file_path = "tmp/append_sub_chunk.bin", .initial_size = 100, .appended_size = 50},
+    };
+
+    remove_db(APPEND_DB);
+    remove_db(FULL_DB);
+    if (!fz_ctx_init(&append_ctx, FZ_FIXED_SIZED_CHUNK, "tmp/", "tmp/", APPEND_DB, NULL, NULL)
+        || !fz_ctx_init(&full_ctx, FZ_FIXED_SIZED_CHUNK, "tmp/", "tmp/", FULL_DB, NULL, NULL)){
+        fz_log(FZ_ERROR, "%s: Failed to initialize file zap contexts", __func__);
+        RETURN_DEFER(1);
+    }
+    append_ctx.ctx_attrs.chunk_size = TEST_CHUNK_SIZE;
+    full_ctx.ctx_attrs.chunk_size = TEST_CHUNK_SIZE;
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++){
+        if (!run_case(&append_ctx, &full_ctx, &cases[i])) RETURN_DEFER(1);
+    }
+    defer:
+        fz_ctx_destroy(&append_ctx);
+        fz_ctx_destroy(&full_ctx);
+        remove_db(APPEND_DB);
+        remove_db(FULL_DB);
+        return result;
+}
@@ -47,6 +47,18 @@ int main(int argc, char *argv[]){
             RETURN_DEFER(1);
         }
         fz_log(FZ_INFO, "Receiver context initialized successfully");
+        if (!fz_watcher_start(&recv_fz)){
+            fz_log(FZ_ERROR, "%s: Failed to watch the receiver's recorded files", __func__);
+            RETURN_DEFER(1);
+        }
+        if (!fz_janitor_start(&recv_fz)){
+            fz_log(FZ_ERROR, "%s: Failed to start the receiver's janitor", __func__);
+            RETURN_DEFER(1);
+        }
+        if (!fz_meta_writer_start(&recv_fz)){
+            fz_log(FZ_ERROR, "%s: Failed to start the receiver's metadata writer", __func__);
+            RETURN_DEFER(1);
+        }
         if (!fz_channel_init(&recv_channel, FZ_FIFO, FZ_RECEIVER_MODE)){
             fz_log(FZ_ERROR, "%s: Failed to initialize file zap sender channel", __func__);
             RETURN_DEFER(1);